@@ -55,6 +55,13 @@ void init_cpu() {
         }
         cpus[i].next_slot = 0;
         cpus[i].start_cycle = r_time();
+        cpus[i].timer_deadline = ~0ULL;
+        cpus[i].slice_start = 0;
+        cpus[i].idle = FALSE;
+        cpus[i].ipi_sent = 0;
+        cpus[i].idle_ticks = 0;
+        cpus[i].nr_wakeups = 0;
+        cpus[i].wakeup_ticks = 0;
     }
 }
 
@@ -49,6 +49,16 @@ struct cpu
   int next_slot;
   uint64 start_cycle;
 
+  uint64 asid_generation; // TLB flushed since the ASIDs of this generation were handed out
+
+  uint64 timer_deadline;  // tick the timer is set for, ~0 if none
+  uint64 slice_start;     // tick the running proc was picked at
+  int idle;               // waiting in wfi for work, see make_runnable()
+  uint64 ipi_sent;        // tick the pending wakeup IPI was sent, 0 if none
+  uint64 idle_ticks;      // time spent in wfi
+  uint64 nr_wakeups;      // IPIs that woke it up
+  uint64 wakeup_ticks;    // from sending those IPIs until it ran again
+
 };
 
 // debug print
@@ -82,6 +82,8 @@ static inline void w_sip(uint64 x) { asm volatile("csrw sip, %0"
 #define SIE_SEIE (1L << 9)// external
 #define SIE_STIE (1L << 5)// timer
 #define SIE_SSIE (1L << 1)// software
+
+#define SIP_SSIP (1L << 1)// software interrupt pending, see send_ipi()
 static inline uint64 r_sie() {
     uint64 x;
     asm volatile("csrr %0, sie"
@@ -178,6 +180,9 @@ static inline void w_mtvec(uint64 x) {
 #define SATP_SV39 (8L << 60)
 
 #define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64) pagetable) >> 12))
+#define SATP_ASID_SHIFT 44
+#define SATP_ASID_MASK 0xFFFFL // at most 16 bits, fewer may be implemented
+#define MAKE_SATP_ASID(pagetable, asid) (MAKE_SATP(pagetable) | ((uint64)(asid) << SATP_ASID_SHIFT))
 
 // supervisor address translation and protection;
 // holds the address of the page table.
@@ -312,6 +317,22 @@ static inline void sfence_vma() {
     asm volatile("sfence.vma zero, zero");
 }
 
+// flush the non-global TLB entries of one address space.
+static inline void sfence_vma_asid(uint64 asid) {
+    asm volatile("sfence.vma zero, %0"
+                 :
+                 : "r"(asid)
+                 : "memory");
+}
+
+// flush the TLB entries of one page of one address space.
+static inline void sfence_vma_page(uint64 va, uint64 asid) {
+    asm volatile("sfence.vma %0, %1"
+                 :
+                 : "r"(va), "r"(asid)
+                 : "memory");
+}
+
 #define PGSIZE 4096// bytes per page
 #define PGSHIFT 12// bits of offset within a page
 
@@ -329,6 +350,8 @@ static inline void sfence_vma() {
 #define PTE_G (1L << 5)
 #define PTE_A (1L << 6)
 #define PTE_D (1L << 7)
+#define PTE_COW (1L << 8)// RSW, writable but shared until the first write
+#define PTE_LAZY (1L << 9)// RSW, with V clear: reserved, filled by its VMA on first touch or from swap, see swap.h
 
 #define HAS_BIT(val, bit) (((val) & (bit)) != 0)
 
@@ -344,6 +367,12 @@ static inline void sfence_vma() {
 #define PXSHIFT(level) (PGSHIFT + (9 * (level)))
 #define PX(level, va) ((((uint64)(va)) >> PXSHIFT(level)) & PXMASK)
 
+// a valid PTE with any of R, W, X is a leaf, at level 1 or 2 a superpage
+#define PTE_LEAF(pte) (((pte) & (PTE_R | PTE_W | PTE_X)) != 0)
+#define LEVEL_SIZE(level) (1UL << PXSHIFT(level)) // 4 KiB, 2 MiB, 1 GiB
+#define HUGEPGSIZE LEVEL_SIZE(1)
+#define HUGEPG_ORDER 9 // buddy order of a 2 MiB page
+
 // one beyond the highest possible virtual address.
 // MAXVA is actually one bit less than the max allowed by
 // Sv39, to avoid having to sign-extend virtual addresses
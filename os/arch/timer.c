@@ -2,73 +2,85 @@
 #include <ucore/defs.h>
 #include <ucore/ucore.h>
 #include <proc/proc.h>
+#include <mem/slab.h>
 
 #include "timer.h"
 
-struct timer timer_pool[NTIMER];
+static struct kmem_cache *timer_cachep;
+static struct list_head timer_list; // armed timers
 struct spinlock timers_lock;
 
 void timerinit() {
     init_spin_lock_with_name(&timers_lock, "timer");
-    for (int i = 0; i < NTIMER; i++) {
-        timer_pool[i].wakeup_tick = 0;
-        timer_pool[i].valid = 0;
-        init_spin_lock(&timer_pool[i].guard_lock);
-    }
+    list_init(&timer_list);
+    timer_cachep = kmem_cache_create("timer", sizeof(struct timer));
+    KERNEL_ASSERT(timer_cachep != NULL, "timerinit: can not create timer cache");
 }
 
 struct timer *add_timer(uint64 expires_us) {
-    struct timer *timer = NULL;
-    acquire(&timers_lock);
-    for (int i = 0; i < NTIMER; i++) {
-        acquire(&timer_pool[i].guard_lock);
-        if (!timer_pool[i].valid) {
-            timer = &timer_pool[i];
-            timer->wakeup_tick = get_tick() + US_TO_TICK(expires_us);
-            timer->valid = TRUE;
-            // don't release the guard lock here
-            break;
-        }
-        release(&timer_pool[i].guard_lock);
+    struct timer *timer = kmem_cache_alloc(timer_cachep);
+    if (timer == NULL) {
+        return NULL;
     }
+    init_spin_lock(&timer->guard_lock);
+    timer->wakeup_tick = get_tick() + US_TO_TICK(expires_us);
+    timer->valid = TRUE;
+    timer->fired = FALSE;
+    acquire(&timers_lock);
+    list_add(&timer->list, &timer_list);
+    // don't release the guard lock here
+    acquire(&timer->guard_lock);
     release(&timers_lock);
     return timer;
 }
 
+// Disarm and free a timer returned by add_timer.
 int del_timer(struct timer *timer) {
+    acquire(&timers_lock);
     acquire(&timer->guard_lock);
     if (!timer->valid) {
         infof("del_timer: timer %p is not valid\n", timer);
         release(&timer->guard_lock);
+        release(&timers_lock);
         return -1;
     }
     timer->valid = FALSE;
+    list_del(&timer->list);
     release(&timer->guard_lock);
+    release(&timers_lock);
+    kmem_cache_free(timer_cachep, timer);
     return 0;
 }
 
 void try_wakeup_timer() {
     uint64 tick = get_tick();
+    struct list_head *pos;
     acquire(&timers_lock);
-    for (int i = 0; i < NTIMER; i++) {
-        acquire(&timer_pool[i].guard_lock);
-        if (timer_pool[i].valid && tick >= timer_pool[i].wakeup_tick) {
-            wakeup(&timer_pool[i]);
+    list_for_each(pos, &timer_list) {
+        struct timer *timer = list_entry(pos, struct timer, list);
+        acquire(&timer->guard_lock);
+        if (timer->valid && !timer->fired && tick >= timer->wakeup_tick) {
+            timer->fired = TRUE;
+            wakeup(timer);
         }
-        release(&timer_pool[i].guard_lock);
+        release(&timer->guard_lock);
     }
     release(&timers_lock);
 }
 
+// The nearest tick a timer still has to fire at. A fired timer stays on the
+// list until its sleeper runs, an interrupt for it would come right away again.
 uint64 get_min_wakeup_tick() {
     uint64 min_tick = ~0ULL;
+    struct list_head *pos;
     acquire(&timers_lock);
-    for (int i = 0; i < NTIMER; i++) {
-        acquire(&timer_pool[i].guard_lock);
-        if (timer_pool[i].valid && timer_pool[i].wakeup_tick < min_tick) {
-            min_tick = timer_pool[i].wakeup_tick;
+    list_for_each(pos, &timer_list) {
+        struct timer *timer = list_entry(pos, struct timer, list);
+        acquire(&timer->guard_lock);
+        if (timer->valid && !timer->fired && timer->wakeup_tick < min_tick) {
+            min_tick = timer->wakeup_tick;
         }
-        release(&timer_pool[i].guard_lock);
+        release(&timer->guard_lock);
     }
     release(&timers_lock);
     return min_tick;
@@ -83,13 +95,24 @@ void stop_timer_interrupt(){
     w_sie(r_sie() & ~SIE_STIE);
 }
 
-/// Set the next timer interrupt (10 ms)
+/// Set the next timer interrupt, for the nearest timer or when the
+/// running proc has to make way for someone waiting for this hart,
+/// see preempt_deadline(). Without either no interrupt comes.
+/// Neither may be in the past once handled: should_preempt() is what
+/// the trap handlers act on, and a fired timer must not count, or
+/// the hart traps back to back until the slice ends.
 void set_next_timer() {
-    // 100Hz @ QEMU
-    const uint64 timebase = TICK_FREQ / TIME_SLICE_PER_SEC; // how many ticks
-    uint64 slice_tick = r_time() + timebase;
     uint64 timer_tick = get_min_wakeup_tick();
-    set_timer(slice_tick < timer_tick ? slice_tick : timer_tick);
+    push_off();
+    struct cpu *c = mycpu();
+    if (c->proc != NULL) {
+        uint64 preempt_tick = preempt_deadline();
+        if (preempt_tick < timer_tick)
+            timer_tick = preempt_tick;
+    }
+    c->timer_deadline = timer_tick;
+    set_timer(timer_tick);
+    pop_off();
 }
 
 
@@ -3,9 +3,12 @@
 
 #include <ucore/defs.h>
 #include <lock/lock.h>
+#include <utils/list.h>
 #define TIME_SLICE_PER_SEC 100    // 10 ms
+#define TIME_SLICE_TICKS (TICK_FREQ / TIME_SLICE_PER_SEC)
 #define MSEC_PER_SEC 1000    // 1s = 1000 ms
 #define USEC_PER_SEC 1000000 // 1s = 1000000 us
+#define NSEC_PER_SEC 1000000000 // 1s = 1000000000 ns
 
 #define TICK_FREQ 1000000    // 1 MHz   FUF740-C000 for csr time
 #define TICK_TO_MS(tick) ((tick) / (TICK_FREQ / MSEC_PER_SEC))
@@ -20,8 +23,6 @@
 #define MS_TO_CYCLE(ms) ((ms) * (CYCLE_FREQ / MSEC_PER_SEC))
 #define SECOND_TO_CYCLE(sec) ((sec)*CYCLE_FREQ)
 
-#define NTIMER 10
-
 struct timeval {
     uint64 tv_sec;
     uint64 tv_usec;
@@ -40,7 +41,9 @@ struct timezone {
 struct timer {
     uint64 wakeup_tick;
     bool valid;
+    bool fired; // the sleeper was woken, it only has to del_timer() now
     struct spinlock guard_lock;
+    struct list_head list; // in the armed timer list
 };
 
 struct tm {
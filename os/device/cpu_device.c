@@ -1,11 +1,18 @@
 #include <arch/cpu.h>
 #include <file/file.h>
+#include <proc/scheduler.h>
 
 struct cpu_stat
 {
     uint64 uptime;
     uint64 sample_duration;
     uint64 sample_busy_duration;
+    uint64 nr_queued;     // procs waiting in its run queue
+    uint64 nr_migrations; // procs it stole from other harts
+    uint64 idle_time;     // us spent waiting for work
+    uint64 nr_wakeups;    // times another hart woke it up for work
+    uint64 wakeup_time;   // us from those wakeups until it ran
+    uint64 nr_rt_throttled; // periods real-time procs used up their budget in
 };
 
 int64 cpu_write(char *src, int64 len, int from_user)
@@ -42,6 +49,12 @@ int64 cpu_read(char *dst, int64 len, int to_user)
         stat_buf[i].sample_duration = all_average;
         stat_buf[i].sample_busy_duration = busy_average;
         stat_buf[i].uptime = r_time()-cpus[i].start_cycle;
+        stat_buf[i].nr_queued = __atomic_load_n(&runqueues[i].nr_queued, __ATOMIC_RELAXED);
+        stat_buf[i].nr_migrations = runqueues[i].nr_migrations;
+        stat_buf[i].idle_time = TICK_TO_US(cpus[i].idle_ticks);
+        stat_buf[i].nr_wakeups = cpus[i].nr_wakeups;
+        stat_buf[i].wakeup_time = TICK_TO_US(cpus[i].wakeup_ticks);
+        stat_buf[i].nr_rt_throttled = runqueues[i].nr_rt_throttled;
 
     }
 
@@ -2,6 +2,11 @@
 #include <ucore/defs.h>
 #include "meminfo_device.h"
 #include <mem/string.h>
+#include <mem/physical.h>
+#include <mem/slab.h>
+#include <mem/swap.h>
+#include <mem/swapfile.h>
+#include <mem/zram.h>
 
 void meminfo_device_init() {
     device_handler[MEMINFO_DEVICE].read = meminfo_read;
@@ -12,11 +17,25 @@ int64 meminfo_write(char *src, int64 len, int from_user) {
     return 0;
 }
 
-static void append_info(char *buf, char *title, int value, char *unit) {
+// decimal digits of n into s, with room for up to 20 digits and the nul
+static char *format_u64(uint64 n, char *s) {
+    char digits[20];
+    int i = 0;
+    do {
+        digits[i++] = n % 10 + '0';
+    } while ((n /= 10) > 0);
+    char *t = s;
+    while (i > 0)
+        *t++ = digits[--i];
+    *t = '\0';
+    return s;
+}
+
+static void append_info(char *buf, char *title, uint64 value, char *unit) {
     strcat(buf, title);
     strcat(buf, ": ");
-    char svalue[16];
-    itoa(value, svalue, 10);
+    char svalue[21];
+    format_u64(value, svalue);
     strcat(buf, svalue);
     strcat(buf, " ");
     strcat(buf, unit);
@@ -24,8 +43,57 @@ static void append_info(char *buf, char *title, int value, char *unit) {
 }
 
 int64 meminfo_read(char *dst, int64 len, int to_user) {
-    char buf[1024];
+    char buf[2048];
+    buf[0] = '\0';
     append_info(buf, "MemAvailable", get_free_page_count() * 4, "kB");
+    append_info(buf, "Slab", get_slab_page_count() * 4, "kB");
+    struct zero_pool_stat zstat;
+    get_zero_pool_stat(&zstat);
+    append_info(buf, "ZeroPool", zstat.count * 4, "kB");
+    append_info(buf, "ZeroPoolHit", zstat.hit, "");
+    append_info(buf, "ZeroPoolMiss", zstat.miss, "");
+    struct zram_stat zrstat;
+    get_zram_stat(&zrstat);
+    append_info(buf, "Zram", zrstat.stored * 4, "kB");
+    append_info(buf, "ZramSameFilled", zrstat.same_filled * 4, "kB");
+    append_info(buf, "ZramCompressed", zrstat.compressed / 1024, "kB");
+    append_info(buf, "ZramUsed", zrstat.used / 1024, "kB");
+    append_info(buf, "ZramRejected", zrstat.rejected, "pages");
+    struct swap_stat sstat;
+    get_swap_stat(&sstat);
+    append_info(buf, "SwapOut", sstat.swap_out, "pages");
+    append_info(buf, "SwapIn", sstat.swap_in, "pages");
+    append_info(buf, "SwapTotal", swapfile_slots() * 4, "kB");
+    append_info(buf, "SwapFree", swapfile_free_slots() * 4, "kB");
+    uint64 nr_free[BUDDY_MAX_ORDER + 1];
+    get_buddy_stat(nr_free);
+    for (int i = 0; i <= BUDDY_MAX_ORDER; i++) {
+        char title[32] = "BuddyOrder";
+        char id[21];
+        format_u64(i, id);
+        strcat(title, id);
+        append_info(buf, title, nr_free[i], "blocks");
+    }
+    for (int i = 0; i < NCPU; i++) {
+        struct magazine_stat stat;
+        get_magazine_stat(i, &stat);
+        char title[32] = "Magazine";
+        char id[21];
+        format_u64(i, id);
+        strcat(title, id);
+        int base = strlen(title);
+        strcat(title, "Hit");
+        append_info(buf, title, stat.hit, "");
+        title[base] = '\0';
+        strcat(title, "Miss");
+        append_info(buf, title, stat.miss, "");
+        title[base] = '\0';
+        strcat(title, "Refill");
+        append_info(buf, title, stat.refill, "");
+        title[base] = '\0';
+        strcat(title, "Drain");
+        append_info(buf, title, stat.drain, "");
+    }
     infof("meminfo: %s", buf);
     return either_copyout(dst, buf, strlen(buf), to_user);
 }
@@ -13,6 +13,8 @@ struct proc_stat
     uint64 heap_sz;
     uint64 total_size;
     uint64 cpu_time; // ms, user and kernel
+    uint64 nr_migrations; // times it ran on another hart than the last time
+    int last_cpu;         // hart it last ran on, -1 if none
 };
 
 int64 proc_write(char *src, int64 len, int from_user)
@@ -53,6 +55,8 @@ int64 proc_read(char *dst, int64 len, int to_user)
             stat_buf[cnt].total_size = p->total_size;
             stat_buf[cnt].cpu_time = p->kernel_time + p->user_time;
             stat_buf[cnt].state = p->state;
+            stat_buf[cnt].nr_migrations = p->nr_migrations;
+            stat_buf[cnt].last_cpu = p->last_cpu;
             cnt++;
         }
         release(&p->lock);
@@ -11,5 +11,17 @@ int64 zero_write(char *src, int64 len, int from_user) {
 }
 
 int64 zero_read(char *dst, int64 len, int to_user) {
-    return either_memset(dst, 0, len, to_user) == -1 ? 0 : len;
+    uint64 va = (uint64)dst, end = va + len;
+    while (va < end) {
+        // whole pages of private memory just get the zero page
+        if (to_user && va % PGSIZE == 0 && end - va >= PGSIZE && uvm_map_zero_page(curr_proc(), va) == 0) {
+            va += PGSIZE;
+            continue;
+        }
+        uint64 n = MIN(PGROUNDDOWN(va) + PGSIZE, end) - va;
+        if (either_memset((char *)va, 0, n, to_user) == -1)
+            return 0;
+        va += n;
+    }
+    return len;
 }
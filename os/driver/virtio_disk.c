@@ -61,7 +61,7 @@ static struct disk {
     // indexed by first descriptor index of chain.
     struct
     {
-        struct buf *b;
+        int *busy; // cleared when the request is done, also the wait channel
         char status;
     } info[NUM];
 
@@ -194,11 +194,9 @@ alloc3_desc(int *idx) {
 
 extern int PID;
 
-void virtio_disk_rw(struct buf *b, int write) {
-//    debugcore("virtio_disk_rw w=%d", write);
-    uint64 sector = b->blockno * (BSIZE / 512);
-
-    acquire(&disk.vdisk_lock);
+// Transfer len bytes between data and the disk from sector on,
+// sleeping until the device is done. Called with vdisk_lock held.
+static void virtio_disk_request(void *data, uint64 sector, uint32 len, int write, int *busy) {
     // the spec's Section 5.2 says that legacy block operations use
     // three descriptors: one for type/reserved/sector, one for the
     // data, one for a 1-byte status result.
@@ -227,8 +225,8 @@ void virtio_disk_rw(struct buf *b, int write) {
     disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
     disk.desc[idx[0]].next = idx[1];
 
-    disk.desc[idx[1]].addr = (uint64)b->data;
-    disk.desc[idx[1]].len = BSIZE;
+    disk.desc[idx[1]].addr = (uint64)data;
+    disk.desc[idx[1]].len = len;
     if (write)
         disk.desc[idx[1]].flags = 0; // device reads b->data
     else
@@ -242,9 +240,9 @@ void virtio_disk_rw(struct buf *b, int write) {
     disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
     disk.desc[idx[2]].next = 0;
 
-    // record struct buf for virtio_disk_intr().
-    b->disk_is_reading = 1;
-    disk.info[idx[0]].b = b;
+    // record the wait channel for virtio_disk_intr().
+    *busy = 1;
+    disk.info[idx[0]].busy = busy;
 
     // tell the device the first index in our chain of descriptors.
     disk.avail->ring[disk.avail->idx % NUM] = idx[0];
@@ -259,13 +257,30 @@ void virtio_disk_rw(struct buf *b, int write) {
     *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
 
     // Wait for virtio_disk_intr() to say request has finished.
-    while (b->disk_is_reading == 1) {
-        sleep(b, &disk.vdisk_lock);
+    while (*busy == 1) {
+        sleep(busy, &disk.vdisk_lock);
     }
 
     // infof("wait for intr over = %d\n", intr_get());
-    disk.info[idx[0]].b = 0;
+    disk.info[idx[0]].busy = 0;
     free_chain(idx[0]);
+}
+
+void virtio_disk_rw(struct buf *b, int write) {
+//    debugcore("virtio_disk_rw w=%d", write);
+    acquire(&disk.vdisk_lock);
+    virtio_disk_request(b->data, b->blockno * (BSIZE / 512), BSIZE, write, &b->disk_is_reading);
+    release(&disk.vdisk_lock);
+}
+
+/**
+ * @brief Transfer nsect sectors from sector on in one request,
+ * bypassing the buffer cache. data must be physically contiguous.
+ */
+void virtio_disk_rw_sectors(void *data, uint64 sector, uint32 nsect, int write) {
+    int busy;
+    acquire(&disk.vdisk_lock);
+    virtio_disk_request(data, sector, nsect * 512, write, &busy);
     release(&disk.vdisk_lock);
 }
 
@@ -293,10 +308,10 @@ void virtio_disk_intr() {
         if (disk.info[id].status != 0)
             panic("virtio_disk_intr status");
 
-        struct buf *b = disk.info[id].b;
-        b->disk_is_reading = 0; // disk is done with buf
+        int *busy = disk.info[id].busy;
+        *busy = 0; // disk is done with the data
         // debugcore("wakeup start");
-        wakeup(b);
+        wakeup(busy);
         // debugcore("wakeup end");
         disk.used_idx += 1;
     }
@@ -147,6 +147,38 @@ DRESULT disk_write (
 #endif
 
 
+/*-----------------------------------------------------------------------*/
+/* Read or Write Sector(s) past the buffer cache, for the swap file      */
+/*-----------------------------------------------------------------------*/
+
+DRESULT disk_rw_direct (
+	BYTE pdrv,		/* Physical drive nmuber to identify the drive */
+	BYTE *buff,		/* Physically contiguous data buffer */
+	LBA_t sector,	/* Start sector in LBA */
+	UINT count,		/* Number of sectors */
+	int write		/* Write the disk if nonzero */
+)
+{
+	int result;
+
+    if (pdrv != DEV_MMC){
+        return RES_PARERR;
+    }
+
+#ifndef QEMU
+    if (write)
+        result = sd_write_blocks(spictrl, buff, sector, count);
+    else
+        result = sd_read_blocks(spictrl, buff, sector, count);
+#else
+    // one request for the whole range, the device does the splitting
+    virtio_disk_rw_sectors(buff, sector, count, write);
+    result = 0;
+#endif
+    return result == 0 ? RES_OK : RES_ERROR;
+}
+
+
 /*-----------------------------------------------------------------------*/
 /* Miscellaneous Functions                                               */
 /*-----------------------------------------------------------------------*/
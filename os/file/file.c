@@ -6,14 +6,15 @@
 #include <ucore/types.h>
 #include <device/console.h>
 #include <file/stat.h>
+#include <mem/slab.h>
 /**
  * @brief The global file pool
- * Every opened file is kept here in system level
+ * Every opened file is allocated from here in system level
  * Process files are pointing here.
  * 
  */
 struct {
-    struct file files[FILE_MAX];    // system level files
+    struct kmem_cache *cachep;      // system level files
     struct spinlock lock;
 } filepool;
 struct device_handler device_handler[NDEV];
@@ -50,6 +51,8 @@ void device_init() {
  */
 void fileinit() {
     init_spin_lock_with_name(&filepool.lock, "filepool.lock");
+    filepool.cachep = kmem_cache_create("file", sizeof(struct file));
+    KERNEL_ASSERT(filepool.cachep != NULL, "fileinit: can not create file cache");
     device_init();
 }
 
@@ -74,6 +77,7 @@ void fileclose(struct file *f) {
     f->ref = 0;
     f->type = FD_NONE;
     release(&filepool.lock);
+    kmem_cache_free(filepool.cachep, f);
 
     if (ff.type == FD_PIPE) {
         pipeclose(ff.pipe, ff.writable);
@@ -88,24 +92,22 @@ void fileclear(struct file *f) {
     KERNEL_ASSERT(f->ref == 0, "file reference should be 0");
     f->type = FD_NONE;
     release(&filepool.lock);
+    kmem_cache_free(filepool.cachep, f);
 }
 
 /**
- * @brief Scans the file table for an unreferenced file
+ * @brief Allocate a new file with ref 1
  * 
- * @return struct file* the unreferenced file, or NULL if all used
+ * @return struct file* the new file, or NULL if out of memory
  */
 struct file *filealloc() {
-    acquire(&filepool.lock);
-    for (int i = 0; i < FILE_MAX; ++i) {
-        if (filepool.files[i].ref == 0) {
-            filepool.files[i].ref = 1;
-            release(&filepool.lock);
-            return &filepool.files[i];
-        }
-    }
-    release(&filepool.lock);
-    return NULL;
+    struct file *f = kmem_cache_alloc(filepool.cachep);
+    if (f == NULL)
+        return NULL;
+    memset(f, 0, sizeof(struct file));
+    f->type = FD_NONE;
+    f->ref = 1;
+    return f;
 }
 
 struct inode * create(char *path, short type, short major, short minor) {
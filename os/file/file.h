@@ -98,7 +98,6 @@ int filelseek(struct file *f, off_t offset, int whence);
 int filepath(struct file *file, char *path);
 int filerename(struct file *file, char *new_path);
 int fileioctl(struct file *f, int cmd, void *arg);
-#define FILE_MAX (128 * 16)
 
 #define CONSOLE 1
 #define CPU_DEVICE 2
@@ -17,28 +17,46 @@
 #include <fs/buf.h>
 #include <fs/fs.h>
 #include <lock/lock.h>
+#include <mem/slab.h>
 #include <ucore/defs.h>
 #include <ucore/types.h>
 #include <ucore/ucore.h>
 struct {
     struct spinlock lock;
-    struct buf buf[NBUF];
+    struct kmem_cache *cachep;
+    uint nbuf;                            // capacity, scales with RAM
     struct buf head;
+    struct list_head hash[BUF_HASH_SIZE]; // cached blocks
 } bcache;
 
+static uint buf_hash(uint dev, uint blockno) {
+    return (dev ^ blockno) % BUF_HASH_SIZE;
+}
+
 void binit(void) {
     struct buf *b;
     init_spin_lock_with_name(&bcache.lock, "bcache.lock");
+    bcache.cachep = kmem_cache_create("buf", sizeof(struct buf));
+    KERNEL_ASSERT(bcache.cachep != NULL, "binit: can not create buf cache");
+    for (int i = 0; i < BUF_HASH_SIZE; i++) {
+        list_init(&bcache.hash[i]);
+    }
     // Create linked list of buffers
     bcache.head.prev = &bcache.head;
     bcache.head.next = &bcache.head;
-    for (b = bcache.buf; b < bcache.buf + NBUF; b++) {
+    bcache.nbuf = MAX(NBUF, get_free_page_count() / BUF_RAM_RATIO);
+    for (uint i = 0; i < bcache.nbuf; i++) {
+        b = kmem_cache_alloc(bcache.cachep);
+        KERNEL_ASSERT(b != NULL, "binit: out of memory");
+        memset(b, 0, sizeof(*b));
+        list_init(&b->hash);
         b->next = bcache.head.next;
         b->prev = &bcache.head;
         init_mutex(&b->mu);
         bcache.head.next->prev = b;
         bcache.head.next = b;
     }
+    infof("buffer cache: %d buffers", bcache.nbuf);
 }
 
 // Look through buffer cache for block on device dev.
@@ -50,7 +68,9 @@ acquire_buf(uint dev, uint blockno) {
     acquire(&bcache.lock);
 
     // Is the block already cached?
-    for (b = bcache.head.next; b != &bcache.head; b = b->next) {
+    struct list_head *pos;
+    list_for_each(pos, &bcache.hash[buf_hash(dev, blockno)]) {
+        b = list_entry(pos, struct buf, hash);
         if (b->dev == dev && b->blockno == blockno) {
             b->refcnt++;
             release(&bcache.lock);
@@ -67,6 +87,7 @@ acquire_buf(uint dev, uint blockno) {
             b->blockno = blockno;
             b->valid = 0;
             b->refcnt = 1;
+            list_move(&b->hash, &bcache.hash[buf_hash(dev, blockno)]);
             release(&bcache.lock);
             acquire_mutex_sleep(&b->mu);
             return b;
@@ -4,6 +4,11 @@
 #include <fs/fs.h>
 #include <ucore/types.h>
 #include <lock/lock.h>
+#include <utils/list.h>
+
+#define BUF_HASH_SIZE 64
+#define BUF_RAM_RATIO 512 // one buffer per 512 free pages, at least NBUF
+
 struct buf
 {
     int valid; // has data been read from disk?
@@ -14,6 +19,7 @@ struct buf
     uint refcnt;
     struct buf *prev; // LRU cache list
     struct buf *next;
+    struct list_head hash; // in bcache.hash, keyed by dev and blockno
     uchar data[BSIZE];
 };
 
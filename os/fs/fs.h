@@ -8,12 +8,10 @@
 // Both the kernel and user programs use this header file.
 
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
-#define NCACHE       200 // page cache size
 #define NDEV         11  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define NBUF         (MAXOPBLOCKS*3)  // minimum size of disk block cache
 #define FSSIZE       1000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
 
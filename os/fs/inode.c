@@ -2,25 +2,85 @@
 #include <fs/fs.h>
 #include <fs/buf.h>
 #include <proc/proc.h>
+#include <mem/slab.h>
+#include <mem/physical.h>
+#include <mem/shrinker.h>
+
+#define INODE_HASH_SIZE 64
+#define CTABLE_HASH_MIN 256 // buckets, grows to about max_cache / CTABLE_HASH_LOAD
+#define CTABLE_HASH_LOAD 4
+#define CTABLE_RAM_RATIO 16 // at most 1/16 of free memory for the page cache
+#define READAHEAD_QUEUE 16  // pending asynchronous readahead requests
 
 struct {
     struct mutex lock;
-    struct inode inode[NINODE];
+    struct kmem_cache *cachep;
+    struct list_head hash[INODE_HASH_SIZE]; // in-memory inodes, hashed by path
 } itable;
 
 struct {
     struct mutex lock;
-    struct page_cache cache[NCACHE];
-    struct page_cache* lru[NCACHE];
+    struct kmem_cache *cachep;
+    struct list_head lru;                    // most recently used first
+    struct list_head *hash;                  // hashed by host and offset
+    uint hash_size;                          // power of two
+    uint nr_cache;
+    uint max_cache;                          // capacity, scales with RAM
 } ctable;
 
+// Asynchronous readahead requests, served in order by kreadaheadd.
+struct readahead_req {
+    struct inode *ip; // holds a reference
+    uint offset;
+    uint npages;
+};
+
+struct {
+    struct spinlock lock;
+    struct readahead_req req[READAHEAD_QUEUE];
+    uint head, tail; // req[head] up to req[tail] are pending, modulo READAHEAD_QUEUE
+} ra;
+
 static int cache_writeback(struct page_cache* cache);
 
+static uint ctable_hash(struct inode *ip, uint offset) {
+    return (((uint64)ip >> 4) ^ (offset >> PGSHIFT)) & (ctable.hash_size - 1);
+}
+
+// The following ctable_* helpers should hold ctable.lock
+
+static struct page_cache *ctable_lookup(struct inode *ip, uint offset) {
+    struct list_head *pos;
+    list_for_each(pos, &ctable.hash[ctable_hash(ip, offset)]) {
+        struct page_cache *cache = list_entry(pos, struct page_cache, hash);
+        if (cache->host == ip && cache->offset == offset) {
+            return cache;
+        }
+    }
+    return NULL;
+}
+
+static void ctable_add(struct page_cache *cache) {
+    list_add(&cache->lru, &ctable.lru);
+    list_add(&cache->hash, &ctable.hash[ctable_hash(cache->host, cache->offset)]);
+    ctable.nr_cache++;
+}
+
+static void ctable_remove(struct page_cache *cache) {
+    list_del(&cache->lru);
+    list_del(&cache->hash);
+    ctable.nr_cache--;
+    kmem_cache_free(ctable.cachep, cache);
+}
+
 static int ctable_lru_evict() {
 //    infof("ctable_lru_evict");
-    for (int i = NCACHE - 1; i>=0;i--) {
-        struct page_cache* cache = ctable.lru[i];
-        if (cache &&                                        // cache entry exists
+    struct list_head *pos, *n;
+    list_for_each_prev_safe(pos, n, &ctable.lru) {
+        struct page_cache *cache = list_entry(pos, struct page_cache, lru);
+        // cache->lock is only acquired with ctable.lock held, ctable_sync() included,
+        // so it can't become locked under us
+        if (!cache->lock.locked &&                      // nobody is using it
             get_physical_page_ref(cache->page) == 1) {  // cache page is not shared
 
             // if dirty, write back to disk
@@ -32,15 +92,7 @@ static int ctable_lru_evict() {
             // dereference inode
             iput(cache->host);
 
-            // clear the cache entry
-            memset(cache, 0, sizeof(struct page_cache));
-
-            // move cache entry from back to front
-            for (int j = i; j < NCACHE - 1; j++) {
-                ctable.lru[j] = ctable.lru[j+1];
-            }
-            ctable.lru[NCACHE - 1] = NULL;
-
+            ctable_remove(cache);
             return 0;
         }
     }
@@ -48,50 +100,6 @@ static int ctable_lru_evict() {
     return -1;
 }
 
-static int ctable_lru_add(struct page_cache* cache) {
-//    infof("ctable_lru_add");
-    int i;
-    if (ctable.lru[NCACHE-1] != NULL && ctable_lru_evict() < 0) {
-        infof("ctable_lru_add: ctable_lru_evict error");
-        return -1;
-    }
-    for (i = NCACHE - 1; i > 0; i--) {
-        ctable.lru[i] = ctable.lru[i-1];
-    }
-    ctable.lru[0] = cache;
-    return 0;
-}
-
-static int ctable_lru_remove(struct page_cache* cache) {
-//    infof("ctable_lru_remove");
-    for (int i = 0; i < NCACHE; i++) {
-        if (ctable.lru[i] == cache) {
-            for (int j = i; j < NCACHE - 1; j++) {
-                ctable.lru[j] = ctable.lru[j+1];
-            }
-            ctable.lru[NCACHE - 1] = NULL;
-            return 0;
-        }
-    }
-    infof("ctable_lru_remove: cache not found");
-    return -1;
-}
-
-static int ctable_lru_adjust(struct page_cache* cache) {
-//    infof("ctable_lru_adjust");
-    for (int i = 0; i < NCACHE; i++) {
-        if (ctable.lru[i] == cache) {
-            for (int j = i; j > 0; j--) {
-                ctable.lru[j] = ctable.lru[j-1];
-            }
-            ctable.lru[0] = cache;
-            return 0;
-        }
-    }
-    infof("ctable_lru_adjust: cache not found");
-    return -1;
-}
-
 struct page_cache* ctable_acquire(struct inode* ip, uint offset) {
 //    infof("ctable_acquire, ip: %p, offset: %d", ip, offset);
     KERNEL_ASSERT(ip != NULL, "inode is NULL");
@@ -101,45 +109,38 @@ struct page_cache* ctable_acquire(struct inode* ip, uint offset) {
 
     acquire_mutex_sleep(&ctable.lock);
     // reuse cache if it is already in the cache
-    for (cache = ctable.cache; cache < ctable.cache + NCACHE; cache++) {
-        acquire_mutex_sleep(&cache->lock);
-        if (cache->valid && cache->host == ip && cache->offset == offset) {
-//            infof("reuse cache");
-            ctable_lru_adjust(cache);
-            release_mutex_sleep(&ctable.lock);
-            return cache;
-        }
-        release_mutex_sleep(&cache->lock);
-    }
-    // if not, find an empty cache
-    int first_chance = 1;
-find_again:
-    for (cache = ctable.cache; cache < ctable.cache + NCACHE; cache++) {
+    if ((cache = ctable_lookup(ip, offset)) != NULL) {
+//        infof("reuse cache");
         acquire_mutex_sleep(&cache->lock);
-        if (!cache->valid) {
-//            infof("create cache");
-            cache->host = ip;
-            cache->offset = offset;
-            cache->valid = TRUE;
-            cache->dirty = FALSE;
-            cache->page = alloc_physical_page();
-            memset(cache->page, 0, PGSIZE);
-            release_mutex_sleep(&ctable.lock);
-            goto read_page;
-        }
-        release_mutex_sleep(&cache->lock);
+        list_move(&cache->lru, &ctable.lru);
+        release_mutex_sleep(&ctable.lock);
+        return cache;
     }
-    if (first_chance) {
-        first_chance = 0;
-        ctable_lru_evict();
-        goto find_again;
-    } else {
+    // if not, make room and create one
+    if (ctable.nr_cache >= ctable.max_cache && ctable_lru_evict() < 0) {
         release_mutex_sleep(&ctable.lock);
         infof("ctable_acquire: no free space");
         return NULL;
     }
+    if ((cache = kmem_cache_alloc(ctable.cachep)) == NULL) {
+        release_mutex_sleep(&ctable.lock);
+        infof("ctable_acquire: no memory for cache entry");
+        return NULL;
+    }
+    init_mutex(&cache->lock);
+    acquire_mutex_sleep(&cache->lock);
+    cache->host = ip;
+    cache->offset = offset;
+    cache->valid = TRUE;
+    cache->dirty = FALSE;
+    cache->page = alloc_zeroed_page();
+    if (cache->page == NULL) {
+        infof("ctable_acquire: no memory for cache page");
+        goto free_cache;
+    }
+    set_page_owner(cache->page, PG_CACHE, cache);
 
-read_page:
+    // the page is read with ctable.lock held, so nobody can find it half filled
     if (f_lseek(&ip->file, offset) != FR_OK) {
         infof("ctable_acquire: invalid offset");
         goto read_page_err;
@@ -152,17 +153,16 @@ read_page:
     }
 
     idup(ip);
-    ctable_lru_add(cache);
+    ctable_add(cache);
+    release_mutex_sleep(&ctable.lock);
     return cache;
 
 read_page_err:
-    cache->host = NULL;
-    cache->offset = 0;
-    cache->valid = FALSE;
-    cache->dirty = FALSE;
     recycle_physical_page(cache->page);
-    cache->page = NULL;
+free_cache:
     release_mutex_sleep(&cache->lock);
+    kmem_cache_free(ctable.cachep, cache);
+    release_mutex_sleep(&ctable.lock);
     return NULL;
 }
 
@@ -186,6 +186,102 @@ static int cache_writeback(struct page_cache* cache) {
     return 0;
 }
 
+// A shared file mapping has written to pa, a page cache page.
+void ctable_mark_dirty(void *pa) {
+    struct page *page = pa_to_page(pa);
+    KERNEL_ASSERT(page->flags & PG_CACHE, "ctable_mark_dirty: not a page cache page");
+    struct page_cache *cache = page->owner;
+    cache->dirty = TRUE;
+}
+
+// Write the page cache page pa back to disk if it is dirty.
+// It must be mapped by the caller, so that it can't be evicted.
+// ctable.lock is held as well, since ctable_acquire() moves the
+// position of the same FIL under it.
+int ctable_sync(void *pa) {
+    struct page *page = pa_to_page(pa);
+    KERNEL_ASSERT(page->flags & PG_CACHE, "ctable_sync: not a page cache page");
+    struct page_cache *cache = page->owner;
+    int ret = 0;
+    acquire_mutex_sleep(&ctable.lock);
+    acquire_mutex_sleep(&cache->lock);
+    if (cache->dirty) {
+        ret = cache_writeback(cache);
+        if (ret == 0)
+            cache->dirty = FALSE;
+    }
+    release_mutex_sleep(&cache->lock);
+    release_mutex_sleep(&ctable.lock);
+    return ret;
+}
+
+// Whether the page of ip at offset is in the page cache, for mincore().
+int ctable_cached(struct inode *ip, uint offset) {
+    acquire_mutex_sleep(&ctable.lock);
+    int cached = ctable_lookup(ip, offset) != NULL;
+    release_mutex_sleep(&ctable.lock);
+    return cached;
+}
+
+/**
+ * @brief Bring npages pages of ip from offset on into the page cache,
+ * up to the end of the file. Cached pages only move up the LRU.
+ */
+void ctable_readahead(struct inode *ip, uint offset, uint npages) {
+    // never push out more than a part of the cache
+    npages = MIN(npages, ctable.max_cache / 4);
+    uint64 end = MIN((uint64)offset + (uint64)npages * PGSIZE, PGROUNDUP(f_size(&ip->file)));
+    for (uint64 off = offset; off < end; off += PGSIZE) {
+        struct page_cache *cache = ctable_acquire(ip, off);
+        if (cache == NULL) {
+            return;
+        }
+        release_mutex_sleep(&cache->lock);
+    }
+}
+
+/**
+ * @brief ctable_readahead() done by kreadaheadd while the caller goes on.
+ * It is only a hint, dropped when too many requests are pending.
+ */
+void ctable_readahead_async(struct inode *ip, uint offset, uint npages) {
+    // idup() may sleep, so take the reference first
+    ip = idup(ip);
+    acquire(&ra.lock);
+    if (ra.tail - ra.head < READAHEAD_QUEUE) {
+        struct readahead_req *r = &ra.req[ra.tail++ % READAHEAD_QUEUE];
+        r->ip = ip;
+        r->offset = offset;
+        r->npages = npages;
+        ip = NULL;
+        wakeup(&ra);
+    }
+    release(&ra.lock);
+    if (ip != NULL) {
+        iput(ip);
+    }
+}
+
+static void readahead_thread(void *arg) {
+    for (;;) {
+        acquire(&ra.lock);
+        while (ra.head == ra.tail) {
+            sleep(&ra, &ra.lock);
+        }
+        struct readahead_req r = ra.req[ra.head++ % READAHEAD_QUEUE];
+        release(&ra.lock);
+        ctable_readahead(r.ip, r.offset, r.npages);
+        iput(r.ip);
+    }
+}
+
+void readahead_init() {
+    init_spin_lock_with_name(&ra.lock, "readahead_lock");
+    ra.head = ra.tail = 0;
+    if (kthread_create(readahead_thread, NULL, "kreadaheadd") == NULL)
+        panic("readahead_init: can not create readahead thread");
+}
+
 //static int ctable_release(struct inode* ip, uint offset) {
 //    infof("ctable_release, ip: %p, offset: %d", ip, offset);
 //    KERNEL_ASSERT(ip != NULL, "inode is NULL");
@@ -220,11 +316,12 @@ static int cache_writeback(struct page_cache* cache) {
 // so the disk can get all changes back to it
 void ctable_release(struct inode *ip) {
     infof("ctable_release");
-    struct page_cache* cache;
+    struct list_head *pos, *n;
     acquire_mutex_sleep(&ctable.lock);
-    for (cache = ctable.cache; cache < ctable.cache + NCACHE; cache++) {
-        acquire_mutex_sleep(&cache->lock);
-        if (cache->valid && (cache->host == ip || ip == NULL)) {
+    list_for_each_safe(pos, n, &ctable.lru) {
+        struct page_cache *cache = list_entry(pos, struct page_cache, lru);
+        if (cache->host == ip || ip == NULL) {
+            acquire_mutex_sleep(&cache->lock);
             // if dirty, write back to disk
             if (cache->dirty && cache_writeback(cache) != 0) {
                 panic("cache_writeback error");
@@ -236,24 +333,61 @@ void ctable_release(struct inode *ip) {
 
             // dereference inode
             iput(cache->host);
+            release_mutex_sleep(&cache->lock);
 
-            // clear the cache entry
-            memset(cache, 0, sizeof(struct page_cache));
+            // remove it from the table
+            ctable_remove(cache);
+        }
+    }
+    release_mutex_sleep(&ctable.lock);
+}
 
-            // remove it from the lru list
-            ctable_lru_remove(cache);
+static uint64 ctable_shrink_count() {
+    return ctable.nr_cache;
+}
 
-        }
-        release_mutex_sleep(&cache->lock);
+// drop up to nr clean or written-back pages, least recently used first
+static uint64 ctable_shrink_scan(uint64 nr) {
+    uint64 freed = 0;
+    // the allocating process may be inside ctable already
+    if (!tryacquire_mutex_sleep(&ctable.lock)) {
+        return 0;
+    }
+    while (freed < nr && ctable_lru_evict() == 0) {
+        freed++;
     }
     release_mutex_sleep(&ctable.lock);
+    return freed;
 }
 
+static struct shrinker ctable_shrinker = {
+    .name = "page_cache",
+    .count = ctable_shrink_count,
+    .scan = ctable_shrink_scan,
+};
+
 static void cache_table_init() {
     init_mutex(&ctable.lock);
-    for (int i = 0; i < NCACHE; i++) {
-        init_mutex(&ctable.cache[i].lock);
+    ctable.cachep = kmem_cache_create("page_cache", sizeof(struct page_cache));
+    KERNEL_ASSERT(ctable.cachep != NULL, "cache_table_init: can not create page cache");
+    list_init(&ctable.lru);
+    ctable.nr_cache = 0;
+    ctable.max_cache = get_free_page_count() / CTABLE_RAM_RATIO;
+    // size the hash table for a full cache
+    int order = 0;
+    ctable.hash_size = CTABLE_HASH_MIN;
+    while (ctable.hash_size * CTABLE_HASH_LOAD < ctable.max_cache && order < BUDDY_MAX_ORDER) {
+        ctable.hash_size <<= 1;
+        while (ctable.hash_size * sizeof(struct list_head) > (PGSIZE << order))
+            order++;
+    }
+    ctable.hash = alloc_physical_pages(order);
+    KERNEL_ASSERT(ctable.hash != NULL, "cache_table_init: can not allocate hash table");
+    for (uint i = 0; i < ctable.hash_size; i++) {
+        list_init(&ctable.hash[i]);
     }
+    infof("page cache: %d pages, %d buckets", ctable.max_cache, ctable.hash_size);
+    register_shrinker(&ctable_shrinker);
 }
 
 
@@ -387,12 +521,56 @@ skipelem(char *path, char *name) {
 void inode_table_init() {
 //    init_spin_lock_with_name(&itable.lock, "itable");
     init_mutex(&itable.lock);
-    for (int i = 0; i < NINODE; i++) {
-        init_mutex(&itable.inode[i].lock);
+    itable.cachep = kmem_cache_create("inode", sizeof(struct inode));
+    KERNEL_ASSERT(itable.cachep != NULL, "inode_table_init: can not create inode cache");
+    for (int i = 0; i < INODE_HASH_SIZE; i++) {
+        list_init(&itable.hash[i]);
     }
     cache_table_init();
 }
 
+static uint path_hash(const char *path) {
+    uint h = 0;
+    while (*path)
+        h = h * 31 + *path++;
+    return h % INODE_HASH_SIZE;
+}
+
+// The following itable_* helpers should hold itable.lock
+
+// find an in-memory inode by absolute path and take a reference
+static struct inode *itable_lookup(const char *path) {
+    struct list_head *pos;
+    list_for_each(pos, &itable.hash[path_hash(path)]) {
+        struct inode *ip = list_entry(pos, struct inode, hash);
+        if (ip->dev == ROOTDEV && strcmp(ip->path, path) == 0) {
+            ip->ref++;
+            return ip;
+        }
+    }
+    return NULL;
+}
+
+static struct inode *itable_alloc() {
+    struct inode *ip = kmem_cache_alloc(itable.cachep);
+    if (ip == NULL)
+        return NULL;
+    memset(ip, 0, sizeof(struct inode));
+    init_mutex(&ip->lock);
+    list_init(&ip->hash);
+    return ip;
+}
+
+// make a filled-in inode visible to itable_lookup
+static void itable_insert(struct inode *ip) {
+    list_add(&ip->hash, &itable.hash[path_hash(ip->path)]);
+}
+
+static void itable_free(struct inode *ip) {
+    list_del(&ip->hash);
+    kmem_cache_free(itable.cachep, ip);
+}
+
 // Copy a modified in-memory inode to disk.
 // Must be called after every change to an ip->xxx field
 // that lives on disk.
@@ -449,29 +627,19 @@ void inode_table_init() {
 struct inode *iget_root() {
     debugcore("iget_root");
 
-    struct inode *inode_ptr, *empty;
+    struct inode *inode_ptr;
     //    acquire(&itable.lock);
     acquire_mutex_sleep(&itable.lock);
     // Is the inode already in the table?
-    empty = NULL;
-    for (inode_ptr = &itable.inode[0]; inode_ptr < &itable.inode[NINODE]; inode_ptr++) {
-        if (inode_ptr->ref > 0 && inode_ptr->dev == ROOTDEV && strcmp(inode_ptr->path, "/") == 0) {
-            inode_ptr->ref++;
-            //    release(&itable.lock);
-            release_mutex_sleep(&itable.lock);
-            return inode_ptr;
-        }
-        if (inode_ptr->ref == 0) { // Remember empty slot.
-            empty = inode_ptr; // still holding lock
-            break;
-        }
+    if ((inode_ptr = itable_lookup("/")) != NULL) {
+        //    release(&itable.lock);
+        release_mutex_sleep(&itable.lock);
+        return inode_ptr;
     }
 
-    // Recycle an inode entry.
-    if (empty == NULL)
-        panic("iget: no inodes");
-
-    inode_ptr = empty;
+    // Allocate an inode entry.
+    if ((inode_ptr = itable_alloc()) == NULL)
+        panic("iget_root: no memory for inode");
 
     // open root directory via fatfs interface
     FRESULT result = f_opendir(&inode_ptr->dir, "/");
@@ -487,6 +655,7 @@ struct inode *iget_root() {
     strcpy(inode_ptr->path, "/");
     inode_ptr->unlinked = 0;
     inode_ptr->new_path[0] = '\0';
+    itable_insert(inode_ptr);
 
 //    acquire(&itable.lock);
     release_mutex_sleep(&itable.lock);
@@ -545,6 +714,9 @@ void iput(struct inode *ip) {
         }
     }
     ip->ref--;
+    if (ip->ref == 0) {
+        itable_free(ip);
+    }
 //    release(&itable.lock);
     release_mutex_sleep(&itable.lock);
 }
@@ -951,27 +1123,23 @@ dirlookup(struct inode *dp, char *name) {
     infof("dirlookup: path: %s\n", path);
 
     // get the inode of the queried entity
-    struct inode *inode_ptr, *empty;
+    struct inode *inode_ptr;
 //    acquire(&itable.lock);
     acquire_mutex_sleep(&itable.lock);
     // Is the inode already in the table?
-    empty = NULL;
-    for (inode_ptr = &itable.inode[0]; inode_ptr < &itable.inode[NINODE]; inode_ptr++) {
-        if (inode_ptr->ref > 0 && inode_ptr->dev == ROOTDEV && strcmp(inode_ptr->path, path) == 0) {
-            inode_ptr->ref++;
-//            release(&itable.lock);
-            release_mutex_sleep(&itable.lock);
-            return inode_ptr;
-        }
-        if (empty == 0 && inode_ptr->ref == 0) // Remember empty slot.
-            empty = inode_ptr;
+    if ((inode_ptr = itable_lookup(path)) != NULL) {
+//        release(&itable.lock);
+        release_mutex_sleep(&itable.lock);
+        return inode_ptr;
     }
 
-    // Recycle an inode entry.
-    if (empty == NULL)
-        panic("iget: no inodes");
-
-    inode_ptr = empty;
+    // Allocate an inode entry.
+    if ((inode_ptr = itable_alloc()) == NULL) {
+        infof("dirlookup: no memory for inode");
+//        release(&itable.lock);
+        release_mutex_sleep(&itable.lock);
+        return NULL;
+    }
 
     // try to open root directory via fatfs interface
     if (f_opendir(&inode_ptr->dir, path) == FR_OK) {
@@ -981,6 +1149,7 @@ dirlookup(struct inode *dp, char *name) {
         strcpy(inode_ptr->path, path);
         inode_ptr->unlinked = 0;
         inode_ptr->new_path[0] = '\0';
+        itable_insert(inode_ptr);
 //        release(&itable.lock);
         release_mutex_sleep(&itable.lock);
         return inode_ptr;
@@ -1006,6 +1175,7 @@ dirlookup(struct inode *dp, char *name) {
             strcpy(inode_ptr->path, path);
             inode_ptr->unlinked = 0;
             inode_ptr->new_path[0] = '\0';
+            itable_insert(inode_ptr);
 //            release(&itable.lock);
             release_mutex_sleep(&itable.lock);
             return inode_ptr;
@@ -1021,6 +1191,8 @@ dirlookup(struct inode *dp, char *name) {
             // record new file
             if (f_open(&inode_ptr->file, symlink_info.path, FA_READ | FA_WRITE) != FR_OK) {
                 infof("dirlookup: symlink destination is invalid: %s", symlink_info.path);
+                itable_free(inode_ptr);
+                release_mutex_sleep(&itable.lock);
                 return NULL;
             }
             inode_ptr->dev = ROOTDEV;
@@ -1029,6 +1201,7 @@ dirlookup(struct inode *dp, char *name) {
             strcpy(inode_ptr->path, symlink_info.path);
             inode_ptr->unlinked = 0;
             inode_ptr->new_path[0] = '\0';
+            itable_insert(inode_ptr);
 //            release(&itable.lock);
             release_mutex_sleep(&itable.lock);
             ienable_fastseek(inode_ptr);
@@ -1042,6 +1215,7 @@ dirlookup(struct inode *dp, char *name) {
             strcpy(inode_ptr->path, path);
             inode_ptr->unlinked = 0;
             inode_ptr->new_path[0] = '\0';
+            itable_insert(inode_ptr);
 //            release(&itable.lock);
             release_mutex_sleep(&itable.lock);
             ienable_fastseek(inode_ptr);
@@ -1049,6 +1223,7 @@ dirlookup(struct inode *dp, char *name) {
         }
 
     } else {
+        itable_free(inode_ptr);
 //        release(&itable.lock);
         release_mutex_sleep(&itable.lock);
         return NULL;
@@ -1072,27 +1247,23 @@ icreate(struct inode *dp, char *name, int type, int major, int minor) {
 
     // create the inode of the queried entity
     // get the inode of the queried entity
-    struct inode *inode_ptr, *empty;
+    struct inode *inode_ptr;
 //    acquire(&itable.lock);
     acquire_mutex_sleep(&itable.lock);
     // Is the inode already in the table?
-    empty = NULL;
-    for (inode_ptr = &itable.inode[0]; inode_ptr < &itable.inode[NINODE]; inode_ptr++) {
-        if (inode_ptr->ref > 0 && inode_ptr->dev == ROOTDEV && strcmp(inode_ptr->path, path) == 0) {
-            inode_ptr->ref++;
-//            release(&itable.lock);
-            release_mutex_sleep(&itable.lock);
-            return inode_ptr;
-        }
-        if (empty == 0 && inode_ptr->ref == 0) // Remember empty slot.
-            empty = inode_ptr;
+    if ((inode_ptr = itable_lookup(path)) != NULL) {
+//        release(&itable.lock);
+        release_mutex_sleep(&itable.lock);
+        return inode_ptr;
     }
 
-    // Recycle an inode entry.
-    if (empty == NULL)
-        panic("iget: no inodes");
-
-    inode_ptr = empty;
+    // Allocate an inode entry.
+    if ((inode_ptr = itable_alloc()) == NULL) {
+        infof("icreate: no memory for inode");
+//        release(&itable.lock);
+        release_mutex_sleep(&itable.lock);
+        return NULL;
+    }
     FRESULT result;
 
     infof("inode_ptr: %p\n", inode_ptr);
@@ -1102,12 +1273,14 @@ icreate(struct inode *dp, char *name, int type, int major, int minor) {
         // create directory via fatfs interface
         if ((result = f_mkdir(path)) != FR_OK) {
             infof("icreate::dir: f_mkdir failed: %d\n", result);
+            itable_free(inode_ptr);
 //            release(&itable.lock);
             release_mutex_sleep(&itable.lock);
             return NULL;
         }
         if ((result = f_opendir(&inode_ptr->dir, path)) != FR_OK) {
             infof("icreate::dir: f_opendir failed: %d\n", result);
+            itable_free(inode_ptr);
 //            release(&itable.lock);
             release_mutex_sleep(&itable.lock);
             return NULL;
@@ -1118,6 +1291,7 @@ icreate(struct inode *dp, char *name, int type, int major, int minor) {
         strcpy(inode_ptr->path, path);
         inode_ptr->unlinked = 0;
         inode_ptr->new_path[0] = '\0';
+        itable_insert(inode_ptr);
 //        release(&itable.lock);
         release_mutex_sleep(&itable.lock);
         return inode_ptr;
@@ -1127,6 +1301,7 @@ icreate(struct inode *dp, char *name, int type, int major, int minor) {
         // create file via fatfs interface
         if ((result = f_open(&inode_ptr->file, path, FA_CREATE_ALWAYS | FA_WRITE | FA_READ)) != FR_OK) {
             infof("icreate::file: f_open failed: %d\n", result);
+            itable_free(inode_ptr);
 //            release(&itable.lock);
             release_mutex_sleep(&itable.lock);
             return NULL;
@@ -1137,6 +1312,7 @@ icreate(struct inode *dp, char *name, int type, int major, int minor) {
         strcpy(inode_ptr->path, path);
         inode_ptr->unlinked = 0;
         inode_ptr->new_path[0] = '\0';
+        itable_insert(inode_ptr);
 //        release(&itable.lock);
         release_mutex_sleep(&itable.lock);
         ienable_fastseek(inode_ptr);
@@ -1155,6 +1331,7 @@ icreate(struct inode *dp, char *name, int type, int major, int minor) {
             (result = f_write(&inode_ptr->file, &devinfo, sizeof(devinfo), &bw)) != FR_OK ||
             bw != sizeof(devinfo)) {
             infof("icreate::device: f_open/f_write failed: %d\n", result);
+            itable_free(inode_ptr);
 //            release(&itable.lock);
             release_mutex_sleep(&itable.lock);
             return NULL;
@@ -1167,12 +1344,14 @@ icreate(struct inode *dp, char *name, int type, int major, int minor) {
         strcpy(inode_ptr->path, path);
         inode_ptr->unlinked = 0;
         inode_ptr->new_path[0] = '\0';
+        itable_insert(inode_ptr);
 //        release(&itable.lock);
         release_mutex_sleep(&itable.lock);
         return inode_ptr;
 
     } else {
         infof("icreate: unknown type: %d\n", type);
+        itable_free(inode_ptr);
 //        release(&itable.lock);
         release_mutex_sleep(&itable.lock);
         return NULL;
@@ -3,6 +3,7 @@
 #include <ucore/ucore.h>
 #include <lock/lock.h>
 #include <fatfs/ff.h>
+#include <utils/list.h>
 
 #define NDIRECT 12
 #define NINDIRECT (BSIZE / sizeof(uint))
@@ -38,6 +39,7 @@ struct inode {
     bool unlinked;      // has been unlinked
     char new_path[MAXPATH]; // absolute path, if it has been renamed
     uint32 clmt[NFASTSEEK]; // cluster link map table buffer, for fatfs fast seek
+    struct list_head hash;  // in itable.hash
 };
 
 struct page_cache {
@@ -47,6 +49,8 @@ struct page_cache {
     uint dirty;
     uint valid;
     void *page;
+    struct list_head lru;   // in ctable.lru
+    struct list_head hash;  // in ctable.hash
 };
 
 struct device {
@@ -20,6 +20,20 @@ void acquire_mutex_sleep(struct mutex *mu) {
     mu->pid = curr_proc()->pid;
     release(&mu->guard_lock);
 }
+// Take mu only if it is free, never sleeps.
+// Returns 1 if acquired.
+int tryacquire_mutex_sleep(struct mutex *mu) {
+    int ret;
+    acquire(&mu->guard_lock);
+    ret = !mu->locked;
+    if (ret) {
+        mu->locked = 1;
+        mu->pid = curr_proc()->pid;
+    }
+    release(&mu->guard_lock);
+    return ret;
+}
+
 void release_mutex_sleep(struct mutex *mu) {
     acquire(&mu->guard_lock);
     mu->locked = 0;
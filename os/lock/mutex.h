@@ -11,6 +11,7 @@ struct mutex {
 
 void init_mutex(struct mutex *mutex);
 void acquire_mutex_sleep(struct mutex *mu);
+int tryacquire_mutex_sleep(struct mutex *mu);
 void release_mutex_sleep(struct mutex *mu);
 int holdingsleep(struct mutex *lk);
 
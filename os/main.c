@@ -4,6 +4,11 @@
 #include <proc/proc.h>
 #include <fatfs/init.h>
 #include <fatfs/fftest.h>
+#include <mem/asid.h>
+#include <mem/slab.h>
+#include <mem/shared.h>
+#include <mem/shrinker.h>
+#include <mem/swap.h>
 
 extern char s_bss[];
 extern char e_bss[];
@@ -74,21 +79,29 @@ void main(uint64 hartid, uint64 a1) {
         printfinit();
         trapinit();
         trapinit_hart();
+        detect_memory(a1); // a1 is the device tree from the firmware
         kinit();
+        slab_init();    // object caches, needs kinit
+        vma_init();
         procinit();
         plicinit();     // set up interrupt controller
         plicinithart(); // ask PLIC for device interrupts
         binit();        // buffer cache
         inode_table_init();        // inode cache
         fileinit();     // file table
+        init_shared_mem();
         init_trace();
         kvminit();
         infof("kernel vm created");
         kvminithart();
         infof("kernel vm enabled");
-        timerinit();    // do nothing
+        asid_init();
+        timerinit();    // timer cache
         init_app_names();
         init_scheduler();
+        swap_init();    // after the other shrinkers
+        reclaim_init(); // before the shell, see kthread_create
+        readahead_init();
         make_shell_proc();
 
         init_booted();
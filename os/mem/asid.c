@@ -0,0 +1,114 @@
+// Address space identifiers.
+// With ASIDs the user and kernel TLB entries live side by side,
+// so the trampoline no longer flushes the TLB on every trap.
+// Without them (asid_max == 0) it still does.
+
+#include <arch/cpu.h>
+#include <arch/riscv.h>
+#include <lock/lock.h>
+#include <mem/asid.h>
+#include <proc/proc.h>
+#include <utils/log.h>
+
+static struct spinlock asid_lock;
+static uint64 asid_max;        // highest usable ASID, 0 is the kernel's
+static uint64 asid_generation; // current generation
+static uint64 next_asid;       // next free ASID of the current generation
+
+/**
+ * @brief Find out how many ASID bits the hart implements.
+ * Must be called after kvminithart().
+ */
+void asid_init() {
+    init_spin_lock_with_name(&asid_lock, "asid_lock");
+    // the field is WARL, unimplemented bits read back as zero
+    uint64 satp = r_satp();
+    w_satp(satp | (SATP_ASID_MASK << SATP_ASID_SHIFT));
+    asid_max = (r_satp() >> SATP_ASID_SHIFT) & SATP_ASID_MASK;
+    w_satp(satp);
+    sfence_vma();
+    asid_generation = 1;
+    next_asid = 1;
+    infof("asid: %d usable ASIDs", asid_max);
+}
+
+static uint64 asid_of(struct proc *p) {
+    return p->asid & ((1UL << ASID_GEN_SHIFT) - 1);
+}
+
+/**
+ * @brief satp for returning to p in user space, see usertrapret()
+ * Gives p an ASID of the current generation if it has none, and
+ * drops what this hart may still cache under it from elsewhere.
+ */
+uint64 asid_user_satp(struct proc *p) {
+    if (asid_max == 0)
+        return MAKE_SATP(p->pagetable);
+
+    push_off();
+    struct cpu *c = mycpu();
+    int hart = cpuid();
+    uint64 gen = __atomic_load_n(&asid_generation, __ATOMIC_ACQUIRE);
+    if ((p->asid >> ASID_GEN_SHIFT) != gen || c->asid_generation != gen) {
+        acquire(&asid_lock);
+        if ((p->asid >> ASID_GEN_SHIFT) != asid_generation) {
+            if (next_asid > asid_max) {
+                // rollover, every hart flushes before its next user return
+                __atomic_store_n(&asid_generation, asid_generation + 1, __ATOMIC_RELEASE);
+                next_asid = 1;
+            }
+            // no hart caches anything under a fresh ASID
+            p->asid = (asid_generation << ASID_GEN_SHIFT) | next_asid++;
+            p->asid_hart = hart;
+        }
+        if (c->asid_generation != asid_generation) {
+            c->asid_generation = asid_generation;
+            sfence_vma();
+        }
+        release(&asid_lock);
+    }
+    if (p->asid_hart != hart) {
+        // the page table may have changed while p ran on another hart
+        sfence_vma_asid(asid_of(p));
+        p->asid_hart = hart;
+    }
+    uint64 satp = MAKE_SATP_ASID(p->pagetable, asid_of(p));
+    pop_off();
+    return satp;
+}
+
+// Whether pagetable belongs to the running process, which is the only
+// one whose entries this hart can hold under a still valid ASID.
+// Other address spaces are either new or being torn down.
+static struct proc *tlb_owner(pagetable_t pagetable) {
+    struct proc *p = curr_proc();
+    if (asid_max == 0 || p == NULL || p->pagetable != pagetable || p->asid == ASID_NONE)
+        return NULL;
+    return p;
+}
+
+/**
+ * @brief Flush the TLB entries of npages pages from va of a user page table
+ * after changing them. Large ranges flush the whole address space instead.
+ * Without ASIDs this is left to the next user return.
+ */
+void flush_tlb_user_range(pagetable_t pagetable, uint64 va, uint64 npages) {
+    struct proc *p = tlb_owner(pagetable);
+    if (p == NULL)
+        return;
+    if (npages > TLB_FLUSH_PAGES_MAX) {
+        sfence_vma_asid(asid_of(p));
+        return;
+    }
+    for (uint64 i = 0; i < npages; i++)
+        sfence_vma_page(va + i * PGSIZE, asid_of(p));
+}
+
+/**
+ * @brief Drop whatever any hart caches for p after changing its page
+ * table from outside, p must not be running. It simply gets a fresh
+ * ASID on its next user return.
+ */
+void asid_invalidate(struct proc *p) {
+    p->asid = ASID_NONE;
+}
@@ -0,0 +1,21 @@
+#if !defined(ASID_H)
+#define ASID_H
+
+#include <ucore/types.h>
+
+// p->asid holds the generation above ASID_GEN_SHIFT and the ASID below.
+// An ASID is handed out once per generation, when they run out a new
+// generation starts and every hart flushes its TLB before using one.
+#define ASID_GEN_SHIFT 16
+#define ASID_NONE 0 // generations start at 1
+
+#define TLB_FLUSH_PAGES_MAX 32 // beyond this, flush the whole address space
+
+struct proc;
+
+void asid_init();
+uint64 asid_user_satp(struct proc *p);
+void flush_tlb_user_range(pagetable_t pagetable, uint64 va, uint64 npages);
+void asid_invalidate(struct proc *p);
+
+#endif // ASID_H
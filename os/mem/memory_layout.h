@@ -35,9 +35,14 @@
 // the kernel expects there to be RAM
 // for use by the kernel and user pages
 // from physical address 0x80000000 to PHYSTOP.
+// PHYSTOP is read from the /memory node of the device tree at boot,
+// see detect_memory().
 #define KERNBASE 0x80200000ULL
-#define PHYSTOP (0x80000000ULL + (unsigned long long)(1ULL * 256 * 1024 * \
-1024)) // 256MB
+#define PHYSBASE 0x80000000ULL
+#define PHYSTOP_DEFAULT (PHYSBASE + 256ULL * 1024 * 1024)    // no usable device tree
+#define PHYSTOP_MAX (PHYSBASE + 4ULL * 1024 * 1024 * 1024)   // larger RAM is ignored
+extern unsigned long long phystop;
+#define PHYSTOP phystop
 
 // map the trampoline page to the highest address,
 // in both user and kernel space.
@@ -1,46 +1,331 @@
 #include <arch/riscv.h>
+#include <arch/cpu.h>
 #include <lock/lock.h>
 #include <mem/memory_layout.h>
+#include <mem/physical.h>
+#include <mem/shrinker.h>
 #include <ucore/defs.h>
+#include <utils/assert.h>
+#include <utils/fdt.h>
 #include <utils/log.h>
 void freerange(void *pa_start, void *pa_end);
 
 extern char ekernel[];
 
-struct linklist {
-    struct linklist *next;
+#define NPAGES ((PHYSTOP - KERNBASE) >> PGSHIFT)
+#define PFN(pa) (((uint64)(pa) - KERNBASE) >> PGSHIFT)
+#define PFN2PA(pfn) ((void *)(KERNBASE + ((uint64)(pfn) << PGSHIFT)))
+
+// embedded in the first page of a free block
+struct buddy_block {
+    struct buddy_block *next;
+    struct buddy_block *prev;
 };
 
 struct
 {
     struct spinlock lock;
-    struct linklist *freelist;
-    uint64 free_page_count;
-    uint8 pfn_ref[(PHYSTOP - KERNBASE) >> PGSHIFT];
+    struct buddy_block *free_area[BUDDY_MAX_ORDER + 1];
+    uint64 nr_free[BUDDY_MAX_ORDER + 1]; // free blocks per order
+    uint64 free_page_count;              // pages held by the buddy lists
+    uint64 low_watermark;                // below it, wake up background reclaim
+    uint64 high_watermark;               // background reclaim stops here
 } kmem;
 
+// end of RAM, set by detect_memory() before kinit()
+uint64 phystop = PHYSTOP_DEFAULT;
+
+// the device tree blob, kept out of the allocator
+static uint64 dtb_start, dtb_end;
+
+// one descriptor per physical page from KERNBASE to PHYSTOP,
+// carved out of the first free pages by kinit()
+struct page *mem_map;
+
+struct page *pa_to_page(void *pa) {
+    KERNEL_ASSERT((uint64)pa >= KERNBASE && (uint64)pa < PHYSTOP, "pa_to_page: bad pa");
+    return &mem_map[PFN(pa)];
+}
+
+void *page_to_pa(struct page *page) {
+    return PFN2PA(page - mem_map);
+}
+
+// a page leaving the allocator is owned by exactly one user
+static void page_set_allocated(void *pa) {
+    struct page *page = &mem_map[PFN(pa)];
+    page->flags = 0;
+    page->age = 0;
+    page->owner = NULL;
+    __atomic_store_n(&page->refcount, 1, __ATOMIC_RELEASE);
+}
+
+static void page_set_free(void *pa) {
+    struct page *page = &mem_map[PFN(pa)];
+    page->flags = 0;
+    page->owner = NULL;
+    __atomic_store_n(&page->refcount, 0, __ATOMIC_RELEASE);
+}
+
+// Used by its own hart, with interrupts off. The lock is only
+// contended when an allocation about to fail drains them all.
+struct kmem_magazine {
+    struct spinlock lock;
+    uint count;
+    void *frames[MAGAZINE_SIZE];
+    uint64 hit;
+    uint64 miss;
+    uint64 refill;
+    uint64 drain;
+} kmem_magazines[NCPU];
+
+// pages zeroed ahead of time by idle harts, see refill_zeroed_pool()
+struct {
+    struct spinlock lock;
+    uint count;
+    void *pages[ZERO_POOL_SIZE];
+    uint64 hit;
+    uint64 miss;
+} zero_pool;
+
+#ifdef MEM_POISON
+// Fill with junk to catch dangling refs and uninitialized use.
+#define poison_pages(pa, c, size) memset((pa), (c), (size))
+#else
+#define poison_pages(pa, c, size) do { } while (0)
+#endif
+
 uint64 get_free_page_count(){
     acquire(&kmem.lock);
     uint64 c = kmem.free_page_count;
     release(&kmem.lock);
+    // frames cached in magazines are free as well
+    for (int i = 0; i < NCPU; i++) {
+        c += kmem_magazines[i].count;
+    }
+    // so are the pre-zeroed ones
+    c += zero_pool.count;
     return c;
 }
 
+void get_zero_pool_stat(struct zero_pool_stat *stat) {
+    acquire(&zero_pool.lock);
+    stat->hit = zero_pool.hit;
+    stat->miss = zero_pool.miss;
+    stat->count = zero_pool.count;
+    release(&zero_pool.lock);
+}
+
+void get_buddy_stat(uint64 nr_free[BUDDY_MAX_ORDER + 1]) {
+    acquire(&kmem.lock);
+    for (int i = 0; i <= BUDDY_MAX_ORDER; i++) {
+        nr_free[i] = kmem.nr_free[i];
+    }
+    release(&kmem.lock);
+}
+
+void get_magazine_stat(int cpu, struct magazine_stat *stat) {
+    struct kmem_magazine *mag = &kmem_magazines[cpu];
+    stat->hit = mag->hit;
+    stat->miss = mag->miss;
+    stat->refill = mag->refill;
+    stat->drain = mag->drain;
+    stat->count = mag->count;
+}
+
+/**
+ * @brief Size physical memory from the device tree
+ * Must be called before kinit(), falls back to PHYSTOP_DEFAULT.
+ *
+ * @param dtb physical address of the device tree blob, a1 at boot
+ */
+void detect_memory(uint64 dtb) {
+    uint64 base, size;
+    if (fdt_find_memory(dtb, &base, &size) < 0 || base > KERNBASE || base + size <= KERNBASE) {
+        warnf("no usable memory node in device tree %p", dtb);
+        phystop = PHYSTOP_DEFAULT;
+    } else if (base + size > PHYSTOP_MAX) {
+        warnf("only using %p of %p bytes of RAM", PHYSTOP_MAX - base, size);
+        phystop = PHYSTOP_MAX;
+    } else {
+        phystop = PGROUNDDOWN(base + size);
+    }
+    dtb_start = dtb;
+    dtb_end = dtb + fdt_totalsize(dtb);
+    infof("RAM ends at %p, %d MiB for the kernel", phystop, (phystop - KERNBASE) >> 20);
+}
+
 /**
  * Kernel mem init
  * collect kernel pages
  */
 void kinit() {
     init_spin_lock_with_name(&kmem.lock, "kmem.lock");
+    init_spin_lock_with_name(&zero_pool.lock, "zero_pool.lock");
     kmem.free_page_count = 0;
-    freerange(ekernel, (void *)PHYSTOP);
+    memset(kmem_magazines, 0, sizeof(kmem_magazines));
+    for (int i = 0; i < NCPU; i++) {
+        init_spin_lock_with_name(&kmem_magazines[i].lock, "kmem_magazine.lock");
+    }
+
+    // mem_map takes the first free pages that do not overlap the device tree
+    uint64 map_start = PGROUNDUP((uint64)ekernel);
+    uint64 map_size = PGROUNDUP(NPAGES * sizeof(struct page));
+    if (map_start < dtb_end && map_start + map_size > dtb_start)
+        map_start = PGROUNDUP(dtb_end);
+    mem_map = (struct page *)map_start;
+    memset(mem_map, 0, map_size);
+
+    // free the rest, leaving holes for mem_map and the device tree
+    uint64 holes[2][2] = {{dtb_start, dtb_end}, {map_start, map_start + map_size}};
+    if (holes[0][0] > holes[1][0]) {
+        holes[0][0] = map_start;
+        holes[0][1] = map_start + map_size;
+        holes[1][0] = dtb_start;
+        holes[1][1] = dtb_end;
+    }
+    uint64 p = (uint64)ekernel;
+    for (int i = 0; i < 2; i++) {
+        if (holes[i][0] > p)
+            freerange((void *)p, (void *)MIN(holes[i][0], PHYSTOP));
+        p = MAX(p, holes[i][1]);
+    }
+    freerange((void *)p, (void *)PHYSTOP);
+    kmem.low_watermark = kmem.free_page_count / WMARK_LOW_RATIO;
+    kmem.high_watermark = kmem.free_page_count / WMARK_HIGH_RATIO;
+}
+
+uint64 get_high_watermark() {
+    return kmem.high_watermark;
+}
+
+// Reclaim may sleep, so only a process holding no spinlock can do it.
+static int can_reclaim() {
+    push_off();
+    struct cpu *c = mycpu();
+    int ret = c->noff == 1 && c->proc != NULL;
+    pop_off();
+    return ret;
+}
+
+// The following buddy_* helpers should hold kmem.lock
+
+static void buddy_list_add(void *pa, int order) {
+    struct buddy_block *b = (struct buddy_block *)pa;
+    b->prev = NULL;
+    b->next = kmem.free_area[order];
+    if (b->next)
+        b->next->prev = b;
+    kmem.free_area[order] = b;
+    mem_map[PFN(pa)].flags = PG_BUDDY;
+    mem_map[PFN(pa)].order = order;
+    kmem.nr_free[order]++;
+    kmem.free_page_count += 1ULL << order;
+}
+
+static void buddy_list_del(void *pa, int order) {
+    struct buddy_block *b = (struct buddy_block *)pa;
+    if (b->prev)
+        b->prev->next = b->next;
+    else
+        kmem.free_area[order] = b->next;
+    if (b->next)
+        b->next->prev = b->prev;
+    mem_map[PFN(pa)].flags = 0;
+    kmem.nr_free[order]--;
+    kmem.free_page_count -= 1ULL << order;
+}
+
+// take a block of 2^order pages, splitting a larger one if needed
+static void *buddy_alloc(int order) {
+    int o = order;
+    while (o <= BUDDY_MAX_ORDER && kmem.free_area[o] == NULL)
+        o++;
+    if (o > BUDDY_MAX_ORDER)
+        return NULL;
+    void *pa = kmem.free_area[o];
+    buddy_list_del(pa, o);
+    // give the upper halves back until the block has the requested size
+    while (o > order) {
+        o--;
+        buddy_list_add((char *)pa + (PGSIZE << o), o);
+    }
+    return pa;
+}
+
+// return a block of 2^order pages, merging it with its free buddies
+static void buddy_free(void *pa, int order) {
+    uint64 pfn = PFN(pa);
+    while (order < BUDDY_MAX_ORDER) {
+        uint64 buddy = pfn ^ (1ULL << order);
+        if (buddy >= NPAGES || !(mem_map[buddy].flags & PG_BUDDY) || mem_map[buddy].order != order)
+            break;
+        buddy_list_del(PFN2PA(buddy), order);
+        pfn &= ~(1ULL << order);
+        order++;
+    }
+    buddy_list_add(PFN2PA(pfn), order);
 }
 
 void freerange(void *pa_start, void *pa_end) {
     char *p;
     p = (char *)PGROUNDUP((uint64)pa_start);
-    for (; p + PGSIZE <= (char *)pa_end; p += PGSIZE)
-        recycle_physical_page(p);
+    acquire(&kmem.lock);
+    while (p + PGSIZE <= (char *)pa_end) {
+        // carve the largest aligned block that fits
+        int order = 0;
+        while (order < BUDDY_MAX_ORDER
+               && (PFN(p) & ((2ULL << order) - 1)) == 0
+               && p + (PGSIZE << (order + 1)) <= (char *)pa_end)
+            order++;
+        poison_pages(p, 1, PGSIZE << order);
+        for (int i = 0; i < (1 << order); i++)
+            page_set_free(p + i * PGSIZE);
+        buddy_list_add(p, order);
+        p += PGSIZE << order;
+    }
+    release(&kmem.lock);
+}
+
+// Pull a batch of frames from the buddy allocator into mag.
+static void magazine_refill(struct kmem_magazine *mag) {
+    acquire(&kmem.lock);
+    while (mag->count < MAGAZINE_BATCH) {
+        void *pa = buddy_alloc(0);
+        if (pa == NULL)
+            break;
+        mag->frames[mag->count++] = pa;
+    }
+    release(&kmem.lock);
+    mag->refill++;
+}
+
+// Push the older half of mag back to the buddy allocator.
+static void magazine_drain(struct kmem_magazine *mag) {
+    acquire(&kmem.lock);
+    for (int i = 0; i < MAGAZINE_BATCH; i++) {
+        buddy_free(mag->frames[i], 0);
+    }
+    release(&kmem.lock);
+    // keep the most recently freed (cache-hot) frames
+    for (int i = MAGAZINE_BATCH; i < mag->count; i++) {
+        mag->frames[i - MAGAZINE_BATCH] = mag->frames[i];
+    }
+    mag->count -= MAGAZINE_BATCH;
+    mag->drain++;
+}
+
+// Give a page whose reference count dropped to zero to this hart's magazine.
+static void magazine_free(void *pa) {
+    push_off();
+    struct kmem_magazine *mag = &kmem_magazines[cpuid()];
+    acquire(&mag->lock);
+    if (mag->count == MAGAZINE_SIZE) {
+        magazine_drain(mag);
+    }
+    mag->frames[mag->count++] = pa;
+    release(&mag->lock);
+    pop_off();
 }
 
 // Free the page of physical memory pointed at by v,
@@ -48,65 +333,230 @@ void freerange(void *pa_start, void *pa_end) {
 // call to alloc_physical_page().  (The exception is when
 // initializing the allocator; see kinit above.)
 void recycle_physical_page(void *pa) {
-    struct linklist *l;
     if (((uint64)pa % PGSIZE) != 0 || (char *)pa < ekernel || (uint64)pa >= PHYSTOP)
         panic("recycle_physical_page");
 
-    // Fill with junk to catch dangling refs.
-    memset(pa, 1, PGSIZE);
-    l = (struct linklist *)pa;
+    poison_pages(pa, 1, PGSIZE);
 
-    acquire(&kmem.lock);
-    l->next = kmem.freelist;
-    kmem.freelist = l;
-    kmem.free_page_count++;
+    page_set_free(pa);
+    magazine_free(pa);
+}
 
-    kmem.pfn_ref[((uint64)l - KERNBASE) >> PGSHIFT] = 0;
-    release(&kmem.lock);
+// take a frame from this hart's magazine, refilling it if needed
+static void *magazine_alloc(void) {
+    void *pa = NULL;
+    push_off();
+    struct kmem_magazine *mag = &kmem_magazines[cpuid()];
+    acquire(&mag->lock);
+    if (mag->count > 0) {
+        mag->hit++;
+    } else {
+        mag->miss++;
+        magazine_refill(mag);
+    }
+    if (mag->count > 0) {
+        pa = mag->frames[--mag->count];
+    }
+    release(&mag->lock);
+    pop_off();
+    return pa;
+}
+
+// Give the frames cached by every hart back to the buddy allocator,
+// so that an allocation about to fail can use them.
+// Returns the number of frames freed.
+static uint64 drain_all_magazines(void) {
+    uint64 freed = 0;
+    for (int i = 0; i < NCPU; i++) {
+        struct kmem_magazine *mag = &kmem_magazines[i];
+        acquire(&mag->lock);
+        if (mag->count > 0) {
+            acquire(&kmem.lock);
+            for (int j = 0; j < mag->count; j++) {
+                buddy_free(mag->frames[j], 0);
+            }
+            release(&kmem.lock);
+            freed += mag->count;
+            mag->count = 0;
+            mag->drain++;
+        }
+        release(&mag->lock);
+    }
+    return freed;
+}
+
+static void *zero_pool_take(void) {
+    void *pa = NULL;
+    acquire(&zero_pool.lock);
+    if (zero_pool.count > 0)
+        pa = zero_pool.pages[--zero_pool.count];
+    release(&zero_pool.lock);
+    return pa;
 }
 
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
 void *alloc_physical_page(void) {
-    struct linklist *l;
-    acquire(&kmem.lock);
-    l = kmem.freelist;
-    if (l) {
-        kmem.freelist = l->next;
-        kmem.free_page_count--;
-        kmem.pfn_ref[((uint64)l - KERNBASE) >> PGSHIFT] = 1;
+    void *pa = magazine_alloc();
+    if (pa == NULL) {
+        // take back a pre-zeroed page
+        pa = zero_pool_take();
     }
-    release(&kmem.lock);
-    if (l)
-        memset((char *)l, 5, PGSIZE); // fill with junk
-    else
+    if (pa == NULL && drain_all_magazines() > 0) {
+        // other harts were sitting on free frames
+        pa = magazine_alloc();
+    }
+    if (pa == NULL && can_reclaim()) {
+        // last resort, shrink caches before failing
+        shrink_memory(RECLAIM_BATCH);
+        pa = magazine_alloc();
+    }
+    if (pa == NULL) {
         warnf("Out of memory");
-    return (void *)l;
+        return NULL;
+    }
+    page_set_allocated(pa);
+    poison_pages(pa, 5, PGSIZE);
+
+    // racy read, a missed or extra kick is harmless
+    if (kmem.free_page_count < kmem.low_watermark && can_reclaim())
+        wakeup_reclaim();
+    return pa;
+}
+
+// Allocate one zero-filled page, from the pre-zeroed pool if possible.
+// Returns 0 if the memory cannot be allocated.
+void *alloc_zeroed_page(void) {
+    void *pa = NULL;
+    acquire(&zero_pool.lock);
+    if (zero_pool.count > 0) {
+        pa = zero_pool.pages[--zero_pool.count];
+        zero_pool.hit++;
+    } else {
+        zero_pool.miss++;
+    }
+    release(&zero_pool.lock);
+    if (pa == NULL && (pa = alloc_physical_page()) != NULL)
+        memset(pa, 0, PGSIZE);
+    return pa;
 }
 
+// Zero up to ZERO_POOL_BATCH pages into the pool.
+// Called by harts with nothing to run.
+void refill_zeroed_pool(void) {
+    for (int i = 0; i < ZERO_POOL_BATCH; i++) {
+        // racy peek, it only decides whether to do some work
+        if (zero_pool.count >= ZERO_POOL_SIZE || kmem.free_page_count < kmem.high_watermark)
+            return;
+        void *pa = alloc_physical_page();
+        if (pa == NULL)
+            return;
+        memset(pa, 0, PGSIZE);
+        acquire(&zero_pool.lock);
+        if (zero_pool.count < ZERO_POOL_SIZE) {
+            zero_pool.pages[zero_pool.count++] = pa;
+            pa = NULL;
+        }
+        release(&zero_pool.lock);
+        if (pa != NULL) {
+            recycle_physical_page(pa);
+            return;
+        }
+    }
+}
+
+// Reference counts are updated with AMOs, no lock needed.
 void dup_physical_page(void *pa) {
-    acquire(&kmem.lock);
-    kmem.pfn_ref[((uint64)pa - KERNBASE) >> PGSHIFT]++;
-    release(&kmem.lock);
+    struct page *page = pa_to_page(pa);
+    uint32 old = __atomic_fetch_add(&page->refcount, 1, __ATOMIC_RELAXED);
+    KERNEL_ASSERT(old > 0, "dup_physical_page: page is free");
 }
 
 void put_physical_page(void *pa) {
-    struct linklist *l;
-    acquire(&kmem.lock);
-    if (--kmem.pfn_ref[((uint64)pa - KERNBASE) >> PGSHIFT] == 0) {
-        memset(pa, 1, PGSIZE);
-        l = (struct linklist *)pa;
-        l->next = kmem.freelist;
-        kmem.freelist = l;
-        kmem.free_page_count++;
+    struct page *page = pa_to_page(pa);
+    // acq_rel, so that all uses of the page happen before it's reused
+    uint32 ref = __atomic_sub_fetch(&page->refcount, 1, __ATOMIC_ACQ_REL);
+    KERNEL_ASSERT(ref != (uint32)-1, "put_physical_page: page is free");
+    if (ref == 0) {
+        poison_pages(pa, 1, PGSIZE);
+        page->flags = 0;
+        page->owner = NULL;
+        magazine_free(pa);
+    }
+}
+
+// put_physical_page() for a block from alloc_physical_pages(order),
+// its first page holds the count for the whole block
+void put_physical_pages(void *pa, int order) {
+    if (order == 0) {
+        put_physical_page(pa);
+        return;
     }
+    struct page *page = pa_to_page(pa);
+    uint32 ref = __atomic_sub_fetch(&page->refcount, 1, __ATOMIC_ACQ_REL);
+    KERNEL_ASSERT(ref != (uint32)-1, "put_physical_pages: block is free");
+    if (ref == 0)
+        free_physical_pages(pa, order);
+}
+
+uint32 get_physical_page_ref(void *pa) {
+    return __atomic_load_n(&pa_to_page(pa)->refcount, __ATOMIC_ACQUIRE);
+}
+
+// Record who a page belongs to, e.g. PG_CACHE and its struct page_cache.
+void set_page_owner(void *pa, uint16 flag, void *owner) {
+    struct page *page = pa_to_page(pa);
+    page->owner = owner;
+    __atomic_fetch_or(&page->flags, flag, __ATOMIC_RELEASE);
+}
+
+void clear_page_owner(void *pa, uint16 flag) {
+    struct page *page = pa_to_page(pa);
+    __atomic_fetch_and(&page->flags, (uint16)~flag, __ATOMIC_RELEASE);
+    page->owner = NULL;
+}
+
+// Allocate 2^order physically contiguous pages.
+// Returns 0 if no block that large is free.
+void *alloc_physical_pages(int order) {
+    if (order == 0)
+        return alloc_physical_page();
+    KERNEL_ASSERT(order > 0 && order <= BUDDY_MAX_ORDER, "alloc_physical_pages: bad order");
+    acquire(&kmem.lock);
+    void *pa = buddy_alloc(order);
     release(&kmem.lock);
+    if (pa == NULL && drain_all_magazines() > 0) {
+        // cached frames may complete a block
+        acquire(&kmem.lock);
+        pa = buddy_alloc(order);
+        release(&kmem.lock);
+    }
+    if (pa == NULL && can_reclaim()) {
+        shrink_memory(RECLAIM_BATCH << order);
+        acquire(&kmem.lock);
+        pa = buddy_alloc(order);
+        release(&kmem.lock);
+    }
+    if (pa) {
+        page_set_allocated(pa);
+        poison_pages(pa, 5, PGSIZE << order);
+    } else
+        warnf("Out of memory, order=%d", order);
+    return pa;
 }
 
-uint8 get_physical_page_ref(void *pa) {
+// Free a block returned by alloc_physical_pages(order).
+void free_physical_pages(void *pa, int order) {
+    if (order == 0) {
+        recycle_physical_page(pa);
+        return;
+    }
+    if ((PFN(pa) & ((1ULL << order) - 1)) != 0 || (char *)pa < ekernel || (uint64)pa >= PHYSTOP)
+        panic("free_physical_pages");
+    poison_pages(pa, 1, PGSIZE << order);
+    page_set_free(pa);
     acquire(&kmem.lock);
-    uint8 r = kmem.pfn_ref[((uint64)pa - KERNBASE) >> PGSHIFT];
+    buddy_free(pa, order);
     release(&kmem.lock);
-    return r;
 }
@@ -0,0 +1,61 @@
+#if !defined(PHYSICAL_H)
+#define PHYSICAL_H
+
+#include <ucore/types.h>
+
+// page descriptor, one for every physical page the allocator manages
+struct page {
+    uint32 refcount; // updated with AMOs, see dup/put_physical_page
+    uint16 flags;    // PG_*
+    union {
+        uint16 order;    // block order, valid with PG_BUDDY
+        uint16 age;      // swap scans a user page went unreferenced, see swap.c
+    };
+    void *owner;     // back-pointer to what the page belongs to, see flags
+};
+
+#define PG_BUDDY 0x1 // first page of a free buddy block, protected by kmem.lock
+#define PG_CACHE 0x2 // page cache page, owner is the struct page_cache
+
+struct page *pa_to_page(void *pa);
+void *page_to_pa(struct page *page);
+void set_page_owner(void *pa, uint16 flag, void *owner);
+void clear_page_owner(void *pa, uint16 flag);
+
+// free page watermarks, as a fraction of free memory at boot
+#define WMARK_LOW_RATIO 64
+#define WMARK_HIGH_RATIO 32
+
+uint64 get_high_watermark();
+
+// buddy allocator serves blocks of 2^0 .. 2^BUDDY_MAX_ORDER pages
+#define BUDDY_MAX_ORDER 10
+
+// per-hart magazine, a bounded LIFO stack of free frames
+// sitting in front of the buddy allocator for order-0 pages
+#define MAGAZINE_SIZE 64
+#define MAGAZINE_BATCH (MAGAZINE_SIZE / 2) // frames moved per refill/drain
+
+struct magazine_stat {
+    uint64 hit;    // allocations served by the magazine
+    uint64 miss;   // allocations that found the magazine empty
+    uint64 refill; // batches pulled from the global freelist
+    uint64 drain;  // batches pushed back to the global freelist
+    uint64 count;  // frames currently cached
+};
+
+// pages kept zeroed by idle harts for alloc_zeroed_page()
+#define ZERO_POOL_SIZE 256
+#define ZERO_POOL_BATCH 8 // pages zeroed per idle scheduler loop
+
+struct zero_pool_stat {
+    uint64 hit;   // alloc_zeroed_page() served from the pool
+    uint64 miss;  // alloc_zeroed_page() that had to zero a page itself
+    uint64 count; // pages currently in the pool
+};
+
+void get_zero_pool_stat(struct zero_pool_stat *stat);
+void get_buddy_stat(uint64 nr_free[BUDDY_MAX_ORDER + 1]);
+void get_magazine_stat(int cpu, struct magazine_stat *stat);
+
+#endif // PHYSICAL_H
@@ -1,20 +1,17 @@
 #include <mem/shared.h>
+#include <mem/slab.h>
 #include <lock/spinlock.h>
 #include <proc/proc.h>
-struct shared_mem shared_mem_pool[MAX_SHARED_MEM_INSTANCE];
+static struct kmem_cache *shared_mem_cachep;
+static struct list_head shared_mem_list; // every shared mem instance, in use
 struct spinlock shared_mem_pool_lock;
 
 void init_shared_mem()
 {
     init_spin_lock_with_name(&shared_mem_pool_lock, "shared_mem_pool_lock");
-    for (int i = 0; i < MAX_SHARED_MEM_INSTANCE; i++)
-    {
-        shared_mem_pool[i].used = FALSE;
-        shared_mem_pool[i].ref = 0;
-        shared_mem_pool[i].page_cnt = 0;
-        memset(shared_mem_pool[i].name, 0, MAX_SHARED_NAME);
-        memset(shared_mem_pool[i].mem_pages, 0, sizeof(shared_mem_pool[i].mem_pages));
-    }
+    list_init(&shared_mem_list);
+    shared_mem_cachep = kmem_cache_create("shared_mem", sizeof(struct shared_mem));
+    KERNEL_ASSERT(shared_mem_cachep != NULL, "init_shared_mem: can not create shared mem cache");
 }
 struct shared_mem *dup_shared_mem(struct shared_mem *shmem)
 {
@@ -29,60 +26,53 @@ struct shared_mem *dup_shared_mem(struct shared_mem *shmem)
 // if none exists, will create one, allocate page_cnt pages
 struct shared_mem *get_shared_mem_by_name(char *name, int page_cnt)
 {
+    struct list_head *pos;
     acquire(&shared_mem_pool_lock);
 
     // find created ones
-    for (int i = 0; i < MAX_SHARED_MEM_INSTANCE; i++)
+    list_for_each(pos, &shared_mem_list)
     {
-        if (shared_mem_pool[i].used && strncmp(name, shared_mem_pool[i].name, MAX_SHARED_NAME) == 0)
+        struct shared_mem *shmem = list_entry(pos, struct shared_mem, list);
+        if (strncmp(name, shmem->name, MAX_SHARED_NAME) == 0)
         {
-            shared_mem_pool[i].ref++;
+            shmem->ref++;
             release(&shared_mem_pool_lock);
-            return &shared_mem_pool[i];
+            return shmem;
         }
     }
 
     // not found, create one
+    struct shared_mem *shmem = kmem_cache_alloc(shared_mem_cachep);
+    if (shmem == NULL)
+    {
+        release(&shared_mem_pool_lock);
+        return NULL;
+    }
+    shmem->ref = 1;
+    shmem->page_cnt = 0;
+    strncpy(shmem->name, name, MAX_SHARED_NAME);
+    memset(shmem->mem_pages, 0, sizeof(shmem->mem_pages));
 
-    for (int i = 0; i < MAX_SHARED_MEM_INSTANCE; i++)
+    for (int j = 0; j < page_cnt; j++)
     {
-        if (shared_mem_pool[i].used == FALSE) // empty
+        void *p = alloc_zeroed_page();
+        if (p == NULL)
         {
-            shared_mem_pool[i].used = TRUE;
-            shared_mem_pool[i].ref = 1;
-            shared_mem_pool[i].page_cnt = 0;
-            strncpy(shared_mem_pool[i].name, name, MAX_SHARED_NAME);
-            memset(shared_mem_pool[i].mem_pages, 0, sizeof(shared_mem_pool[i].mem_pages));
-
-            for (int j = 0; j < page_cnt; j++)
+            // not enough mem, free all
+            for (int k = 0; k < j; k++)
             {
-                void *p = alloc_physical_page();
-                if (p == NULL)
-                {
-                    // not enough mem, free all
-                    for (int k = 0; k < j; k++)
-                    {
-                        recycle_physical_page(shared_mem_pool[i].mem_pages[k]);
-                    }
-                    // clear
-                    shared_mem_pool[i].used = FALSE;
-                    shared_mem_pool[i].ref = 0;
-                    shared_mem_pool[i].page_cnt = 0;
-                    memset(shared_mem_pool[i].name, 0, MAX_SHARED_NAME);
-                    memset(shared_mem_pool[i].mem_pages, 0, sizeof(shared_mem_pool[i].mem_pages));
-                    release(&shared_mem_pool_lock);
-                    return NULL;
-                }
-                shared_mem_pool[i].mem_pages[j] = p;
+                recycle_physical_page(shmem->mem_pages[k]);
             }
-            shared_mem_pool[i].page_cnt = page_cnt;
+            kmem_cache_free(shared_mem_cachep, shmem);
             release(&shared_mem_pool_lock);
-            return &shared_mem_pool[i];
+            return NULL;
         }
+        shmem->mem_pages[j] = p;
     }
-    // all used
+    shmem->page_cnt = page_cnt;
+    list_add(&shmem->list, &shared_mem_list);
     release(&shared_mem_pool_lock);
-    return NULL;
+    return shmem;
 }
 
 void drop_shared_mem(struct shared_mem *shmem)
@@ -93,14 +83,12 @@ void drop_shared_mem(struct shared_mem *shmem)
     if (shmem->ref == 0)
     {
         debugcore("a shared mem ref decreased to 0, recycle %d pages", shmem->page_cnt);
-        shmem->used = FALSE;
-        memset(shmem->name, 0, MAX_SHARED_NAME);
+        list_del(&shmem->list);
         for (int j = 0; j < shmem->page_cnt; j++)
         {
             recycle_physical_page(shmem->mem_pages[j]);
-            shmem->mem_pages[j] = NULL;
         }
-        shmem->page_cnt = 0;
+        kmem_cache_free(shared_mem_cachep, shmem);
     }
 
     release(&shared_mem_pool_lock);
@@ -0,0 +1,83 @@
+#include <mem/physical.h>
+#include <mem/shrinker.h>
+#include <proc/proc.h>
+#include <ucore/defs.h>
+#include <utils/log.h>
+
+// registered at boot, never removed
+static struct shrinker *shrinkers[NSHRINKER];
+static int nr_shrinkers;
+
+static struct spinlock reclaim_lock;
+static int reclaim_wanted; // background reclaim is requested or running
+
+/**
+ * @brief Add a shrinker, must be called during boot on one hart
+ */
+void register_shrinker(struct shrinker *shrinker) {
+    KERNEL_ASSERT(nr_shrinkers < NSHRINKER, "register_shrinker: too many shrinkers");
+    shrinkers[nr_shrinkers] = shrinker;
+    __sync_synchronize();
+    nr_shrinkers++;
+}
+
+/**
+ * @brief Ask the shrinkers for target pages, in registration order.
+ * Shrinkers may sleep, so never call it with a spinlock held.
+ *
+ * @return uint64 pages freed
+ */
+uint64 shrink_memory(uint64 target) {
+    uint64 freed = 0;
+    for (int i = 0; i < nr_shrinkers && freed < target; i++) {
+        struct shrinker *s = shrinkers[i];
+        if (s->count() == 0)
+            continue;
+        uint64 n = s->scan(target - freed);
+        debugcore("shrink_memory: %s freed %d pages", s->name, n);
+        freed += n;
+    }
+    return freed;
+}
+
+// Refill free memory up to the high watermark whenever it drops below the low one.
+static void reclaim_thread(void *arg) {
+    for (;;) {
+        acquire(&reclaim_lock);
+        while (!reclaim_wanted) {
+            sleep(&reclaim_wanted, &reclaim_lock);
+        }
+        release(&reclaim_lock);
+
+        uint64 free = get_free_page_count();
+        uint64 high = get_high_watermark();
+        if (free < high) {
+            uint64 freed = shrink_memory(high - free);
+            infof("reclaim: %d pages free, %d pages reclaimed", free, freed);
+        }
+
+        acquire(&reclaim_lock);
+        reclaim_wanted = FALSE;
+        release(&reclaim_lock);
+    }
+}
+
+void reclaim_init() {
+    init_spin_lock_with_name(&reclaim_lock, "reclaim_lock");
+    reclaim_wanted = FALSE;
+    if (kthread_create(reclaim_thread, NULL, "kreclaimd") == NULL)
+        panic("reclaim_init: can not create reclaim thread");
+}
+
+/**
+ * @brief Kick background reclaim. Must not hold any spinlock,
+ * because wakeup() takes the proc locks.
+ */
+void wakeup_reclaim() {
+    acquire(&reclaim_lock);
+    if (!reclaim_wanted) {
+        reclaim_wanted = TRUE;
+        wakeup(&reclaim_wanted);
+    }
+    release(&reclaim_lock);
+}
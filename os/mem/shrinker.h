@@ -0,0 +1,21 @@
+#if !defined(SHRINKER_H)
+#define SHRINKER_H
+
+#include <ucore/types.h>
+
+#define NSHRINKER 8
+#define RECLAIM_BATCH 32 // pages direct reclaim tries to free before failing
+
+// a subsystem holding memory it can give back under pressure
+struct shrinker {
+    const char *name;
+    uint64 (*count)(void);         // pages that could be freed now
+    uint64 (*scan)(uint64 nr);     // free up to nr pages, return pages freed
+};
+
+void register_shrinker(struct shrinker *shrinker);
+uint64 shrink_memory(uint64 target);
+void reclaim_init();
+void wakeup_reclaim();
+
+#endif // SHRINKER_H
@@ -0,0 +1,280 @@
+#include <arch/cpu.h>
+#include <arch/riscv.h>
+#include <mem/shrinker.h>
+#include <mem/slab.h>
+#include <ucore/defs.h>
+#include <utils/assert.h>
+#include <utils/log.h>
+
+// header at the beginning of every slab page, objects follow it
+struct slab {
+    struct list_head list; // in one of cache->partial, full, empty
+    struct kmem_cache *cache;
+    void *freelist;        // next free object, linked through the objects
+    uint inuse;
+};
+
+#define SLAB_OBJ_OFFSET ((sizeof(struct slab) + 7) & ~7UL)
+
+static struct kmem_cache cache_cache; // where struct kmem_cache come from
+static struct kmem_cache *kmalloc_caches[KMALLOC_MAX_SHIFT + 1];
+static const char *kmalloc_names[KMALLOC_MAX_SHIFT + 1] = {
+    [3] = "kmalloc-8",
+    [4] = "kmalloc-16",
+    [5] = "kmalloc-32",
+    [6] = "kmalloc-64",
+    [7] = "kmalloc-128",
+    [8] = "kmalloc-256",
+    [9] = "kmalloc-512",
+    [10] = "kmalloc-1024",
+    [11] = "kmalloc-2048",
+};
+
+static struct list_head cache_chain;
+static struct spinlock cache_chain_lock;
+
+static struct slab *obj_to_slab(void *obj) {
+    return (struct slab *)PGROUNDDOWN((uint64)obj);
+}
+
+static void kmem_cache_init(struct kmem_cache *cachep, const char *name, uint size) {
+    memset(cachep, 0, sizeof(*cachep));
+    safestrcpy(cachep->name, name, KMEM_CACHE_NAME_MAX);
+    cachep->size = (size + 7) & ~7U;
+    cachep->objs_per_slab = (PGSIZE - SLAB_OBJ_OFFSET) / cachep->size;
+    KERNEL_ASSERT(cachep->objs_per_slab > 0, "kmem_cache_init: object too large");
+    init_spin_lock_with_name(&cachep->lock, "kmem_cache.lock");
+    list_init(&cachep->partial);
+    list_init(&cachep->full);
+    list_init(&cachep->empty);
+
+    acquire(&cache_chain_lock);
+    list_add_tail(&cachep->chain, &cache_chain);
+    release(&cache_chain_lock);
+}
+
+// The following slab_* helpers should hold cachep->lock
+
+// carve page into objects, put it on the empty list
+static void slab_grow(struct kmem_cache *cachep, void *page) {
+    struct slab *slab = page;
+    slab->cache = cachep;
+    slab->inuse = 0;
+    slab->freelist = NULL;
+    char *base = (char *)slab + SLAB_OBJ_OFFSET;
+    for (int i = cachep->objs_per_slab - 1; i >= 0; i--) {
+        void *obj = base + i * cachep->size;
+        *(void **)obj = slab->freelist;
+        slab->freelist = obj;
+    }
+    list_add(&slab->list, &cachep->empty);
+    cachep->nr_empty++;
+    cachep->nr_slabs++;
+}
+
+static void *slab_get_obj(struct kmem_cache *cachep) {
+    struct slab *slab;
+    if (!list_empty(&cachep->partial)) {
+        slab = list_first_entry(&cachep->partial, struct slab, list);
+    } else {
+        if (list_empty(&cachep->empty))
+            return NULL;
+        slab = list_first_entry(&cachep->empty, struct slab, list);
+        cachep->nr_empty--;
+        list_move(&slab->list, &cachep->partial);
+    }
+    void *obj = slab->freelist;
+    slab->freelist = *(void **)obj;
+    slab->inuse++;
+    if (slab->inuse == cachep->objs_per_slab)
+        list_move(&slab->list, &cachep->full);
+    cachep->nr_active++;
+    return obj;
+}
+
+static void slab_put_obj(struct kmem_cache *cachep, void *obj) {
+    struct slab *slab = obj_to_slab(obj);
+    KERNEL_ASSERT(slab->cache == cachep, "slab_put_obj: object from another cache");
+    *(void **)obj = slab->freelist;
+    slab->freelist = obj;
+    if (slab->inuse == cachep->objs_per_slab)
+        list_move(&slab->list, &cachep->partial);
+    slab->inuse--;
+    cachep->nr_active--;
+    if (slab->inuse == 0) {
+        // keep one empty slab around, give the rest back
+        if (cachep->nr_empty > 0) {
+            list_del(&slab->list);
+            cachep->nr_slabs--;
+            recycle_physical_page(slab);
+        } else {
+            list_move(&slab->list, &cachep->empty);
+            cachep->nr_empty++;
+        }
+    }
+}
+
+// Pull a batch of objects from the slabs into cc,
+// after adding page as a new slab unless it is NULL.
+static void cpu_cache_refill(struct kmem_cache *cachep, struct kmem_cpu_cache *cc, void *page) {
+    acquire(&cachep->lock);
+    if (page != NULL)
+        slab_grow(cachep, page);
+    while (cc->avail < SLAB_CPU_CACHE_BATCH) {
+        void *obj = slab_get_obj(cachep);
+        if (obj == NULL)
+            break;
+        cc->objs[cc->avail++] = obj;
+    }
+    release(&cachep->lock);
+}
+
+// Push the older half of cc back to the slabs.
+static void cpu_cache_flush(struct kmem_cache *cachep, struct kmem_cpu_cache *cc) {
+    acquire(&cachep->lock);
+    for (int i = 0; i < SLAB_CPU_CACHE_BATCH; i++) {
+        slab_put_obj(cachep, cc->objs[i]);
+    }
+    release(&cachep->lock);
+    for (int i = SLAB_CPU_CACHE_BATCH; i < cc->avail; i++) {
+        cc->objs[i - SLAB_CPU_CACHE_BATCH] = cc->objs[i];
+    }
+    cc->avail -= SLAB_CPU_CACHE_BATCH;
+}
+
+static uint64 slab_shrink_count() {
+    uint64 c = 0;
+    struct list_head *pos;
+    acquire(&cache_chain_lock);
+    list_for_each(pos, &cache_chain) {
+        c += list_entry(pos, struct kmem_cache, chain)->nr_empty;
+    }
+    release(&cache_chain_lock);
+    return c;
+}
+
+// give back the spare empty slab every cache keeps
+static uint64 slab_shrink_scan(uint64 nr) {
+    uint64 freed = 0;
+    struct list_head *pos;
+    acquire(&cache_chain_lock);
+    list_for_each(pos, &cache_chain) {
+        struct kmem_cache *cachep = list_entry(pos, struct kmem_cache, chain);
+        acquire(&cachep->lock);
+        while (freed < nr && !list_empty(&cachep->empty)) {
+            struct slab *slab = list_first_entry(&cachep->empty, struct slab, list);
+            list_del(&slab->list);
+            cachep->nr_empty--;
+            cachep->nr_slabs--;
+            recycle_physical_page(slab);
+            freed++;
+        }
+        release(&cachep->lock);
+    }
+    release(&cache_chain_lock);
+    return freed;
+}
+
+static struct shrinker slab_shrinker = {
+    .name = "slab",
+    .count = slab_shrink_count,
+    .scan = slab_shrink_scan,
+};
+
+/**
+ * @brief Init the slab allocator and the kmalloc caches.
+ * Must be called after kinit().
+ */
+void slab_init() {
+    list_init(&cache_chain);
+    init_spin_lock_with_name(&cache_chain_lock, "cache_chain_lock");
+    kmem_cache_init(&cache_cache, "kmem_cache", sizeof(struct kmem_cache));
+    for (int i = KMALLOC_MIN_SHIFT; i <= KMALLOC_MAX_SHIFT; i++) {
+        kmalloc_caches[i] = kmem_cache_create(kmalloc_names[i], 1 << i);
+        KERNEL_ASSERT(kmalloc_caches[i] != NULL, "slab_init: can not create kmalloc caches");
+    }
+    register_shrinker(&slab_shrinker);
+}
+
+/**
+ * @brief Create a cache of objects of the same size
+ *
+ * @param name shown in statistics
+ * @param size object size, at most about one page
+ * @return struct kmem_cache* the cache, or NULL if out of memory
+ */
+struct kmem_cache *kmem_cache_create(const char *name, uint size) {
+    struct kmem_cache *cachep = kmem_cache_alloc(&cache_cache);
+    if (cachep == NULL)
+        return NULL;
+    kmem_cache_init(cachep, name, size);
+    return cachep;
+}
+
+/**
+ * @brief Allocate an object, the content is undefined
+ * A new slab page is allocated with no lock held and interrupts on,
+ * so that it may reclaim, unless the caller holds a spinlock.
+ *
+ * @return void* the object, or NULL if out of memory
+ */
+void *kmem_cache_alloc(struct kmem_cache *cachep) {
+    void *obj = NULL;
+    void *page = NULL;
+    for (;;) {
+        push_off();
+        struct kmem_cpu_cache *cc = &cachep->cpu[cpuid()];
+        if (cc->avail == 0 || page != NULL)
+            cpu_cache_refill(cachep, cc, page);
+        if (cc->avail > 0)
+            obj = cc->objs[--cc->avail];
+        pop_off();
+        if (obj != NULL)
+            return obj;
+        // the slabs are used up, other harts may take the new one first
+        if ((page = alloc_physical_page()) == NULL)
+            return NULL;
+    }
+}
+
+void kmem_cache_free(struct kmem_cache *cachep, void *obj) {
+    push_off();
+    struct kmem_cpu_cache *cc = &cachep->cpu[cpuid()];
+    if (cc->avail == SLAB_CPU_CACHE_SIZE)
+        cpu_cache_flush(cachep, cc);
+    cc->objs[cc->avail++] = obj;
+    pop_off();
+}
+
+/**
+ * @brief Allocate size bytes from the smallest fitting kmalloc cache
+ *
+ * @return void* the memory, or NULL if out of memory or size > KMALLOC_MAX_SIZE
+ */
+void *kmalloc(uint64 size) {
+    if (size > KMALLOC_MAX_SIZE) {
+        warnf("kmalloc: size %d is too large", size);
+        return NULL;
+    }
+    int shift = KMALLOC_MIN_SHIFT;
+    while ((1UL << shift) < size)
+        shift++;
+    return kmem_cache_alloc(kmalloc_caches[shift]);
+}
+
+void kfree(void *obj) {
+    if (obj == NULL)
+        return;
+    kmem_cache_free(obj_to_slab(obj)->cache, obj);
+}
+
+uint64 get_slab_page_count() {
+    uint64 c = 0;
+    struct list_head *pos;
+    acquire(&cache_chain_lock);
+    list_for_each(pos, &cache_chain) {
+        c += list_entry(pos, struct kmem_cache, chain)->nr_slabs;
+    }
+    release(&cache_chain_lock);
+    return c;
+}
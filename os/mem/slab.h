@@ -0,0 +1,48 @@
+#if !defined(SLAB_H)
+#define SLAB_H
+
+#include <ucore/types.h>
+#include <lock/spinlock.h>
+#include <utils/list.h>
+
+// objects a hart keeps for itself before going to the slabs
+#define SLAB_CPU_CACHE_SIZE 16
+#define SLAB_CPU_CACHE_BATCH (SLAB_CPU_CACHE_SIZE / 2) // objects moved per refill/flush
+
+// kmalloc serves power-of-two sizes from 2^KMALLOC_MIN_SHIFT to 2^KMALLOC_MAX_SHIFT
+#define KMALLOC_MIN_SHIFT 3
+#define KMALLOC_MAX_SHIFT 11
+#define KMALLOC_MAX_SIZE (1 << KMALLOC_MAX_SHIFT)
+
+#define KMEM_CACHE_NAME_MAX 16
+
+struct kmem_cpu_cache {
+    uint avail;
+    void *objs[SLAB_CPU_CACHE_SIZE];
+};
+
+// a cache of equally sized objects, carved out of one-page slabs
+struct kmem_cache {
+    char name[KMEM_CACHE_NAME_MAX];
+    uint size;          // object size, 8-byte aligned
+    uint objs_per_slab;
+    struct spinlock lock;
+    struct list_head partial; // slabs with both used and free objects
+    struct list_head full;    // slabs without free objects
+    struct list_head empty;   // slabs without used objects
+    uint nr_empty;
+    uint64 nr_slabs;
+    uint64 nr_active;   // objects handed out, including those in cpu caches
+    struct kmem_cpu_cache cpu[NCPU];
+    struct list_head chain; // in the list of all caches
+};
+
+void slab_init();
+struct kmem_cache *kmem_cache_create(const char *name, uint size);
+void *kmem_cache_alloc(struct kmem_cache *cachep);
+void kmem_cache_free(struct kmem_cache *cachep, void *obj);
+void *kmalloc(uint64 size);
+void kfree(void *obj);
+uint64 get_slab_page_count();
+
+#endif // SLAB_H
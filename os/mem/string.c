@@ -1,11 +1,21 @@
 #include <ucore/defs.h>
 
+// memset() and memmove() go a word at a time once the pointers are
+// aligned, most of what they see are whole pages and user copies.
+#define WORD_SIZE sizeof(uint64)
+#define WORD_ALIGNED(p) (((uint64)(p) & (WORD_SIZE - 1)) == 0)
+
 void *memset(void *dst, int c, uint n) {
     char *cdst = (char *)dst;
-    int i;
-    for (i = 0; i < n; i++) {
-        cdst[i] = c;
+    while (n > 0 && !WORD_ALIGNED(cdst)) {
+        *cdst++ = c;
+        n--;
     }
+    uint64 word = (uchar)c * 0x0101010101010101ULL;
+    for (; n >= WORD_SIZE; n -= WORD_SIZE, cdst += WORD_SIZE)
+        *(uint64 *)cdst = word;
+    while (n-- > 0)
+        *cdst++ = c;
     return dst;
 }
 
@@ -30,14 +40,36 @@ memmove(void *dst, const void *src, uint n) {
 
     s = src;
     d = dst;
+    // words only help if both sides can be aligned at once
+    int words = (((uint64)s ^ (uint64)d) & (WORD_SIZE - 1)) == 0;
     if (s < d && s + n > d) {
         s += n;
         d += n;
+        if (words) {
+            while (n > 0 && !WORD_ALIGNED(d)) {
+                *--d = *--s;
+                n--;
+            }
+            for (; n >= WORD_SIZE; n -= WORD_SIZE) {
+                d -= WORD_SIZE;
+                s -= WORD_SIZE;
+                *(uint64 *)d = *(const uint64 *)s;
+            }
+        }
         while (n-- > 0)
             *--d = *--s;
-    } else
+    } else {
+        if (words) {
+            while (n > 0 && !WORD_ALIGNED(d)) {
+                *d++ = *s++;
+                n--;
+            }
+            for (; n >= WORD_SIZE; n -= WORD_SIZE, d += WORD_SIZE, s += WORD_SIZE)
+                *(uint64 *)d = *(const uint64 *)s;
+        }
         while (n-- > 0)
             *d++ = *s++;
+    }
 
     return dst;
 }
@@ -0,0 +1,216 @@
+// Swapping of anonymous user pages, into zram and past it into the
+// swap file. Under memory pressure, a shrinker walks the address spaces
+// of the processes that are not running like the hand of a clock: a
+// page referenced since the last pass gets its A bit cleared, one that
+// was not ages, see struct page. Pages older than SWAP_AGE_MAX are
+// written out. The PTE keeps the slot, see SWAP_PTE(), and uvm_fault()
+// brings the page back on first touch.
+//
+// Only private pages mapped once are swapped, so no other PTE has to
+// be found. The swap file is written without p->lock, so a page is only
+// let go if its PTE did not change meanwhile: any access by p sets A,
+// see also user_addr(). A process is left alone while the kernel may
+// hold one of its pages outside the page table, see p->swap_pin.
+
+#include <arch/riscv.h>
+#include <mem/asid.h>
+#include <mem/physical.h>
+#include <mem/shrinker.h>
+#include <mem/swap.h>
+#include <mem/swapfile.h>
+#include <mem/vma.h>
+#include <mem/zram.h>
+#include <proc/proc.h>
+#include <ucore/defs.h>
+#include <utils/log.h>
+
+static uint64 swap_hand; // next process to scan
+static struct swap_stat stat;
+
+// a page picked for swapping out, with an extra reference held
+struct swap_victim {
+    uint64 va;
+    pte_t pte;   // the PTE when it was picked
+    uint64 slot; // where it was written, 0 if nowhere
+};
+
+// whether the pages of p can be swapped now, with p->lock held
+static int swappable(struct proc *p) {
+    return (p->state == RUNNABLE || p->state == SLEEPING) && !p->kthread && p->swap_pin == 0
+           && p != curr_proc();
+}
+
+// Move the hand over up to SWAP_SCAN_BATCH PTEs of p from where the
+// last scan stopped, picking at most nr pages old enough to swap out.
+// p->lock is held and p is not running.
+static int swap_scan_proc(struct proc *p, struct swap_victim *victims, int nr) {
+    uint64 scanned = 0;
+    int n = 0, changed = FALSE;
+    struct vma *v = vma_find_next(&p->vmas, p->swap_cursor);
+
+    while (v != NULL && scanned < SWAP_SCAN_BATCH && n < nr) {
+        // shared pages may be mapped elsewhere, huge pages stay put
+        if (v->flags & (MAP_SHARED | MAP_HUGETLB)) {
+            v = vma_next(v);
+            continue;
+        }
+        uint64 va = MAX(p->swap_cursor, v->start);
+        for (; va < v->end && scanned < SWAP_SCAN_BATCH && n < nr; va += PGSIZE) {
+            scanned++;
+            pte_t *pte = walk(p->pagetable, va, FALSE);
+            if (pte == NULL || (*pte & (PTE_V | PTE_U)) != (PTE_V | PTE_U))
+                continue;
+            void *pa = (void *)PTE2PA(*pte);
+            struct page *page = pa_to_page(pa);
+            if (*pte & PTE_A) {
+                *pte &= ~PTE_A;
+                page->age = 0;
+                changed = TRUE;
+            } else if (page->age < SWAP_AGE_MAX) {
+                page->age++;
+            } else if (get_physical_page_ref(pa) == 1 && !(page->flags & PG_CACHE)) {
+                dup_physical_page(pa);
+                victims[n].va = va;
+                victims[n].pte = *pte;
+                victims[n].slot = 0;
+                n++;
+            }
+        }
+        p->swap_cursor = va;
+        if (va >= v->end)
+            v = vma_next(v);
+    }
+    if (v == NULL)
+        p->swap_cursor = 0; // start over next time
+    // the harts p ran on may cache what was changed
+    if (changed)
+        asid_invalidate(p);
+    return n;
+}
+
+// zram first, the swap file takes what it has no room for. May sleep.
+static uint64 swap_store(void *pa) {
+    uint64 slot = zram_store(pa);
+    if (slot != 0)
+        return slot;
+    slot = swapfile_store(pa);
+    return slot ? slot | SWAP_FILE_SLOT : 0;
+}
+
+// Write the victims of p out with p->lock released, then swap out
+// those whose PTE is still the same. Returns the pages freed.
+static uint64 swap_out_victims(struct proc *p, struct swap_victim *victims, int n) {
+    int pid = p->pid;
+    release(&p->lock);
+    for (int i = 0; i < n; i++)
+        victims[i].slot = swap_store((void *)PTE2PA(victims[i].pte));
+    acquire(&p->lock);
+
+    uint64 freed = 0;
+    for (int i = 0; i < n; i++) {
+        struct swap_victim *s = &victims[i];
+        void *pa = (void *)PTE2PA(s->pte);
+        pte_t *pte = NULL;
+        // p may have run, forked, exec'ed or exited meanwhile
+        if (s->slot != 0 && p->pid == pid && swappable(p))
+            pte = walk(p->pagetable, s->va, FALSE);
+        if (pte != NULL && *pte == s->pte && get_physical_page_ref(pa) == 2) {
+            // nobody else shares a copy-on-write page any more
+            uint64 flags = PTE_FLAGS(*pte) & (PTE_R | PTE_W | PTE_X | PTE_U);
+            if (*pte & PTE_COW)
+                flags |= PTE_W;
+            *pte = SWAP_PTE(s->slot, flags);
+            put_physical_page(pa);
+            p->nswap++;
+            freed++;
+        } else if (s->slot != 0) {
+            swap_free(s->slot);
+        }
+        put_physical_page(pa); // the reference of swap_scan_proc()
+    }
+    if (freed > 0)
+        asid_invalidate(p);
+    __atomic_fetch_add(&stat.swap_out, freed, __ATOMIC_RELAXED);
+    return freed;
+}
+
+static uint64 swap_shrink_count(void) {
+    return zram_free_slots() + swapfile_free_slots();
+}
+
+// swap out up to nr pages, one batch of one process at a time
+static uint64 swap_shrink_scan(uint64 nr) {
+    struct swap_victim victims[SWAP_IO_BATCH];
+    uint64 freed = 0;
+    uint64 budget = nr * SWAP_SCAN_RATIO;
+    int idle = 0;
+    while (freed < nr && budget >= SWAP_SCAN_BATCH && idle < NPROC) {
+        struct proc *p = &pool[__atomic_fetch_add(&swap_hand, 1, __ATOMIC_RELAXED) % NPROC];
+        acquire(&p->lock);
+        if (swappable(p)) {
+            int n = swap_scan_proc(p, victims, MIN(nr - freed, SWAP_IO_BATCH));
+            if (n > 0)
+                freed += swap_out_victims(p, victims, n);
+            budget -= SWAP_SCAN_BATCH;
+            idle = 0;
+        } else {
+            idle++;
+        }
+        release(&p->lock);
+    }
+    return freed;
+}
+
+static struct shrinker swap_shrinker = {
+    .name = "swap",
+    .count = swap_shrink_count,
+    .scan = swap_shrink_scan,
+};
+
+/**
+ * @brief Init zram and register swapping as the last resort of reclaim.
+ * Must be called after the other shrinkers are registered.
+ */
+void swap_init() {
+    zram_init();
+    register_shrinker(&swap_shrinker);
+}
+
+/**
+ * @brief Read the page in slot into pa for p and drop p's reference to it
+ * May sleep when the page is in the swap file.
+ *
+ * @return int 0 on success, -1 if it could not be read
+ */
+int swap_in(struct proc *p, uint64 slot, void *pa) {
+    if (slot & SWAP_FILE_SLOT) {
+        if (swapfile_load(slot & ~SWAP_FILE_SLOT, pa) != 0)
+            return -1;
+    } else if (zram_load(slot, pa) != 0) {
+        return -1;
+    }
+    swap_free(slot);
+    p->majflt++;
+    __atomic_fetch_add(&stat.swap_in, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+// another PTE refers to slot, see uvm_share_page()
+void swap_dup(uint64 slot) {
+    if (slot & SWAP_FILE_SLOT)
+        swapfile_dup(slot & ~SWAP_FILE_SLOT);
+    else
+        zram_dup(slot);
+}
+
+void swap_free(uint64 slot) {
+    if (slot & SWAP_FILE_SLOT)
+        swapfile_free(slot & ~SWAP_FILE_SLOT);
+    else
+        zram_free(slot);
+}
+
+void get_swap_stat(struct swap_stat *s) {
+    s->swap_out = __atomic_load_n(&stat.swap_out, __ATOMIC_RELAXED);
+    s->swap_in = __atomic_load_n(&stat.swap_in, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,31 @@
+#if !defined(SWAP_H)
+#define SWAP_H
+
+#include <ucore/types.h>
+
+// A swapped out page keeps its PTE with V clear and PTE_LAZY set,
+// the PPN field holds its swap slot, which is never 0.
+#define SWAP_PTE(slot, flags) (((uint64)(slot) << 10) | (flags) | PTE_LAZY)
+#define PTE_SWAP_SLOT(pte) ((pte) >> 10)
+// set in the slots of the swap file, the others are zram's
+#define SWAP_FILE_SLOT (1UL << 40)
+
+#define SWAP_SCAN_BATCH 64  // PTEs looked at per p->lock hold
+#define SWAP_SCAN_RATIO 64  // PTEs looked at per page asked for
+#define SWAP_AGE_MAX 2      // scans a page must go unreferenced before it is swapped
+#define SWAP_IO_BATCH 16    // pages written per p->lock release
+
+struct swap_stat {
+    uint64 swap_out; // pages swapped out since boot
+    uint64 swap_in;  // pages swapped back in
+};
+
+struct proc;
+
+void swap_init();
+int swap_in(struct proc *p, uint64 slot, void *pa);
+void swap_dup(uint64 slot);
+void swap_free(uint64 slot);
+void get_swap_stat(struct swap_stat *stat);
+
+#endif // SWAP_H
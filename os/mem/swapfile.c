@@ -0,0 +1,145 @@
+#include <arch/riscv.h>
+#include <fatfs/ff.h>
+#include <fatfs/diskio.h>
+#include <lock/lock.h>
+#include <mem/physical.h>
+#include <mem/swapfile.h>
+#include <ucore/defs.h>
+#include <utils/assert.h>
+#include <utils/log.h>
+
+static struct {
+    struct spinlock lock;
+    uint32 *refcount; // page table entries referring to each slot, slot 0 is never used
+    uint64 nr_slots;  // 0 until the file is set up
+    uint64 nr_free;
+    uint64 hint;      // where the search for a free slot starts
+    uint64 start;     // sector of slot 1
+    uint8 pdrv;
+} swapfile;
+
+static FIL file;
+
+static uint64 slot_sector(uint64 slot) {
+    return swapfile.start + (slot - 1) * SWAPFILE_PAGE_SECTORS;
+}
+
+// Create the file with size bytes in one run of clusters.
+// Returns its first sector, 0 if the volume has no such run.
+static uint64 reserve(uint64 size) {
+    if (f_open(&file, SWAPFILE_PATH, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
+        return 0;
+    if (f_expand(&file, size, 1) != FR_OK) {
+        f_close(&file);
+        return 0;
+    }
+    FATFS *fs = file.obj.fs;
+    uint64 start = fs->database + (uint64)(file.obj.sclust - 2) * fs->csize;
+    swapfile.pdrv = fs->pdrv;
+    if (f_close(&file) != FR_OK)
+        return 0;
+    return start;
+}
+
+/**
+ * @brief Reserve the swap file, what it held before is dropped.
+ * It needs the file system, so the first process calls it after ffinit().
+ * Without room for it, swapping stays in zram.
+ */
+void swapfile_init() {
+    init_spin_lock_with_name(&swapfile.lock, "swapfile.lock");
+    uint64 size = SWAPFILE_SIZE, start = 0;
+    for (; size >= SWAPFILE_MIN_SIZE; size /= 2) {
+        if ((start = reserve(size)) != 0)
+            break;
+    }
+    if (start == 0) {
+        f_unlink(SWAPFILE_PATH);
+        warnf("swapfile: no room on the volume");
+        return;
+    }
+
+    uint64 nr_slots = size / PGSIZE + 1;
+    int order = 0;
+    while ((PGSIZE << order) < nr_slots * sizeof(uint32))
+        order++;
+    KERNEL_ASSERT(order <= BUDDY_MAX_ORDER, "swapfile_init: slot table too large");
+    swapfile.refcount = alloc_physical_pages(order);
+    KERNEL_ASSERT(swapfile.refcount != NULL, "swapfile_init: can not allocate slot table");
+    memset(swapfile.refcount, 0, nr_slots * sizeof(uint32));
+    swapfile.start = start;
+    swapfile.nr_free = nr_slots - 1;
+    swapfile.hint = 1;
+    __atomic_store_n(&swapfile.nr_slots, nr_slots, __ATOMIC_RELEASE);
+    infof("swapfile: %d slots from sector %d", nr_slots - 1, start);
+}
+
+/**
+ * @brief Write the page at pa to a free slot, sleeps for the disk
+ *
+ * @return uint64 the slot with one reference, 0 if the file is full
+ */
+uint64 swapfile_store(void *pa) {
+    uint64 nr_slots = __atomic_load_n(&swapfile.nr_slots, __ATOMIC_ACQUIRE);
+    if (nr_slots == 0)
+        return 0;
+
+    acquire(&swapfile.lock);
+    if (swapfile.nr_free == 0) {
+        release(&swapfile.lock);
+        return 0;
+    }
+    // next fit, so consecutive stores go to consecutive sectors
+    uint64 slot = swapfile.hint;
+    while (swapfile.refcount[slot] != 0)
+        slot = slot + 1 < nr_slots ? slot + 1 : 1;
+    swapfile.refcount[slot] = 1;
+    swapfile.nr_free--;
+    swapfile.hint = slot + 1 < nr_slots ? slot + 1 : 1;
+    release(&swapfile.lock);
+
+    if (disk_rw_direct(swapfile.pdrv, pa, slot_sector(slot), SWAPFILE_PAGE_SECTORS, TRUE) != RES_OK) {
+        swapfile_free(slot);
+        return 0;
+    }
+    return slot;
+}
+
+/**
+ * @brief Read the page in slot into pa, sleeps for the disk
+ *
+ * @return int 0 on success, -1 on a disk error
+ */
+int swapfile_load(uint64 slot, void *pa) {
+    KERNEL_ASSERT(slot > 0 && slot < swapfile.nr_slots && swapfile.refcount[slot] > 0,
+                  "swapfile_load: bad slot");
+    if (disk_rw_direct(swapfile.pdrv, pa, slot_sector(slot), SWAPFILE_PAGE_SECTORS, FALSE) != RES_OK)
+        return -1;
+    return 0;
+}
+
+void swapfile_dup(uint64 slot) {
+    acquire(&swapfile.lock);
+    KERNEL_ASSERT(slot > 0 && slot < swapfile.nr_slots && swapfile.refcount[slot] > 0,
+                  "swapfile_dup: bad slot");
+    swapfile.refcount[slot]++;
+    release(&swapfile.lock);
+}
+
+void swapfile_free(uint64 slot) {
+    acquire(&swapfile.lock);
+    KERNEL_ASSERT(slot > 0 && slot < swapfile.nr_slots && swapfile.refcount[slot] > 0,
+                  "swapfile_free: bad slot");
+    if (--swapfile.refcount[slot] == 0)
+        swapfile.nr_free++;
+    release(&swapfile.lock);
+}
+
+uint64 swapfile_slots() {
+    uint64 nr_slots = __atomic_load_n(&swapfile.nr_slots, __ATOMIC_ACQUIRE);
+    return nr_slots ? nr_slots - 1 : 0;
+}
+
+uint64 swapfile_free_slots() {
+    return __atomic_load_n(&swapfile.nr_free, __ATOMIC_RELAXED);
+}
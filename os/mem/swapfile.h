@@ -0,0 +1,22 @@
+#if !defined(SWAPFILE_H)
+#define SWAPFILE_H
+
+#include <ucore/types.h>
+
+// Swap file on the FAT root volume, where swap.c puts the pages
+// zram has no room for. It is one contiguous run of clusters, so
+// a slot is a fixed range of sectors and moves in one request.
+#define SWAPFILE_PATH "0:/swapfile"
+#define SWAPFILE_SIZE (32UL << 20) // halved until the volume has room
+#define SWAPFILE_MIN_SIZE (1UL << 20)
+#define SWAPFILE_PAGE_SECTORS (PGSIZE / 512)
+
+void swapfile_init();
+uint64 swapfile_store(void *pa);
+int swapfile_load(uint64 slot, void *pa);
+void swapfile_dup(uint64 slot);
+void swapfile_free(uint64 slot);
+uint64 swapfile_slots();
+uint64 swapfile_free_slots();
+
+#endif // SWAPFILE_H
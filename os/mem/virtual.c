@@ -1,11 +1,18 @@
 #include <ucore/defs.h>
+#include <mem/asid.h>
 #include <mem/memory_layout.h>
 #include <sifive/platform.h>
 #include <arch/riscv.h>
 #include <utils/log.h>
 #include <proc/proc.h>
+#include <mem/physical.h>
+#include <mem/swap.h>
 pagetable_t kernel_pagetable;
 
+// Read-only page of zeros shared by every untouched private page that
+// was only read, writes copy it, see uvm_cow_fault(). It is never freed.
+static void *zero_page;
+
 extern char e_text[]; // kernel.ld sets this to end of kernel code.
 extern char trampoline[];
 
@@ -14,8 +21,7 @@ pagetable_t kvmmake(void)
 {
     pagetable_t kpgtbl;
 
-    kpgtbl = (pagetable_t)alloc_physical_page();
-    memset(kpgtbl, 0, PGSIZE);
+    kpgtbl = (pagetable_t)alloc_zeroed_page();
 
     // uart registers
     // kvmmap(kpgtbl, UART0, UART0, PGSIZE, PTE_R | PTE_W);
@@ -51,6 +57,8 @@ void kvminit(void)
 {
     // generate the kernel page table
     kernel_pagetable = kvmmake();
+    zero_page = alloc_zeroed_page();
+    KERNEL_ASSERT(zero_page != NULL, "kvminit: can not allocate the zero page");
 }
 
 // Switch h/w page table register to the kernel's page table,
@@ -77,17 +85,22 @@ void kvminithart()
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
-pte_t *
-walk(pagetable_t pagetable, uint64 va, int alloc)
+//
+// A valid leaf PTE at level 2 or 1 maps a 1 GiB or 2 MiB superpage,
+// the walk stops there and *level tells which one it is.
+static pte_t *
+walk_level(pagetable_t pagetable, uint64 va, int alloc, int *level)
 {
     if (va >= MAXVA)
         panic("walk");
 
-    for (int level = 2; level > 0; level--)
+    for (*level = 2; *level > 0; (*level)--)
     {
-        pte_t *pte = &pagetable[PX(level, va)];
+        pte_t *pte = &pagetable[PX(*level, va)];
         if (*pte & PTE_V)
         {
+            if (PTE_LEAF(*pte))
+                return pte;
             // found the pte
             pagetable = (pagetable_t)PTE2PA(*pte);
         }
@@ -99,7 +112,7 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
                 return NULL;
             }
             // should create new child page table
-            pagetable = (pde_t *)alloc_physical_page();
+            pagetable = (pde_t *)alloc_zeroed_page();
             if (pagetable == NULL)
             {
                 warnf("out of memory when creating pagetable");
@@ -108,34 +121,36 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
 
             // create new child pagetable successfully
             // point to it
-            memset(pagetable, 0, PGSIZE);
             *pte = PA2PTE(pagetable) | PTE_V;
         }
     }
     return &pagetable[PX(0, va)];
 }
 
+pte_t *
+walk(pagetable_t pagetable, uint64 va, int alloc)
+{
+    int level;
+    return walk_level(pagetable, va, alloc, &level);
+}
+
 // Look up a virtual address, return the physical address,
 // or 0 if not mapped.
 // Can only be used to look up user pages.
+static uint64 user_addr(pagetable_t pagetable, uint64 va, int write, uint64 *span);
+
+// The kernel touching a reserved page of the running process faults it in.
+// A caller that writes through the result must pass write, so that it gets
+// a page of its own instead of the zero page or a copy-on-write page.
 uint64
-walkaddr(pagetable_t pagetable, uint64 va)
+walkaddr(pagetable_t pagetable, uint64 va, int write)
 {
-    pte_t *pte;
-    uint64 pa;
-
-    if (va >= MAXVA)
+    uint64 span;
+    uint64 pa = user_addr(pagetable, va, write, &span);
+    if (pa == 0)
         return 0;
-
-    pte = walk(pagetable, va, FALSE);
-    if (pte == 0)
-        return 0;
-    if ((*pte & PTE_V) == 0)
-        return 0;
-    if ((*pte & PTE_U) == 0)
-        return 0;
-    pa = PTE2PA(*pte);
-    return pa;
+    // the page of va within a superpage
+    return PGROUNDDOWN(pa);
 }
 
 uint64
@@ -147,19 +162,20 @@ walkaddr_k(pagetable_t pagetable, uint64 va)
     if (va >= MAXVA)
         return 0;
 
-    pte = walk(pagetable, va, FALSE);
+    int level;
+    pte = walk_level(pagetable, va, FALSE, &level);
     if (pte == 0)
         return 0;
     if ((*pte & PTE_V) == 0)
         return 0;
-    pa = PTE2PA(*pte);
+    pa = PTE2PA(*pte) + (PGROUNDDOWN(va) & (LEVEL_SIZE(level) - 1));
     return pa;
 }
 
 // Look up a virtual address, return the physical address,
-uint64 virt_addr_to_physical(pagetable_t pagetable, uint64 va)
+uint64 virt_addr_to_physical(pagetable_t pagetable, uint64 va, int write)
 {
-    uint64 page = walkaddr(pagetable, va);
+    uint64 page = walkaddr(pagetable, va, write);
     if (page == 0)
         return 0;
     return page | (va & 0xFFFULL);
@@ -174,10 +190,38 @@ void kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
         panic("kvmmap");
 }
 
+// Install a leaf PTE for va at the given level, allocating
+// the page-table pages above it.
+static pte_t *walk_create_leaf(pagetable_t pagetable, uint64 va, int level)
+{
+    for (int l = 2; l > level; l--)
+    {
+        pte_t *pte = &pagetable[PX(l, va)];
+        if (*pte & PTE_V)
+        {
+            if (PTE_LEAF(*pte))
+                panic("remap");
+            pagetable = (pagetable_t)PTE2PA(*pte);
+        }
+        else
+        {
+            if ((pagetable = (pde_t *)alloc_zeroed_page()) == NULL)
+            {
+                warnf("out of memory when creating pagetable");
+                return NULL;
+            }
+            *pte = PA2PTE(pagetable) | PTE_V;
+        }
+    }
+    return &pagetable[PX(level, va)];
+}
+
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
 // be page-aligned. Returns 0 on success, -1 if walk() couldn't
 // allocate a needed page-table page.
+// Kernel mappings use 1 GiB and 2 MiB leaves wherever va and pa
+// are aligned alike and the range covers the whole superpage.
 int mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 {
     uint64 a, last;
@@ -190,21 +234,28 @@ int mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
     //        HAS_BIT(perm, PTE_R));
     a = PGROUNDDOWN(va);
     last = PGROUNDDOWN(va + size - 1);
-    // int cnt =0 ;
     for (;;)
     {
-        // cnt+=1;
-        if ((pte = walk(pagetable, a, 1)) == 0)
+        int level = 0;
+        if ((perm & PTE_U) == 0)
+        {
+            for (level = 2; level > 0; level--)
+            {
+                uint64 sz = LEVEL_SIZE(level);
+                if (a % sz == 0 && pa % sz == 0 && last - a >= sz - PGSIZE)
+                    break;
+            }
+        }
+        if ((pte = walk_create_leaf(pagetable, a, level)) == 0)
             return -1;
         if (*pte & PTE_V)
             panic("remap");
         *pte = PA2PTE(pa) | perm | PTE_V | PTE_A | PTE_D; // U74 requires A and D = 1
-        if (a == last)
+        if (last - a < LEVEL_SIZE(level))
             break;
-        a += PGSIZE;
-        pa += PGSIZE;
+        a += LEVEL_SIZE(level);
+        pa += LEVEL_SIZE(level);
     }
-    // debugf("map page cnt=%d", cnt);
     return 0;
 }
 
@@ -236,32 +287,111 @@ int map1page(pagetable_t pagetable, uint64 va, uint64 pa, int perm)
     return size;
 }
 
+/**
+ * @brief Map the 2 MiB page at pa to va, both must be 2 MiB aligned
+ * and nothing may be mapped in [va, va + HUGEPGSIZE) yet.
+ *
+ * @return int 0 on success, -1 if out of memory
+ */
+int map1hugepage(pagetable_t pagetable, uint64 va, uint64 pa, int perm)
+{
+    pte_t *pte;
+    KERNEL_ASSERT(va % HUGEPGSIZE == 0 && pa % HUGEPGSIZE == 0, "map1hugepage: not aligned");
+    if ((pte = walk_create_leaf(pagetable, va, 1)) == 0)
+        return -1;
+    if (*pte & PTE_V)
+        panic("map1hugepage: remap");
+    *pte = PA2PTE(pa) | perm | PTE_V | PTE_A | PTE_D;
+    return 0;
+}
+
+// A page cache page mapped shared and written through pte
+// is marked dirty in the page cache. Returns whether it was.
+static int uvm_transfer_dirty(pte_t *pte)
+{
+    if ((*pte & (PTE_V | PTE_D)) != (PTE_V | PTE_D))
+        return 0;
+    void *pa = (void *)PTE2PA(*pte);
+    if ((pa_to_page(pa)->flags & PG_CACHE) == 0)
+        return 0;
+    ctable_mark_dirty(pa);
+    return 1;
+}
+
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
+// page-aligned. The mappings must exist, a superpage must be
+// covered as a whole.
 // Optionally free the physical memory.
 void uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
-    uint64 a;
+    uint64 a, step;
     pte_t *pte;
+    int level;
     debugf("va=%p npages=%d do_free=%d", va, npages, do_free);
     if ((va % PGSIZE) != 0)
         panic("uvmunmap: not aligned");
 
-    for (a = va; a < va + npages * PGSIZE; a += PGSIZE)
+    for (a = va; a < va + npages * PGSIZE; a += step)
     {
-        if ((pte = walk(pagetable, a, FALSE)) == 0)
+        if ((pte = walk_level(pagetable, a, FALSE, &level)) == 0)
             panic("uvmunmap: walk");
+        step = LEVEL_SIZE(level);
+        if (a % step != 0 || va + npages * PGSIZE - a < step)
+            panic("uvmunmap: partial superpage");
         if ((*pte & PTE_V) == 0)
-            panic("uvmunmap: not mapped");
+        {
+            // reserved but never touched, nothing to free but a swap slot
+            if ((*pte & PTE_LAZY) == 0)
+                panic("uvmunmap: not mapped");
+            if (do_free && PTE_SWAP_SLOT(*pte) != 0)
+                swap_free(PTE_SWAP_SLOT(*pte));
+            *pte = 0;
+            continue;
+        }
         if (PTE_FLAGS(*pte) == PTE_V)
             panic("uvmunmap: not a leaf");
         if (do_free)
         {
             uint64 pa = PTE2PA(*pte);
-            put_physical_page((void *)pa);
+            uvm_transfer_dirty(pte);
+            put_physical_pages((void *)pa, level * HUGEPG_ORDER);
         }
         *pte = 0;
     }
+    flush_tlb_user_range(pagetable, va, npages);
+}
+
+/**
+ * @brief Write back the page cache pages of a shared file mapping
+ * Pages written through the mapping since the last sync are found
+ * by their PTE dirty bit.
+ *
+ * @return 0 on success, -1 if a write back failed
+ */
+int uvmsync(pagetable_t pagetable, uint64 va, uint64 npages)
+{
+    uint64 a;
+    pte_t *pte;
+    int ret = 0;
+
+    for (a = va; a < va + npages * PGSIZE; a += PGSIZE)
+    {
+        pte = walk(pagetable, a, FALSE);
+        if (pte && uvm_transfer_dirty(pte))
+            *pte &= ~PTE_D;
+    }
+    // later writes must set the dirty bit again
+    flush_tlb_user_range(pagetable, va, npages);
+    for (a = va; a < va + npages * PGSIZE; a += PGSIZE)
+    {
+        pte = walk(pagetable, a, FALSE);
+        if (pte && (*pte & PTE_V) && (pa_to_page((void *)PTE2PA(*pte))->flags & PG_CACHE))
+        {
+            if (ctable_sync((void *)PTE2PA(*pte)) != 0)
+                ret = -1;
+        }
+    }
+    return ret;
 }
 
 // create an empty user page table.
@@ -271,11 +401,7 @@ pagetable_t
 create_empty_user_pagetable()
 {
     pagetable_t pagetable;
-    pagetable = (pagetable_t)alloc_physical_page();
-    if (pagetable != NULL)
-    {
-        memset(pagetable, 0, PGSIZE);
-    }
+    pagetable = (pagetable_t)alloc_zeroed_page();
     return pagetable;
 }
 
@@ -293,13 +419,12 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
     oldsz = PGROUNDUP(oldsz);
     for (a = oldsz; a < newsz; a += PGSIZE)
     {
-        mem = alloc_physical_page();
+        mem = alloc_zeroed_page();
         if (mem == 0)
         {
             uvmdealloc(pagetable, a, oldsz);
             return 0;
         }
-        memset(mem, 0, PGSIZE);
         if (mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_W | PTE_X | PTE_R | PTE_U) != 0)
         {
             recycle_physical_page(mem);
@@ -310,6 +435,33 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
     return newsz;
 }
 
+// Like uvmalloc(), but only reserve the range: every page gets a
+// PTE_LAZY entry with perm and is zero-filled on first touch.
+// Returns new size or 0 on error.
+uint64
+uvmreserve(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int perm)
+{
+    uint64 a;
+    pte_t *pte;
+
+    if (newsz < oldsz)
+        return oldsz;
+
+    oldsz = PGROUNDUP(oldsz);
+    for (a = oldsz; a < newsz; a += PGSIZE)
+    {
+        if ((pte = walk(pagetable, a, TRUE)) == 0)
+        {
+            uvmdealloc(pagetable, a, oldsz);
+            return 0;
+        }
+        if (*pte & (PTE_V | PTE_LAZY))
+            panic("uvmreserve: remap");
+        *pte = perm | PTE_LAZY;
+    }
+    return newsz;
+}
+
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
@@ -352,25 +504,6 @@ void free_pagetable_pages(pagetable_t pagetable)
     recycle_physical_page((void *)pagetable);
 }
 
-// Free user memory pages,
-// then free page-table pages.
-// total_size used for checking
-void free_user_mem_and_pagetables(pagetable_t pagetable, uint64 total_size)
-{
-
-    // free ustack
-    debugcore("free_user_mem_and_pagetables free stack");
-    uvmunmap(pagetable, USER_STACK_BOTTOM - USTACK_SIZE, USTACK_SIZE / PGSIZE, TRUE);
-    total_size -= USTACK_SIZE;
-    
-    // free bin
-    debugcore("free_user_mem_and_pagetables free bin");
-    uvmunmap(pagetable, USER_TEXT_START, PGROUNDUP(total_size) / PGSIZE, TRUE);
-
-    // free page-table pages
-    free_pagetable_pages(pagetable);
-}
-
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
 void uvmclear(pagetable_t pagetable, uint64 va)
@@ -383,160 +516,427 @@ void uvmclear(pagetable_t pagetable, uint64 va)
     *pte &= ~PTE_U;
 }
 
-int uvmcopy(pagetable_t old_pagetable, pagetable_t new_pagetable, uint64 total_size)
+// Map the page at va of old_pagetable into new_pagetable as well.
+// If cow, a writable page is turned read-only in both and gets copied
+// on the first write, see uvm_cow_fault().
+// A private superpage is copied right away instead.
+// Returns the number of bytes mapped, -1 if out of memory.
+static int64 uvm_share_page(pagetable_t old_pagetable, pagetable_t new_pagetable, uint64 va, int cow)
 {
     pte_t *pte;
-    uint64 pa, cur_addr;
-    uint flags;
-    char *mem;
-    // debugcore("to copy ustack, sz=%d", total_size);
-    // copy ustack
-    for (cur_addr = USER_STACK_BOTTOM - USTACK_SIZE; cur_addr < USER_STACK_BOTTOM; cur_addr += PGSIZE)
+    uint64 pa;
+    int level;
+    if ((pte = walk_level(old_pagetable, va, FALSE, &level)) == 0)
+        panic("uvm_share_page: pte should exist");
+    if ((*pte & PTE_V) == 0)
     {
-        if ((pte = walk(old_pagetable, cur_addr, FALSE)) == 0)
-            panic("uvmcopy: pte should exist");
-        if ((*pte & PTE_V) == 0)
-            panic("uvmcopy: page not present");
-        pa = PTE2PA(*pte);
-        flags = PTE_FLAGS(*pte);
-        if ((mem = alloc_physical_page()) == 0)
-            goto err_ustack;
-        memmove(mem, (char *)pa, PGSIZE);
-        if (mappages(new_pagetable, cur_addr, PGSIZE, (uint64)mem, flags) != 0)
+        // not touched yet, the child gets its own reservation
+        if ((*pte & PTE_LAZY) == 0)
+            panic("uvm_share_page: page not present");
+        pte_t *new_pte = walk(new_pagetable, va, TRUE);
+        if (new_pte == 0)
+            return -1;
+        // a swapped out page is read in separately by each
+        if (PTE_SWAP_SLOT(*pte) != 0)
+            swap_dup(PTE_SWAP_SLOT(*pte));
+        *new_pte = *pte;
+        return PGSIZE;
+    }
+    pa = PTE2PA(*pte);
+    if (level > 0)
+    {
+        KERNEL_ASSERT(level == 1 && va % HUGEPGSIZE == 0, "uvm_share_page: bad superpage");
+        char *mem = (char *)pa;
+        if (cow)
         {
-            recycle_physical_page(mem);
-            goto err_ustack;
+            if ((mem = alloc_physical_pages(HUGEPG_ORDER)) == NULL)
+                return -1;
+            memmove(mem, (char *)pa, HUGEPGSIZE);
         }
+        else
+        {
+            dup_physical_page((void *)pa);
+        }
+        if (map1hugepage(new_pagetable, va, (uint64)mem, PTE_FLAGS(*pte) & ~PTE_V) != 0)
+        {
+            put_physical_pages(mem, HUGEPG_ORDER);
+            return -1;
+        }
+        return HUGEPGSIZE;
     }
+    if (cow && (*pte & PTE_W))
+        *pte = (*pte & ~PTE_W) | PTE_COW;
+    dup_physical_page((void *)pa);
+    // keep the parent's A and D bits, a set D marks a shared file page dirty
+    if (map1page(new_pagetable, va, pa, PTE_FLAGS(*pte) & ~PTE_V) < 0)
+    {
+        put_physical_page((void *)pa);
+        return -1;
+    }
+    return PGSIZE;
+}
 
-    total_size -= USTACK_SIZE;
-    // debugcore("to copy bin, sz=%d", total_size);
-    // free any other
-    for (cur_addr = USER_TEXT_START; cur_addr < USER_TEXT_START+total_size; cur_addr += PGSIZE)
+int uvmmap_dup(pagetable_t old_pagetable, pagetable_t new_pagetable, uint64 va, uint npages, bool shared) {
+    uint64 cur_addr;
+    int64 step;
+    for (cur_addr = va; cur_addr < va + npages * PGSIZE; cur_addr += step)
     {
-        if ((pte = walk(old_pagetable, cur_addr, FALSE)) == 0)
-            panic("uvmcopy: pte should exist");
-        if ((*pte & PTE_V) == 0)
-            panic("uvmcopy: page not present");
-        pa = PTE2PA(*pte);
-        flags = PTE_FLAGS(*pte);
-        if ((mem = alloc_physical_page()) == 0)
-            goto err;
-        memmove(mem, (char *)pa, PGSIZE);
-        if (mappages(new_pagetable, cur_addr, PGSIZE, (uint64)mem, flags) != 0)
-        {
-            recycle_physical_page(mem);
+        // private mappings are copy-on-write
+        if ((step = uvm_share_page(old_pagetable, new_pagetable, cur_addr, !shared)) < 0)
             goto err;
-        }
     }
+    // the parent lost write permission on its pages
+    flush_tlb_user_range(old_pagetable, va, npages);
     return 0;
 
-err_ustack:
-    debugcore("Copy ustack error");
-    uvmunmap(new_pagetable, USER_STACK_BOTTOM - USTACK_SIZE, USTACK_SIZE / PGSIZE, TRUE);
-    return -1;
-
 err:
-    debugcore("Copy user space error");
-    uvmunmap(new_pagetable, USER_TEXT_START, (cur_addr - USER_TEXT_START) / PGSIZE, TRUE);
+    debugcore("uvmmap_dup error");
+    uvmunmap(new_pagetable, va, (cur_addr - va) / PGSIZE, TRUE);
+    flush_tlb_user_range(old_pagetable, va, npages);
     return -1;
 }
 
-int uvmmap_dup(pagetable_t old_pagetable, pagetable_t new_pagetable, uint64 va, uint npages, bool shared) {
-    pte_t *pte;
-    uint64 pa, cur_addr;
-    uint flags;
+/**
+ * @brief Resolve a write to a copy-on-write page
+ * The last sharer takes the page over, the others get a private copy.
+ *
+ * @return 0 if va is now writable, -1 if it is not a COW page or out of memory
+ */
+int uvm_cow_fault(pagetable_t pagetable, uint64 va)
+{
+    pte_t *pte, old;
+    uint64 pa, flags;
     char *mem;
-    for (cur_addr = va; cur_addr < va + npages * PGSIZE; cur_addr += PGSIZE)
+
+    if (va >= MAXVA)
+        return -1;
+    pte = walk(pagetable, PGROUNDDOWN(va), FALSE);
+    if (pte == 0 || (*pte & (PTE_V | PTE_U | PTE_COW)) != (PTE_V | PTE_U | PTE_COW))
+        return -1;
+    old = *pte;
+    pa = PTE2PA(old);
+    flags = (PTE_FLAGS(old) & ~PTE_COW) | PTE_W;
+    if (get_physical_page_ref((void *)pa) == 1)
     {
-        if ((pte = walk(old_pagetable, cur_addr, FALSE)) == 0)
-            panic("uvmcopy: pte should exist");
-        if ((*pte & PTE_V) == 0)
-            panic("uvmcopy: page not present");
-        pa = PTE2PA(*pte);
-        flags = PTE_FLAGS(*pte);
-        if (shared) {
-            dup_physical_page((char *)pa);
-            mem = (char *)pa;
-        } else {
-            if ((mem = alloc_physical_page()) == 0)
-                goto err;
-            memmove(mem, (char *)pa, PGSIZE);
-        }
-        if (mappages(new_pagetable, cur_addr, PGSIZE, (uint64)mem, flags) != 0)
+        *pte = PA2PTE(pa) | flags;
+    }
+    else
+    {
+        // a copy of the zero page comes from the pre-zeroed pool
+        mem = pa == (uint64)zero_page ? alloc_zeroed_page() : alloc_physical_page();
+        if (mem == 0)
+            return -1;
+        // reclaim may have slept and swapped the page out meanwhile
+        if (*pte != old)
         {
             put_physical_page(mem);
-            goto err;
+            return 0;
         }
+        if (pa != (uint64)zero_page)
+            memmove(mem, (char *)pa, PGSIZE);
+        *pte = PA2PTE(mem) | flags;
+        put_physical_page((void *)pa);
     }
+    flush_tlb_user_range(pagetable, PGROUNDDOWN(va), 1);
     return 0;
-
-err:
-    debugcore("uvmmap_dup error");
-    uvmunmap(new_pagetable, va, npages, TRUE);
-    return -1;
 }
 
-int uvmprotect(pagetable_t pagetable, uint64 va, uint npages, uint perm) {
+/**
+ * @brief Give npages pages from va the permission perm
+ * A private page that other page tables still share, or the zero page,
+ * only gets write permission back on the first write.
+ *
+ * @param cow whether the pages are private, not MAP_SHARED
+ */
+int uvmprotect(pagetable_t pagetable, uint64 va, uint npages, uint perm, bool cow) {
     pte_t *pte;
     uint64 cur_addr;
+    int level;
     if (perm & ~(PTE_R | PTE_W | PTE_X)) {
         infof("uvmprotect: invalid perm %x, only support RWX modification", perm);
         return -1;
     }
 
-    for (cur_addr = va; cur_addr < va + npages * PGSIZE; cur_addr += PGSIZE) {
-        if ((pte = walk(pagetable, cur_addr, FALSE)) == 0) {
+    // a superpage takes the new permission as a whole
+    for (cur_addr = va; cur_addr < va + npages * PGSIZE; cur_addr = ROUNDDOWN(cur_addr, LEVEL_SIZE(level)) + LEVEL_SIZE(level)) {
+        if ((pte = walk_level(pagetable, cur_addr, FALSE, &level)) == 0) {
             infof("uvmprotect: pte should exist");
             return -1;
         }
-        if ((*pte & PTE_V) == 0) {
+        if ((*pte & (PTE_V | PTE_LAZY)) == 0) {
             infof("uvmprotect: page not present");
             return -1;
         }
-        *pte = (*pte & ~(PTE_R | PTE_W | PTE_X)) | perm;
+        if ((*pte & PTE_COW) || (cow && (perm & PTE_W) && (*pte & (PTE_V | PTE_W)) == PTE_V
+                                 && get_physical_page_ref((void *)PTE2PA(*pte)) > 1)) {
+            // still shared, write permission comes back on the first write
+            *pte = (*pte & ~(PTE_R | PTE_X | PTE_COW)) | (perm & ~PTE_W) | ((perm & PTE_W) ? PTE_COW : 0);
+        } else {
+            *pte = (*pte & ~(PTE_R | PTE_W | PTE_X)) | perm;
+        }
+    }
+    flush_tlb_user_range(pagetable, va, npages);
+    return 0;
+}
+
+/**
+ * @brief Move the PTEs of npages pages from old to new, for mremap()
+ * The pages themselves, reservations and swap slots go along as they are.
+ * [new, new + npages pages) must be unmapped and not overlap the old range.
+ *
+ * @return 0 on success, -1 if out of memory for page tables, nothing is moved
+ */
+int uvmmove(pagetable_t pagetable, uint64 old, uint64 new, uint64 npages)
+{
+    // allocate the page tables first so that the move can not fail halfway
+    for (uint64 i = 0; i < npages; i++)
+    {
+        if (walk(pagetable, new + i * PGSIZE, TRUE) == 0)
+            return -1;
+    }
+    for (uint64 i = 0; i < npages; i++)
+    {
+        pte_t *from = walk(pagetable, old + i * PGSIZE, FALSE);
+        pte_t *to = walk(pagetable, new + i * PGSIZE, FALSE);
+        if (from == 0 || (*from & (PTE_V | PTE_LAZY)) == 0)
+            panic("uvmmove: not mapped");
+        if (*to & (PTE_V | PTE_LAZY))
+            panic("uvmmove: remap");
+        *to = *from;
+        *from = 0;
+    }
+    flush_tlb_user_range(pagetable, old, npages);
+    return 0;
+}
+
+// Read the file-backed bytes of the page at va into mem.
+static int fill_from_file(struct vma *v, uint64 va, char *mem)
+{
+    uint64 end = MIN(va + PGSIZE, v->start + v->filesz);
+    if (va >= end)
+        return 0;
+    // readi() goes through the page cache
+    if (readi(v->ip, FALSE, mem, v->off + (va - v->start), end - va) != end - va)
+        return -1;
+    return 0;
+}
+
+// Give the reserved page at va of v behind pte its memory,
+// read back from swap if it was swapped out.
+static int uvm_populate(struct proc *p, struct vma *v, uint64 va, pte_t *pte)
+{
+    char *mem;
+    uint64 slot = PTE_SWAP_SLOT(*pte);
+    if (slot != 0)
+    {
+        if ((mem = alloc_physical_page()) == 0)
+            return -1;
+        if (swap_in(p, slot, mem) != 0)
+        {
+            put_physical_page(mem);
+            return -1;
+        }
+        *pte = PA2PTE(mem) | (PTE_FLAGS(*pte) & ~PTE_LAZY) | PTE_V | PTE_A | PTE_D;
+        return 0;
+    }
+    if ((mem = alloc_zeroed_page()) == 0)
+        return -1;
+    if (v->ip != NULL && fill_from_file(v, va, mem) != 0)
+    {
+        recycle_physical_page(mem);
+        return -1;
     }
+    *pte = PA2PTE(mem) | (PTE_FLAGS(*pte) & ~PTE_LAZY) | PTE_V | PTE_A | PTE_D;
+    return 0;
+}
+
+// Point pte, reserved or mapping a page already dropped by the caller,
+// at the zero page. A writable page becomes copy-on-write.
+static void map_zero_page(struct proc *p, pte_t *pte)
+{
+    uint64 flags = PTE_FLAGS(*pte) & (PTE_R | PTE_W | PTE_X | PTE_U);
+    if (*pte & PTE_COW)
+        flags |= PTE_W;
+    if (flags & PTE_W)
+        flags = (flags & ~PTE_W) | PTE_COW;
+    dup_physical_page(zero_page);
+    *pte = PA2PTE(zero_page) | flags | PTE_V | PTE_A;
+    p->zero_maps++;
+}
+
+/**
+ * @brief Make the page at va of p read as zeros by mapping the zero page
+ * over it, what was there is dropped. For reads from /dev/zero.
+ *
+ * @return int 0 on success, -1 if va is not a writable private page
+ */
+int uvm_map_zero_page(struct proc *p, uint64 va)
+{
+    struct vma *v = vma_find(&p->vmas, va);
+    if (va % PGSIZE != 0 || v == NULL || (v->flags & (MAP_SHARED | MAP_HUGETLB)) || !(v->prot & PROT_WRITE))
+        return -1;
+    pte_t *pte = walk(p->pagetable, va, FALSE);
+    if (pte == NULL || (*pte & PTE_U) == 0 || (*pte & (PTE_V | PTE_LAZY)) == 0)
+        return -1;
+    pte_t old = *pte;
+    if ((old & (PTE_W | PTE_COW)) == 0)
+        return -1;
+    map_zero_page(p, pte);
+    if (old & PTE_V)
+        put_physical_page((void *)PTE2PA(old));
+    else if (PTE_SWAP_SLOT(old) != 0)
+        swap_free(PTE_SWAP_SLOT(old));
+    flush_tlb_user_range(p->pagetable, va, 1);
     return 0;
 }
 
+// Read in the untouched file-backed neighbours of va as well,
+// programs tend to run through their text sequentially.
+// With MADV_SEQUENTIAL the pages after them are read ahead too.
+static void fault_around(struct proc *p, struct vma *v, uint64 va)
+{
+    uint64 start = MAX(ROUNDDOWN(va, FAULT_AROUND_PAGES * PGSIZE), v->start);
+    uint64 file_end = PGROUNDUP(v->start + v->filesz);
+    uint64 end = MIN(start + FAULT_AROUND_PAGES * PGSIZE, file_end);
+    if (v->advice == MADV_SEQUENTIAL && end < file_end)
+        ctable_readahead_async(v->ip, v->off + (end - v->start), MIN(READAHEAD_PAGES, (file_end - end) / PGSIZE));
+    for (uint64 a = start; a < end; a += PGSIZE)
+    {
+        pte_t *pte = walk(p->pagetable, a, FALSE);
+        if (pte && (*pte & (PTE_V | PTE_LAZY)) == PTE_LAZY && PTE_SWAP_SLOT(*pte) == 0)
+        {
+            if (uvm_populate(p, v, a, pte) != 0)
+                return;
+        }
+    }
+}
+
+/**
+ * @brief Handle a user page fault at va
+ * Fills a reserved page with zeros or from its file,
+ * or copies a COW page on write.
+ *
+ * @param write whether the faulting access was a store
+ * @return 0 if the access can be retried, -1 if it is a real fault
+ */
+int uvm_fault(struct proc *p, uint64 va, int write)
+{
+    pte_t *pte;
+
+    if (va >= MAXVA)
+        return -1;
+    va = PGROUNDDOWN(va);
+    pte = walk(p->pagetable, va, FALSE);
+    if (pte == 0)
+        return -1;
+    if ((*pte & PTE_V) == 0)
+    {
+        if ((*pte & (PTE_LAZY | PTE_U)) != (PTE_LAZY | PTE_U))
+            return -1;
+        struct vma *v = vma_find(&p->vmas, va);
+        if (v == NULL)
+            return -1;
+        int swapped = PTE_SWAP_SLOT(*pte) != 0;
+        // reading an untouched private page of zeros needs no frame
+        if (!write && !swapped && !(v->flags & MAP_SHARED) && va >= v->start + v->filesz)
+        {
+            map_zero_page(p, pte);
+            flush_tlb_user_range(p->pagetable, va, 1);
+            return 0;
+        }
+        if (uvm_populate(p, v, va, pte) != 0)
+            return -1;
+        if (v->ip != NULL && !swapped && v->advice != MADV_RANDOM)
+            fault_around(p, v, va);
+        // the hart may have cached the invalid entries
+        flush_tlb_user_range(p->pagetable, ROUNDDOWN(va, FAULT_AROUND_PAGES * PGSIZE), FAULT_AROUND_PAGES);
+        return 0;
+    }
+    if (write && (*pte & PTE_COW))
+        return uvm_cow_fault(p->pagetable, va);
+    // hardware that does not update the A and D bits faults instead,
+    // D tells which shared file pages were written
+    if ((*pte & PTE_A) == 0 || (write && (*pte & PTE_W) && (*pte & PTE_D) == 0))
+    {
+        *pte |= PTE_A | (write ? PTE_D : 0);
+        flush_tlb_user_range(p->pagetable, va, 1);
+        return 0;
+    }
+    return -1;
+}
+
+// Kernel address of user va for a copy, 0 if va is not user memory.
+// A reserved page is faulted in first and, for a write, a copy-on-write
+// page is copied. *span is set to the number of bytes from va to the end
+// of its leaf mapping, which all translate linearly, so a copy only walks
+// the page table once per page or superpage.
+static uint64 user_addr(pagetable_t pagetable, uint64 va, int write, uint64 *span) {
+    pte_t *pte;
+    int level;
+    if (va >= MAXVA)
+        return 0;
+    pte = walk_level(pagetable, va, FALSE, &level);
+    if (pte == 0)
+        return 0;
+    // a fault may sleep, look again at what it left
+    for (;;) {
+        if ((*pte & PTE_V) == 0) {
+            struct proc *p = curr_proc();
+            if (p == NULL || p->pagetable != pagetable || uvm_fault(p, va, write) != 0)
+                return 0;
+        } else if (write && (*pte & PTE_COW)) {
+            if (uvm_cow_fault(pagetable, va) < 0)
+                return 0;
+        } else {
+            break;
+        }
+    }
+    if ((*pte & PTE_U) == 0)
+        return 0;
+    // a read-only page may be the zero page or shared with another process
+    if (write && (*pte & (PTE_W | PTE_COW)) == 0)
+        return 0;
+    // as the hardware would, the swapper must see the page is in use
+    *pte |= PTE_A | (write ? PTE_D : 0);
+    uint64 offset = va & (LEVEL_SIZE(level) - 1);
+    *span = LEVEL_SIZE(level) - offset;
+    return PTE2PA(*pte) + offset;
+}
+
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
 int copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len) {
-    uint64 n, va0, pa0;
+    uint64 n, pa;
 
     while (len > 0) {
-        va0 = PGROUNDDOWN(dstva);
-        pa0 = walkaddr(pagetable, va0);
-        if (pa0 == 0)
+        pa = user_addr(pagetable, dstva, TRUE, &n);
+        if (pa == 0)
             return -1;
-        n = PGSIZE - (dstva - va0);
         if (n > len)
             n = len;
-        memmove((void *)(pa0 + (dstva - va0)), src, n);
+        memmove((void *)pa, src, n);
 
         len -= n;
         src += n;
-        dstva = va0 + PGSIZE;
+        dstva += n;
     }
     return 0;
 }
 
 int uvmemset(pagetable_t pagetable, uint64 dstva, char c, uint64 len) {
-    uint64 n, va0, pa0;
+    uint64 n, pa;
 
     while (len > 0) {
-        va0 = PGROUNDDOWN(dstva);
-        pa0 = walkaddr(pagetable, va0);
-        if (pa0 == 0)
+        pa = user_addr(pagetable, dstva, TRUE, &n);
+        if (pa == 0)
             return -1;
-        n = PGSIZE - (dstva - va0);
         if (n > len)
             n = len;
-        memset((void *)(pa0 + (dstva - va0)), c, n);
+        memset((void *)pa, c, n);
 
         len -= n;
-        dstva = va0 + PGSIZE;
+        dstva += n;
     }
     return 0;
 }
@@ -545,21 +945,19 @@ int uvmemset(pagetable_t pagetable, uint64 dstva, char c, uint64 len) {
 // Copy len bytes to dst from virtual address srcva in a given page table.
 // Return 0 on success, -1 on error.
 int copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len) {
-    uint64 n, va0, pa0;
+    uint64 n, pa;
 
     while (len > 0) {
-        va0 = PGROUNDDOWN(srcva);
-        pa0 = walkaddr(pagetable, va0);
-        if (pa0 == 0)
+        pa = user_addr(pagetable, srcva, FALSE, &n);
+        if (pa == 0)
             return -1;
-        n = PGSIZE - (srcva - va0);
         if (n > len)
             n = len;
-        memmove(dst, (void *)(pa0 + (srcva - va0)), n);
+        memmove(dst, (void *)pa, n);
 
         len -= n;
         dst += n;
-        srcva = va0 + PGSIZE;
+        srcva += n;
     }
     return 0;
 }
@@ -569,21 +967,20 @@ int copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len) {
 // until a '\0', or max.
 // Return 0 on success, -1 on error.
 int copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max) {
-    uint64 n, va0, pa0;
+    uint64 n, pa;
     int got_null = 0;
 
     while (got_null == 0 && max > 0) {
-        va0 = PGROUNDDOWN(srcva);
-        pa0 = walkaddr(pagetable, va0);
-        if (pa0 == 0){
+        pa = user_addr(pagetable, srcva, FALSE, &n);
+        if (pa == 0){
             debugcore("bad addr");
             return -1;
         }
-        n = PGSIZE - (srcva - va0);
         if (n > max)
             n = max;
+        srcva += n;
 
-        char *p = (char *)(pa0 + (srcva - va0));
+        char *p = (char *)pa;
         while (n > 0) {
             if (*p == '\0') {
                 *dst = '\0';
@@ -597,8 +994,6 @@ int copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max) {
             p++;
             dst++;
         }
-
-        srcva = va0 + PGSIZE;
     }
     if (got_null) {
         return 0;
@@ -0,0 +1,420 @@
+#include <mem/slab.h>
+#include <mem/vma.h>
+#include <proc/proc.h>
+#include <ucore/defs.h>
+#include <utils/assert.h>
+#include <utils/log.h>
+
+static struct kmem_cache *vma_cachep;
+
+/**
+ * @brief Init the VMA allocator.
+ * Must be called after slab_init().
+ */
+void vma_init() {
+    vma_cachep = kmem_cache_create("vma", sizeof(struct vma));
+    KERNEL_ASSERT(vma_cachep != NULL, "vma_init: can not create vma cache");
+}
+
+void vma_tree_init(struct vma_tree *t) {
+    t->root = NULL;
+    t->count = 0;
+}
+
+static int height(struct vma *v) {
+    return v ? v->height : 0;
+}
+
+static uint64 max_gap(struct vma *v) {
+    return v ? v->max_gap : 0;
+}
+
+// recompute the augmented fields of v from its children
+static void update(struct vma *v) {
+    v->height = 1 + MAX(height(v->left), height(v->right));
+    v->max_gap = MAX(v->gap, MAX(max_gap(v->left), max_gap(v->right)));
+}
+
+static void replace_child(struct vma_tree *t, struct vma *parent, struct vma *old, struct vma *new) {
+    if (parent == NULL)
+        t->root = new;
+    else if (parent->left == old)
+        parent->left = new;
+    else
+        parent->right = new;
+    if (new)
+        new->parent = parent;
+}
+
+static struct vma *rotate_left(struct vma_tree *t, struct vma *x) {
+    struct vma *y = x->right;
+    x->right = y->left;
+    if (y->left)
+        y->left->parent = x;
+    replace_child(t, x->parent, x, y);
+    y->left = x;
+    x->parent = y;
+    update(x);
+    update(y);
+    return y;
+}
+
+static struct vma *rotate_right(struct vma_tree *t, struct vma *x) {
+    struct vma *y = x->left;
+    x->left = y->right;
+    if (y->right)
+        y->right->parent = x;
+    replace_child(t, x->parent, x, y);
+    y->right = x;
+    x->parent = y;
+    update(x);
+    update(y);
+    return y;
+}
+
+// Walk from v up to the root, restoring the AVL balance
+// and the augmented fields on the way.
+static void rebalance(struct vma_tree *t, struct vma *v) {
+    while (v) {
+        update(v);
+        int balance = height(v->left) - height(v->right);
+        if (balance > 1) {
+            if (height(v->left->left) < height(v->left->right))
+                rotate_left(t, v->left);
+            v = rotate_right(t, v);
+        } else if (balance < -1) {
+            if (height(v->right->right) < height(v->right->left))
+                rotate_right(t, v->right);
+            v = rotate_left(t, v);
+        }
+        v = v->parent;
+    }
+}
+
+// gap of v changed, fix max_gap up to the root
+static void propagate(struct vma *v) {
+    for (; v; v = v->parent)
+        update(v);
+}
+
+static struct vma *vma_prev(struct vma *v) {
+    if (v->left) {
+        v = v->left;
+        while (v->right)
+            v = v->right;
+        return v;
+    }
+    while (v->parent && v->parent->left == v)
+        v = v->parent;
+    return v->parent;
+}
+
+struct vma *vma_next(struct vma *v) {
+    if (v->right) {
+        v = v->right;
+        while (v->left)
+            v = v->left;
+        return v;
+    }
+    while (v->parent && v->parent->right == v)
+        v = v->parent;
+    return v->parent;
+}
+
+struct vma *vma_first(struct vma_tree *t) {
+    struct vma *v = t->root;
+    if (v == NULL)
+        return NULL;
+    while (v->left)
+        v = v->left;
+    return v;
+}
+
+static struct vma *vma_last(struct vma_tree *t) {
+    struct vma *v = t->root;
+    if (v == NULL)
+        return NULL;
+    while (v->right)
+        v = v->right;
+    return v;
+}
+
+static void set_gap(struct vma *v) {
+    struct vma *prev = vma_prev(v);
+    v->gap = v->start - (prev ? prev->end : 0);
+}
+
+/**
+ * @brief Find the VMA containing addr
+ *
+ * @return struct vma* the VMA, or NULL if addr is not mapped
+ */
+struct vma *vma_find(struct vma_tree *t, uint64 addr) {
+    struct vma *v = t->root;
+    while (v) {
+        if (addr < v->start)
+            v = v->left;
+        else if (addr >= v->end)
+            v = v->right;
+        else
+            return v;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Find the lowest VMA that ends above addr
+ *
+ * @return struct vma* the VMA, which may contain addr, or NULL if none
+ */
+struct vma *vma_find_next(struct vma_tree *t, uint64 addr) {
+    struct vma *v = t->root, *best = NULL;
+    while (v) {
+        if (v->end > addr) {
+            best = v;
+            if (v->start <= addr)
+                break;
+            v = v->left;
+        } else {
+            v = v->right;
+        }
+    }
+    return best;
+}
+
+bool vma_range_free(struct vma_tree *t, uint64 start, uint64 end) {
+    struct vma *v = vma_find_next(t, start);
+    return v == NULL || v->start >= end;
+}
+
+// link a new node into the tree, [v->start, v->end) must be free
+static void insert(struct vma_tree *t, struct vma *v) {
+    struct vma *parent = NULL, **link = &t->root;
+    while (*link) {
+        parent = *link;
+        link = v->start < parent->start ? &parent->left : &parent->right;
+    }
+    v->left = v->right = NULL;
+    v->parent = parent;
+    v->height = 1;
+    *link = v;
+    t->count++;
+
+    set_gap(v);
+    v->max_gap = v->gap;
+    struct vma *next = vma_next(v);
+    if (next) {
+        next->gap = next->start - v->end;
+        propagate(next);
+    }
+    rebalance(t, v);
+}
+
+/**
+ * @brief Add [start, end) to the address space, the range must be free
+ *
+ * @param ip backing file, a reference is taken, NULL if anonymous
+ * @return struct vma* the new VMA, or NULL if out of memory
+ */
+struct vma *vma_map(struct vma_tree *t, uint64 start, uint64 end, int prot, int flags,
+                    enum vma_type type, struct inode *ip, uint64 off, uint64 filesz) {
+    KERNEL_ASSERT(start < end && start % PGSIZE == 0 && end % PGSIZE == 0, "vma_map: bad range");
+    KERNEL_ASSERT(vma_range_free(t, start, end), "vma_map: overlap");
+    struct vma *v = kmem_cache_alloc(vma_cachep);
+    if (v == NULL)
+        return NULL;
+    v->start = start;
+    v->end = end;
+    v->prot = prot;
+    v->flags = flags;
+    v->type = type;
+    v->ip = ip ? idup(ip) : NULL;
+    v->off = off;
+    v->filesz = filesz;
+    v->advice = MADV_NORMAL;
+    insert(t, v);
+    return v;
+}
+
+/**
+ * @brief Remove v from the address space and free it
+ * The pages of v must be unmapped by the caller.
+ */
+void vma_erase(struct vma_tree *t, struct vma *v) {
+    struct vma *prev = vma_prev(v);
+    struct vma *next = vma_next(v);
+    struct vma *fix;
+
+    if (v->left && v->right) {
+        // next is the leftmost node of the right subtree, it takes v's place
+        if (next->parent != v) {
+            fix = next->parent;
+            fix->left = next->right;
+            if (next->right)
+                next->right->parent = fix;
+            next->right = v->right;
+            v->right->parent = next;
+        } else {
+            fix = next;
+        }
+        next->left = v->left;
+        v->left->parent = next;
+        replace_child(t, v->parent, v, next);
+    } else {
+        fix = v->parent;
+        replace_child(t, v->parent, v, v->left ? v->left : v->right);
+    }
+    t->count--;
+
+    if (next) {
+        next->gap = next->start - (prev ? prev->end : 0);
+        propagate(next);
+    }
+    rebalance(t, fix);
+
+    if (v->ip)
+        iput(v->ip);
+    kmem_cache_free(vma_cachep, v);
+}
+
+/**
+ * @brief Move the end of v, used by brk
+ * When growing, [v->end, end) must be free.
+ */
+void vma_resize(struct vma_tree *t, struct vma *v, uint64 end) {
+    KERNEL_ASSERT(end > v->start && end % PGSIZE == 0, "vma_resize: bad end");
+    KERNEL_ASSERT(end <= v->end || vma_range_free(t, v->end, end), "vma_resize: overlap");
+    v->end = end;
+    struct vma *next = vma_next(v);
+    if (next) {
+        next->gap = next->start - end;
+        propagate(next);
+    }
+}
+
+// Cut v at addr, v keeps the lower part. Returns the upper part.
+static struct vma *split(struct vma_tree *t, struct vma *v, uint64 addr) {
+    struct vma *upper = kmem_cache_alloc(vma_cachep);
+    if (upper == NULL)
+        return NULL;
+    uint64 delta = addr - v->start;
+    upper->start = addr;
+    upper->end = v->end;
+    upper->prot = v->prot;
+    upper->flags = v->flags;
+    upper->type = v->type;
+    upper->ip = v->ip ? idup(v->ip) : NULL;
+    upper->off = v->off + delta;
+    upper->filesz = v->filesz > delta ? v->filesz - delta : 0;
+    upper->advice = v->advice;
+    v->end = addr;
+    v->filesz = MIN(v->filesz, delta);
+    // the gap before upper is 0 and the one after it stays the same
+    insert(t, upper);
+    return upper;
+}
+
+/**
+ * @brief Split v so that a VMA covers exactly v ∩ [start, end)
+ *
+ * @return struct vma* that VMA, or NULL if out of memory
+ */
+struct vma *vma_isolate(struct vma_tree *t, struct vma *v, uint64 start, uint64 end) {
+    KERNEL_ASSERT(start < v->end && end > v->start, "vma_isolate: no overlap");
+    if (start > v->start) {
+        if ((v = split(t, v, start)) == NULL)
+            return NULL;
+    }
+    if (end < v->end) {
+        if (split(t, v, end) == NULL)
+            return NULL;
+    }
+    return v;
+}
+
+// Highest free range of len bytes in the subtree of v, within [low, high).
+// 0 if there is none, no VMA starts at 0.
+static uint64 topdown(struct vma *v, uint64 len, uint64 low, uint64 high) {
+    if (v == NULL || v->max_gap < len)
+        return 0;
+    uint64 addr;
+    // gaps in the right subtree lie above v->end
+    if (v->end < high && (addr = topdown(v->right, len, low, high)) != 0)
+        return addr;
+    uint64 gap_start = MAX(v->start - v->gap, low);
+    uint64 gap_end = MIN(v->start, high);
+    if (gap_end > gap_start && gap_end - gap_start >= len)
+        return gap_end - len;
+    // gaps in the left subtree lie below v's gap
+    if (v->start - v->gap > low)
+        return topdown(v->left, len, low, high);
+    return 0;
+}
+
+// Lowest free range of len bytes in the subtree of v, within [low, high).
+static uint64 bottomup(struct vma *v, uint64 len, uint64 low, uint64 high) {
+    if (v == NULL || v->max_gap < len)
+        return 0;
+    uint64 addr;
+    if (v->start - v->gap > low && (addr = bottomup(v->left, len, low, high)) != 0)
+        return addr;
+    uint64 gap_start = MAX(v->start - v->gap, low);
+    uint64 gap_end = MIN(v->start, high);
+    if (gap_end > gap_start && gap_end - gap_start >= len)
+        return gap_start;
+    if (v->end < high)
+        return bottomup(v->right, len, low, high);
+    return 0;
+}
+
+/**
+ * @brief Find a free range of len bytes within [low, high)
+ * The lowest one at or above hint if there is one,
+ * otherwise the highest one, like mmap() without MAP_FIXED.
+ *
+ * @param hint 0 if the caller does not care
+ * @return uint64 start of the range, 0 if there is no room
+ */
+uint64 vma_unmapped_area(struct vma_tree *t, uint64 len, uint64 low, uint64 high, uint64 hint) {
+    if (len == 0 || high < low || high - low < len)
+        return 0;
+    // the space after the last VMA is not anyone's gap
+    struct vma *last = vma_last(t);
+    uint64 last_end = last ? last->end : 0;
+    uint64 tail, addr;
+
+    if (hint > low && hint < high) {
+        if ((addr = bottomup(t->root, len, hint, high)) != 0)
+            return addr;
+        tail = MAX(last_end, hint);
+        if (high > tail && high - tail >= len)
+            return tail;
+    }
+    tail = MAX(last_end, low);
+    if (high > tail && high - tail >= len)
+        return high - len;
+    return topdown(t->root, len, low, high);
+}
+
+/**
+ * @brief Copy every VMA of src into the empty tree dst, for fork
+ *
+ * @return 0 on success, -1 if out of memory, dst is left empty
+ */
+int vma_dup(struct vma_tree *dst, struct vma_tree *src) {
+    struct vma *v, *copy;
+    vma_for_each(v, src) {
+        if ((copy = vma_map(dst, v->start, v->end, v->prot, v->flags, v->type, v->ip, v->off, v->filesz)) == NULL) {
+            vma_free_all(dst);
+            return -1;
+        }
+        copy->advice = v->advice;
+    }
+    return 0;
+}
+
+// Drop every VMA, the pages must be unmapped by the caller.
+void vma_free_all(struct vma_tree *t) {
+    while (t->root)
+        vma_erase(t, t->root);
+}
@@ -0,0 +1,60 @@
+#if !defined(VMA_H)
+#define VMA_H
+
+#include <ucore/types.h>
+
+struct inode;
+
+// what a region of the user address space is used for
+enum vma_type {
+    VMA_IMAGE, // program loaded by exec
+    VMA_HEAP,  // grown and shrunk by brk
+    VMA_STACK,
+    VMA_MMAP,
+};
+
+// A page-aligned region [start, end) of a process address space.
+// The VMAs of a process form an AVL tree keyed by start, each node
+// also knows the largest hole in its subtree so that a free range
+// of any length is found in O(log n).
+struct vma {
+    uint64 start;
+    uint64 end;
+    int prot;          // PROT_*
+    int flags;         // MAP_*, MAP_SHARED pages are not copy-on-write
+    enum vma_type type;
+    struct inode *ip;  // backing file, holds a reference, NULL if anonymous
+    uint64 off;        // file offset of start
+    uint64 filesz;     // bytes from start backed by ip, the rest reads as zeros
+    int advice;        // MADV_NORMAL, MADV_RANDOM or MADV_SEQUENTIAL
+
+    struct vma *left, *right, *parent;
+    int height;
+    uint64 gap;        // free bytes between the previous vma (or 0) and start
+    uint64 max_gap;    // largest gap in this subtree
+};
+
+struct vma_tree {
+    struct vma *root;
+    uint64 count;
+};
+
+void vma_init();
+void vma_tree_init(struct vma_tree *t);
+struct vma *vma_find(struct vma_tree *t, uint64 addr);
+struct vma *vma_find_next(struct vma_tree *t, uint64 addr);
+struct vma *vma_first(struct vma_tree *t);
+struct vma *vma_next(struct vma *v);
+struct vma *vma_map(struct vma_tree *t, uint64 start, uint64 end, int prot, int flags,
+                    enum vma_type type, struct inode *ip, uint64 off, uint64 filesz);
+void vma_erase(struct vma_tree *t, struct vma *v);
+void vma_resize(struct vma_tree *t, struct vma *v, uint64 end);
+struct vma *vma_isolate(struct vma_tree *t, struct vma *v, uint64 start, uint64 end);
+bool vma_range_free(struct vma_tree *t, uint64 start, uint64 end);
+uint64 vma_unmapped_area(struct vma_tree *t, uint64 len, uint64 low, uint64 high, uint64 hint);
+int vma_dup(struct vma_tree *dst, struct vma_tree *src);
+void vma_free_all(struct vma_tree *t);
+
+#define vma_for_each(v, t) for ((v) = vma_first(t); (v) != NULL; (v) = vma_next(v))
+
+#endif // VMA_H
@@ -0,0 +1,201 @@
+#include <arch/cpu.h>
+#include <lock/lock.h>
+#include <mem/physical.h>
+#include <mem/zram.h>
+#include <ucore/defs.h>
+#include <utils/assert.h>
+#include <utils/log.h>
+#include <utils/lz4.h>
+
+// A used slot holds size bytes of compressed data, or with size 0 the
+// word its page repeats. A free slot links to the next free one.
+struct zram_slot {
+    union {
+        void *data;
+        uint64 fill;
+        uint64 next_free;
+    };
+    uint32 size;
+    uint32 refcount; // page table entries referring to the slot
+};
+
+// compression scratch space, used with interrupts off
+struct zram_scratch {
+    lz4_table_t table;
+};
+
+static struct {
+    struct spinlock lock;
+    struct zram_slot *slots; // slot 0 is never used, 0 means no slot
+    uint64 nr_slots;
+    uint64 free_list;
+    uint64 nr_free;
+    uint64 max_used;         // bytes compressed data may take
+    struct zram_stat stat;
+} zram;
+
+static struct zram_scratch scratch[NCPU];
+
+void zram_init() {
+    init_spin_lock_with_name(&zram.lock, "zram.lock");
+    uint64 ram = get_free_page_count();
+    uint64 nr_slots = ram / ZRAM_SLOT_RATIO;
+    // the slot table is one buddy block
+    int order = 0;
+    while ((PGSIZE << order) < nr_slots * sizeof(struct zram_slot) && order < BUDDY_MAX_ORDER)
+        order++;
+    nr_slots = MIN(nr_slots, (PGSIZE << order) / sizeof(struct zram_slot));
+    zram.slots = alloc_physical_pages(order);
+    KERNEL_ASSERT(zram.slots != NULL, "zram_init: can not allocate slot table");
+    zram.nr_slots = nr_slots;
+    zram.free_list = 0;
+    zram.nr_free = 0;
+    for (uint64 i = nr_slots - 1; i > 0; i--) {
+        zram.slots[i].next_free = zram.free_list;
+        zram.slots[i].refcount = 0;
+        zram.free_list = i;
+        zram.nr_free++;
+    }
+    zram.max_used = ram * PGSIZE / ZRAM_RAM_RATIO;
+    memset(&zram.stat, 0, sizeof(zram.stat));
+    infof("zram: %d slots, up to %d KiB compressed", zram.nr_free, zram.max_used / 1024);
+}
+
+// what kmalloc() really hands out for size bytes
+static uint64 kmalloc_size(uint64 size) {
+    uint64 n = 1UL << KMALLOC_MIN_SHIFT;
+    while (n < size)
+        n <<= 1;
+    return n;
+}
+
+// whether the page at pa is one 8-byte word repeated
+static int same_filled(void *pa, uint64 *word) {
+    uint64 *p = pa;
+    for (int i = 1; i < PGSIZE / sizeof(uint64); i++) {
+        if (p[i] != p[0])
+            return FALSE;
+    }
+    *word = p[0];
+    return TRUE;
+}
+
+/**
+ * @brief Store a compressed copy of the page at pa
+ * The copy is kmalloc()ed with interrupts on, so a new slab page for it
+ * may be reclaimed, see kmem_cache_alloc(). Must not be called with
+ * spinlocks held: reclaim could not run, and the store fails once
+ * memory is short.
+ *
+ * @return uint64 its slot with one reference, 0 if the page does not
+ * compress well enough or there is no room
+ */
+uint64 zram_store(void *pa) {
+    uint64 word = 0;
+    void *data = NULL;
+    int size = 0;
+
+    if (!same_filled(pa, &word)) {
+        uchar buf[ZRAM_MAX_COMPRESSED];
+        push_off();
+        size = lz4_compress(pa, PGSIZE, buf, ZRAM_MAX_COMPRESSED, scratch[cpuid()].table);
+        pop_off();
+        if (size > 0 && (data = kmalloc(size)) != NULL)
+            memmove(data, buf, size);
+        if (data == NULL) {
+            if (size == 0)
+                __atomic_fetch_add(&zram.stat.rejected, 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+    }
+
+    acquire(&zram.lock);
+    if (zram.nr_free == 0 || zram.stat.used + kmalloc_size(size) > zram.max_used) {
+        release(&zram.lock);
+        kfree(data);
+        return 0;
+    }
+    uint64 slot = zram.free_list;
+    struct zram_slot *z = &zram.slots[slot];
+    zram.free_list = z->next_free;
+    zram.nr_free--;
+    z->size = size;
+    z->refcount = 1;
+    if (size == 0) {
+        z->fill = word;
+        zram.stat.same_filled++;
+    } else {
+        z->data = data;
+        zram.stat.compressed += size;
+        zram.stat.used += kmalloc_size(size);
+    }
+    zram.stat.stored++;
+    release(&zram.lock);
+    return slot;
+}
+
+/**
+ * @brief Decompress the page in slot into pa, the slot stays
+ *
+ * @return int 0 on success, -1 if the data is corrupt
+ */
+int zram_load(uint64 slot, void *pa) {
+    KERNEL_ASSERT(slot > 0 && slot < zram.nr_slots, "zram_load: bad slot");
+    // the caller's reference keeps the slot alive
+    struct zram_slot *z = &zram.slots[slot];
+    KERNEL_ASSERT(z->refcount > 0, "zram_load: slot is free");
+    if (z->size == 0) {
+        uint64 *p = pa;
+        for (int i = 0; i < PGSIZE / sizeof(uint64); i++)
+            p[i] = z->fill;
+        return 0;
+    }
+    if (lz4_decompress(z->data, z->size, pa, PGSIZE) != PGSIZE) {
+        errorf("zram_load: slot %d is corrupt", slot);
+        return -1;
+    }
+    return 0;
+}
+
+void zram_dup(uint64 slot) {
+    KERNEL_ASSERT(slot > 0 && slot < zram.nr_slots, "zram_dup: bad slot");
+    acquire(&zram.lock);
+    KERNEL_ASSERT(zram.slots[slot].refcount > 0, "zram_dup: slot is free");
+    zram.slots[slot].refcount++;
+    release(&zram.lock);
+}
+
+// Drop a reference to slot, the last one frees it.
+void zram_free(uint64 slot) {
+    KERNEL_ASSERT(slot > 0 && slot < zram.nr_slots, "zram_free: bad slot");
+    void *data = NULL;
+    acquire(&zram.lock);
+    struct zram_slot *z = &zram.slots[slot];
+    KERNEL_ASSERT(z->refcount > 0, "zram_free: slot is free");
+    if (--z->refcount == 0) {
+        if (z->size == 0) {
+            zram.stat.same_filled--;
+        } else {
+            data = z->data;
+            zram.stat.compressed -= z->size;
+            zram.stat.used -= kmalloc_size(z->size);
+        }
+        zram.stat.stored--;
+        z->next_free = zram.free_list;
+        zram.free_list = slot;
+        zram.nr_free++;
+    }
+    release(&zram.lock);
+    kfree(data);
+}
+
+uint64 zram_free_slots() {
+    return zram.nr_free;
+}
+
+void get_zram_stat(struct zram_stat *stat) {
+    acquire(&zram.lock);
+    *stat = zram.stat;
+    stat->rejected = __atomic_load_n(&zram.stat.rejected, __ATOMIC_RELAXED);
+    release(&zram.lock);
+}
@@ -0,0 +1,30 @@
+#if !defined(ZRAM_H)
+#define ZRAM_H
+
+#include <ucore/types.h>
+#include <mem/slab.h>
+
+// Compressed in-memory store for swapped out pages, see swap.c.
+// A page is kept LZ4 compressed in kmalloc() memory, a page that
+// repeats one 8-byte word (most often zeros) needs no memory at all.
+#define ZRAM_SLOT_RATIO 2    // a slot for every 2 pages of RAM
+#define ZRAM_RAM_RATIO 4     // compressed data takes at most 1/4 of RAM
+#define ZRAM_MAX_COMPRESSED KMALLOC_MAX_SIZE // pages that compress worse stay in RAM
+
+struct zram_stat {
+    uint64 stored;      // pages held
+    uint64 same_filled; // of those, pages repeating one word
+    uint64 compressed;  // bytes of compressed data
+    uint64 used;        // bytes of memory holding it, with kmalloc rounding
+    uint64 rejected;    // pages that did not compress well enough
+};
+
+void zram_init();
+uint64 zram_store(void *pa);
+int zram_load(uint64 slot, void *pa);
+void zram_dup(uint64 slot);
+void zram_free(uint64 slot);
+uint64 zram_free_slots();
+void get_zram_stat(struct zram_stat *stat);
+
+#endif // ZRAM_H
@@ -83,7 +83,7 @@ load_success:
     // sp itself is on the boundary hence not mapped, but sp-1 is a valid address.
     // we can calculate the physical address of sp
     // but can NOT access sp_pa
-    char *sp_pa = (char *)(virt_addr_to_physical(p->pagetable, (uint64)sp - 1) + 1);
+    char *sp_pa = (char *)(virt_addr_to_physical(p->pagetable, (uint64)sp - 1, TRUE) + 1);
 
     char *sp_pa_bottom = sp_pa; // keep a record
 
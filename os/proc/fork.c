@@ -1,6 +1,29 @@
 #include <proc/proc.h>
 #include <trap/trap.h>
 #include <mem/shared.h>
+
+// Share every VMA of p with np, copy-on-write unless MAP_SHARED.
+static int dup_address_space(struct proc *p, struct proc *np) {
+    struct vma *v, *failed = NULL;
+    if (vma_dup(&np->vmas, &p->vmas) < 0) {
+        return -1;
+    }
+    vma_for_each(v, &p->vmas) {
+        if (uvmmap_dup(p->pagetable, np->pagetable, v->start, (v->end - v->start) / PGSIZE, !!(v->flags & MAP_SHARED)) < 0) {
+            failed = v;
+            break;
+        }
+    }
+    if (failed == NULL) {
+        return 0;
+    }
+    for (v = vma_first(&p->vmas); v != failed; v = vma_next(v)) {
+        uvmunmap(np->pagetable, v->start, (v->end - v->start) / PGSIZE, TRUE);
+    }
+    vma_free_all(&np->vmas);
+    return -1;
+}
+
 /**
  * @brief fork current process
  * 
@@ -19,7 +42,7 @@ int clone(void* stack) {
 
     infof("clone: stage1");
     // Copy user memory from parent to child.
-    if (uvmcopy(p->pagetable, np->pagetable, p->total_size) < 0) {
+    if (dup_address_space(p, np) < 0) {
         freeproc(np);
         release(&np->lock);
         return -1;
@@ -28,6 +51,9 @@ int clone(void* stack) {
     np->heap_start = p->heap_start;
     np->heap_sz = p->heap_sz;
     np->stride  = p->stride;
+    np->cpu_mask = p->cpu_mask;
+    np->policy = p->policy;
+    np->rt_priority = p->rt_priority;
     // copy saved user registers.
     *(np->trapframe) = *(p->trapframe);
 
@@ -56,19 +82,6 @@ int clone(void* stack) {
         np->shmem_map_start[i] = p->shmem_map_start[i] ;
     }
 
-    infof("clone: stage5");
-    // dup mapping
-    for (int i = 0; i < MAX_MAPPING; i++)
-    {
-        if (p->maps[i].va == NULL) {
-            break;
-        }
-        uvmmap_dup(p->pagetable, np->pagetable, p->maps[i].va, p->maps[i].npages, p->maps[i].shared);
-        np->maps[i].va = p->maps[i].va;
-        np->maps[i].npages = p->maps[i].npages;
-        np->maps[i].shared = p->maps[i].shared;
-    }
-
     np->next_shmem_addr = p->next_shmem_addr;
 
     safestrcpy(np->name, p->name, sizeof(p->name));
@@ -84,7 +97,7 @@ int clone(void* stack) {
 
     infof("clone: stage7");
     acquire(&np->lock);
-    np->state = RUNNABLE;
+    make_runnable(np);
     release(&np->lock);
 
     infof("clone: stage8");
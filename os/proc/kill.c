@@ -26,7 +26,9 @@ found:
     // kill the process
     p->killed = 1;
     if (p->state == SLEEPING) {
-        p->state = RUNNABLE;
+        make_runnable(p);
+    } else if (p->state == RUNNING) {
+        kick_proc(p);
     }
     release(&p->lock);
     return 0;
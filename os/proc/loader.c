@@ -143,14 +143,14 @@ int get_app_id_by_name(char *name)
 
 void alloc_ustack(struct proc *p)
 {
-    for (uint64 va = USER_STACK_BOTTOM - USTACK_SIZE; va < USER_STACK_BOTTOM; va += PGSIZE) {
-        void *pa = alloc_physical_page();
-        if (!pa) {
-            panic("alloc_ustack::alloc_physical_page failed");
-        }
-        if (mappages(p->pagetable, va, PGSIZE, (uint64)pa, PTE_U | PTE_R | PTE_W | PTE_X) != 0) {
-            panic("alloc_ustack::mappages failed");
-        }
+    // only pages the process touches get memory
+    if (uvmreserve(p->pagetable, USER_STACK_BOTTOM - USTACK_SIZE, USER_STACK_BOTTOM,
+                   PTE_U | PTE_R | PTE_W | PTE_X) == 0) {
+        panic("alloc_ustack::uvmreserve failed");
+    }
+    if (vma_map(&p->vmas, USER_STACK_BOTTOM - USTACK_SIZE, USER_STACK_BOTTOM, PROT_READ | PROT_WRITE | PROT_EXEC,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, VMA_STACK, NULL, 0, 0) == NULL) {
+        panic("alloc_ustack::vma_map failed");
     }
     p->ustack_bottom = USER_STACK_BOTTOM;
     p->trapframe->sp = p->ustack_bottom;
@@ -171,6 +171,9 @@ void bin_loader(uint64 start, uint64 end, struct proc *p)
         if (mappages(p->pagetable, va, PGSIZE, (uint64)page, PTE_U | PTE_R | PTE_W | PTE_X) != 0)
             panic("bin_loader mappages");
     }
+    if (vma_map(&p->vmas, USER_TEXT_START, USER_TEXT_START + length, PROT_READ | PROT_WRITE | PROT_EXEC,
+                MAP_PRIVATE | MAP_ANONYMOUS, VMA_IMAGE, NULL, 0, 0) == NULL)
+        panic("bin_loader vma_map");
 
     p->trapframe->epc = USER_TEXT_START;
     alloc_ustack(p);
@@ -230,7 +233,7 @@ loadseg(pagetable_t pagetable, uint64 va, struct inode *inode, uint offset, uint
     va_begin = va;
     va_end = MIN(PGROUNDUP(va), va_begin + sz);
     if (va_begin != va_end) {
-        pa_align = walkaddr(pagetable, va_align);
+        pa_align = walkaddr(pagetable, va_align, TRUE);
         if (pa_align == NULL) {
             panic("loadseg: address should exist");
         }
@@ -252,7 +255,7 @@ loadseg(pagetable_t pagetable, uint64 va, struct inode *inode, uint offset, uint
     va_begin = PGROUNDUP(va);
     va_end = va + sz;
     for (i = va_begin; i < va_end; i += PGSIZE) {
-        pa = walkaddr(pagetable, i);
+        pa = walkaddr(pagetable, i, TRUE);
         if (pa == NULL) {
             panic("loadseg: address should exist");
         }
@@ -312,6 +315,37 @@ loadseg(pagetable_t pagetable, uint64 va, struct inode *inode, uint offset, uint
 //    return 0;
 //}
 
+// Back [va, va + filesz) with ip at off, its pages are read in on first touch.
+// The range must be inside an anonymous VMA reserved for the image.
+// Returns -1 if the segment has to be read in now instead.
+static int mapseg(struct proc *p, uint64 va, struct inode *ip, uint64 off, uint64 filesz)
+{
+    if (va % PGSIZE != off % PGSIZE)
+        return -1;
+    struct vma *v = vma_find(&p->vmas, PGROUNDDOWN(va));
+    KERNEL_ASSERT(v != NULL, "mapseg: page not reserved");
+    if (v->ip != NULL) {
+        // the first page is shared with the previous segment, read that part now
+        uint64 n = MIN(filesz, PGROUNDUP(va) - va);
+        if (loadseg(p->pagetable, va, ip, off, n) < 0)
+            return -1;
+        va += n;
+        off += n;
+        filesz -= n;
+        if (filesz == 0)
+            return 0;
+        v = vma_find(&p->vmas, va);
+        KERNEL_ASSERT(v != NULL && v->ip == NULL, "mapseg: page not reserved");
+    }
+    uint64 start = PGROUNDDOWN(va);
+    if ((v = vma_isolate(&p->vmas, v, start, PGROUNDUP(va + filesz))) == NULL)
+        return -1;
+    v->ip = idup(ip);
+    v->off = off - (va - start);
+    v->filesz = filesz + (va - start);
+    return 0;
+}
+
 static void print_proghdr(struct proghdr *ph)
 {
     printf("type: %x\n", ph->type);
@@ -356,22 +390,30 @@ int loadelf(struct proc *p, struct inode *ip, bool is_interp, struct elfhdr
     max_va = PGROUNDUP(max_va);
     infof("elf_loader min_va: %p, max_va: %p, len: %d", min_va, max_va, max_va - min_va);
 
-    // allocate memory
+    // reserve memory, segments are paged in on demand
     uint64 map_base = 0;
+    uint64 image_end;
     if (!is_interp) {
         if (is_dyn) {
             map_base = USER_TEXT_START;
-            if (uvmalloc(p->pagetable, USER_TEXT_START, USER_TEXT_START +
-            max_va) != USER_TEXT_START + max_va) {
-                infof("elf_loader uvmalloc failed");
+            if (uvmreserve(p->pagetable, USER_TEXT_START, USER_TEXT_START +
+            max_va, PTE_W | PTE_X | PTE_R | PTE_U) != USER_TEXT_START + max_va) {
+                infof("elf_loader uvmreserve failed");
                 return -1;
             }
+            image_end = USER_TEXT_START + max_va;
         } else {
             map_base = min_va;
-            if (uvmalloc(p->pagetable, USER_TEXT_START, max_va) != max_va) {
-                infof("elf_loader uvmalloc failed");
+            if (uvmreserve(p->pagetable, USER_TEXT_START, max_va, PTE_W | PTE_X | PTE_R | PTE_U) != max_va) {
+                infof("elf_loader uvmreserve failed");
                 return -1;
             }
+            image_end = max_va;
+        }
+        if (vma_map(&p->vmas, USER_TEXT_START, image_end, PROT_READ | PROT_WRITE | PROT_EXEC,
+                    MAP_PRIVATE | MAP_ANONYMOUS, VMA_IMAGE, NULL, 0, 0) == NULL) {
+            infof("elf_loader vma_map failed");
+            return -1;
         }
 
     } else {
@@ -392,6 +434,10 @@ int loadelf(struct proc *p, struct inode *ip, bool is_interp, struct elfhdr
             continue;
         }
         uint64 loadva = phdr.vaddr + (map_base - min_va);
+        if (phdr.filesz == 0 || mapseg(p, loadva, ip, phdr.off, phdr.filesz) == 0) {
+            continue;
+        }
+        // can not be paged in, read it now
         if (loadseg(p->pagetable, loadva, ip, phdr.off, phdr.filesz) < 0) {
             infof("elf_loader loadseg failed");
             return -1;
@@ -533,6 +579,9 @@ int elf_loader(char* name, struct proc *p, struct auxv_t *auxv, int *auxc) {
     uint64 base[2];
     uint npages[2];
 
+    // loadseg() reads into user pages by physical address
+    p->swap_pin++;
+
     // load exec
     if (loadelf(p, ip, FALSE, &ehdr[0], &base[0], &npages[0]) < 0) {
         panic("elf_loader loadelf exec failed");
@@ -553,6 +602,7 @@ int elf_loader(char* name, struct proc *p, struct auxv_t *auxv, int *auxc) {
         }
         iunlockput(interp_ip);
     }
+    p->swap_pin--;
 
     iunlockput(ip);
 
@@ -614,7 +664,7 @@ int make_shell_proc()
     // cwd
 //    p->cwd = inode_by_name("/");
     p->cwd = NULL;
-    p->state = RUNNABLE;
+    make_runnable(p);
     release(&p->lock);
 
     return 0;
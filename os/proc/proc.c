@@ -1,7 +1,10 @@
 #include <arch/riscv.h>
 #include <arch/timer.h>
 #include <file/file.h>
+#include <mem/asid.h>
 #include <mem/memory_layout.h>
+#include <mem/swap.h>
+#include <mem/swapfile.h>
 #include <proc/proc.h>
 #include <trap/trap.h>
 #include <ucore/defs.h>
@@ -14,7 +17,9 @@ struct proc pool[NPROC];
 volatile struct proc *creating_proc;
 struct spinlock creating_lock;
 
-__attribute__((aligned(16))) char kstack[NPROC][KSTACK_SIZE];
+// allocated on a slot's first use and kept for its lifetime,
+// since an exiting proc still runs on its stack after freeproc()
+char *kstack[NPROC];
 // helps ensure that wakeups of wait()ing
 // parents are not lost. helps obey the
 // memory model when using p->parent.
@@ -126,15 +131,13 @@ void proc_free_mem_and_pagetable(struct proc* p) {
         }
     }
 
-    // unmap mapping pages
-    for (int i = 0; i < MAX_MAPPING; i++)
+    // unmap the whole address space
+    struct vma *v;
+    vma_for_each(v, &p->vmas)
     {
-        if (p->maps[i].va == NULL) {
-            break;
-        }
-        uvmunmap(p->pagetable, (uint64)p->maps[i].va, p->maps[i].npages, TRUE);
-        memset(&p->maps[i], 0, sizeof(struct mapping));
+        uvmunmap(p->pagetable, v->start, (v->end - v->start) / PGSIZE, TRUE);
     }
+    vma_free_all(&p->vmas);
 
     // total_size sanity check, avoid memory leak
     KERNEL_ASSERT(
@@ -144,8 +147,9 @@ void proc_free_mem_and_pagetable(struct proc* p) {
             USTACK_SIZE, // stack size
             "proc_free_mem_and_pagetable: total_size sanity check failed"
     );
-    free_user_mem_and_pagetables(p->pagetable, p->total_size);
+    free_pagetable_pages(p->pagetable);
     p->pagetable = NULL;
+    p->asid = ASID_NONE; // the next page table gets a new one
     p->total_size = 0;
     p->heap_start = 0;
     p->heap_sz = 0;
@@ -170,6 +174,7 @@ void freeproc(struct proc *p) {
     KERNEL_ASSERT(p->waiting_target == NULL, "p->cwd is waiting something");
     KERNEL_ASSERT(p->total_size == 0, "memory not freed");
     KERNEL_ASSERT(p->heap_sz == 0, "heap not freed");
+    KERNEL_ASSERT(p->vmas.root == NULL, "address space not freed");
 
 
     p->heap_start = 0;
@@ -184,9 +189,13 @@ void freeproc(struct proc *p) {
     memset(&p->context, 0, sizeof(p->context));
     p->stride = 0;
     p->priority = 0;
+    p->pass = 0;
     p->kernel_time = 0;
     p->user_time = 0;
     p->last_start_time = 0;
+    p->kthread = FALSE;
+    p->kthread_fn = NULL;
+    p->kthread_arg = NULL;
     for (int i = 0; i < FD_MAX; i++)
     {
         KERNEL_ASSERT(p->files[i] == NULL, "some file is not closed");
@@ -249,6 +258,8 @@ found:
     p->exit_code = -1;
     p->parent = NULL;
     p->ustack_bottom = 0;
+    p->asid = ASID_NONE;
+    p->asid_hart = -1;
     p->pagetable = proc_pagetable(p);
     if (p->pagetable == NULL) {
         errorf("failed to create user pagetable");
@@ -257,6 +268,15 @@ found:
         return NULL;
     }
     memset(&p->context, 0, sizeof(p->context));
+    if (kstack[p - pool] == NULL) {
+        kstack[p - pool] = alloc_physical_pages(KSTACK_ORDER);
+        if (kstack[p - pool] == NULL) {
+            errorf("failed to allocate kernel stack");
+            freeproc(p);
+            release(&p->lock);
+            return NULL;
+        }
+    }
     p->kstack = (uint64)kstack[p - pool];
     memset((void *)p->kstack, 0, KSTACK_SIZE);
 
@@ -264,10 +284,19 @@ found:
     p->context.sp = p->kstack + KSTACK_SIZE;
 
     p->stride = 0;
-    p->priority = 16;
+    set_priority(p, 16);
+    p->rq_next = NULL;
+    p->cpu_mask = (1UL << NCPU) - 1;
+    p->last_cpu = -1;
+    p->nr_migrations = 0;
+    p->policy = SCHED_OTHER;
+    p->rt_priority = 0;
+    p->rq_prio = 0;
+    p->rq_cpu = 0;
     p->user_time = 0;
     p->kernel_time = 0;
     p->last_start_time = 0;
+    p->kthread = FALSE;
     for (int i = 0; i < FD_MAX; i++) {
         p->files[i] = NULL;
     }
@@ -280,13 +309,12 @@ found:
     }
     p->next_shmem_addr = 0;
 
-    // clear mapping fields
-    for (int i = 0; i < MAX_MAPPING; i++)
-    {
-        p->maps[i].va = 0;
-        p->maps[i].npages = 0;
-        p->maps[i].shared = FALSE;
-    }
+    vma_tree_init(&p->vmas);
+    p->swap_cursor = 0;
+    p->swap_pin = 0;
+    p->nswap = 0;
+    p->majflt = 0;
+    p->zero_maps = 0;
 
     return p;
 }
@@ -311,12 +339,50 @@ void forkret(void) {
 //        fftest_qemu();
         ffinit();
         printf("init file system\n");
+        swapfile_init();
 //        inode_test();
     }
 
     usertrapret();
 }
 
+// A kernel thread's very first scheduling by scheduler()
+// will swtch to kthread_entry.
+static void kthread_entry(void) {
+    struct proc *p = curr_proc();
+    // Still holding p->lock from scheduler.
+    release(&p->lock);
+    intr_on();
+    p->kthread_fn(p->kthread_arg);
+    panic("kthread_entry: kernel thread returned");
+}
+
+/**
+ * @brief Create a kernel thread running fn(arg) in S mode.
+ * It is not counted as a user process, so it doesn't keep the kernel alive.
+ *
+ * @return struct proc* the thread, runnable, or NULL if failed
+ */
+struct proc *kthread_create(void (*fn)(void *), void *arg, const char *name) {
+    struct proc *p = alloc_proc();
+    if (p == NULL) {
+        return NULL;
+    }
+    p->kthread = TRUE;
+    p->kthread_fn = fn;
+    p->kthread_arg = arg;
+    p->context.ra = (uint64)kthread_entry;
+    safestrcpy(p->name, name, PROC_NAME_MAX);
+    make_runnable(p);
+    release(&p->lock);
+
+    // it never goes through forkret, so stop being the creating proc here
+    acquire(&creating_lock);
+    creating_proc = NULL;
+    release(&creating_lock);
+    return p;
+}
+
 // Switch to scheduler.  Must hold only p->lock
 // and have changed proc->state. Saves and restores
 // intena because intena is a property of this
@@ -454,7 +520,7 @@ void wakeup(void *waiting_target) {
         if (p != curr_proc() && p != creating_proc) {
             acquire(&p->lock);
             if (p->state == SLEEPING && p->waiting_target == waiting_target) {
-                p->state = RUNNABLE;
+                make_runnable(p);
             }
             release(&p->lock);
         }
@@ -555,7 +621,7 @@ bool the_only_proc_in_pool() {
     struct proc *p;
     for (p = pool; p < &pool[NPROC]; p++) {
         acquire(&p->lock);
-        if (p->state != UNUSED) {
+        if (p->state != UNUSED && !p->kthread) {
             count++;
         }
         release(&p->lock);
@@ -564,142 +630,154 @@ bool the_only_proc_in_pool() {
     return count == 1;
 }
 
-static bool is_free_range(pagetable_t pagetable, uint64 start, uint npages) {
-    uint64 va;
-    pte_t *pte;
-    for (va = start; va < start + npages * PGSIZE; va += PGSIZE) {
-        if ((pte = walk(pagetable, va, TRUE)) == 0) {
-            return FALSE;
-        }
-        if ((*pte & PTE_V) != 0) {
-            return FALSE;
-        }
+// mmap() and brk() place nothing at or above the user stack,
+// the shared memory area lies there and is not tracked by VMAs
+#define MMAP_LOW USER_TEXT_START
+#define MMAP_HIGH (USER_STACK_BOTTOM - USTACK_SIZE)
+
+static int prot_to_perm(int prot) {
+    int perm = 0;
+    if (prot & PROT_READ) {
+        perm |= PTE_R;
     }
-    return TRUE;
+    if (prot & PROT_WRITE) {
+        perm |= PTE_W;
+    }
+    if (prot & PROT_EXEC) {
+        perm |= PTE_X;
+    }
+    return perm;
 }
 
-static void *get_free_range(pagetable_t pagetable, uint npages, uint64 hint_address) {
-    infof("get_free_range: npages: %d, hint_address: %p", npages, hint_address);
-    uint64 va;
-    if (hint_address) {
-        for (va = hint_address; va <= USER_STACK_BOTTOM - USTACK_SIZE - (npages + 1) * PGSIZE; va += PGSIZE) {
-            if (is_free_range(pagetable, va, npages)) {
-                return (void *)va;
-            }
+// Remove the mmap()ed part of [start, end) from the address space.
+// Returns how many VMAs were hit, -1 if out of memory.
+static int unmap_range(struct proc *p, uint64 start, uint64 end) {
+    struct vma *v, *next;
+    int removed = 0;
+    for (v = vma_find_next(&p->vmas, start); v != NULL && v->start < end; v = next) {
+        next = vma_next(v);
+        if (v->type != VMA_MMAP) {
+            continue;
         }
-    } else {
-        for (va = USER_STACK_BOTTOM - USTACK_SIZE - npages * PGSIZE; va > USER_TEXT_START; va -= PGSIZE) {
-            if (is_free_range(pagetable, va, npages)) {
-                return (void *) va;
-            }
+        if ((v = vma_isolate(&p->vmas, v, start, end)) == NULL) {
+            return -1;
         }
+        // write back what was written through a shared file mapping
+        if ((v->flags & MAP_SHARED) && v->ip != NULL
+            && uvmsync(p->pagetable, v->start, (v->end - v->start) / PGSIZE) != 0) {
+            infof("sys_munmap: write back failed");
+        }
+        uvmunmap(p->pagetable, v->start, (v->end - v->start) / PGSIZE, TRUE);
+        vma_erase(&p->vmas, v);
+        removed++;
     }
-    return NULL;
+    return removed;
 }
 
-static int mapping_add(struct proc *p, uint64 va, uint npages, bool shared) {
-    KERNEL_ASSERT(p->maps[MAX_MAPPING - 1].va == NULL, "mapping_add: too many mappings");
+// Whether addr lies inside a 2 MiB page of a MAP_HUGETLB mapping,
+// such a page can only be unmapped or changed as a whole.
+static bool inside_huge_page(struct proc *p, uint64 addr) {
+    struct vma *v = vma_find(&p->vmas, addr);
+    return v != NULL && (v->flags & MAP_HUGETLB) && addr % HUGEPGSIZE != 0;
+}
 
-    // find a entry to insert
-    int i;
-    for (i = 0; i < MAX_MAPPING; i++) {
-        if (p->maps[i].va > va || p->maps[i].va == NULL) {
-            break;
+// Back v with 2 MiB pages right away, they are not faulted in
+// or copied on write. Returns 0 on success, -1 if out of memory.
+static int map_huge_pages(struct proc *p, struct vma *v, int perm) {
+    uint64 va;
+    for (va = v->start; va < v->end; va += HUGEPGSIZE) {
+        void *pa = alloc_physical_pages(HUGEPG_ORDER);
+        if (pa == NULL) {
+            goto err;
+        }
+        memset(pa, 0, HUGEPGSIZE);
+        if (map1hugepage(p->pagetable, va, (uint64)pa, perm) != 0) {
+            free_physical_pages(pa, HUGEPG_ORDER);
+            goto err;
         }
     }
+    return 0;
 
-    // make sure there's no overlap
-    if (p->maps[i].va && va + npages * PGSIZE > p->maps[i].va) {
-        infof("mapping_add: overlap");
-        return -1;
-    }
-
-    // move all mappings after i to the right
-    for (int j = MAX_MAPPING - 1; j > i; j--) {
-        p->maps[j] = p->maps[j - 1];
+err:
+    if (va > v->start) {
+        uvmunmap(p->pagetable, v->start, (va - v->start) / PGSIZE, TRUE);
     }
-
-    // insert the new mapping
-    p->maps[i].va = va;
-    p->maps[i].npages = npages;
-    p->maps[i].shared = shared;
-    return 0;
+    return -1;
 }
 
-static int mapping_remove_fixed(struct proc *p, uint64 va, uint npages) {
-    // find the mapping
-    int i;
-    for (i = 0; i < MAX_MAPPING; i++) {
-        if (p->maps[i].va == va && p->maps[i].npages == npages) {
-            break;
-        }
-    }
-    if (i == MAX_MAPPING) {
-        infof("mapping_remove: not found");
-        return -1;
+// Map [start, end) of v right away: zeroed pages if anonymous, else the
+// file's page cache pages if shared, copies of them if private. ip->lock
+// is held for a file. Returns 0 on success, -1 with nothing left mapped.
+static int map_pages_now(struct proc *p, struct vma *v, uint64 start, uint64 end, int page_prot) {
+    struct inode *ip = v->ip;
+    uint64 off = v->off + (start - v->start);
+    if (ip != NULL && PGROUNDUP(f_size(&ip->file)) < off + (end - start)) {
+        infof("sys_mmap: file is too small, so expand it");
+        f_lseek(&ip->file, off + (end - start));
     }
 
-    // move all mappings after i to the left
-    for (int j = i; j < MAX_MAPPING - 1; j++) {
-        p->maps[j] = p->maps[j + 1];
+    uint64 va;
+    for (va = start; va < end; va += PGSIZE) {
+        void *pa;
+        if (ip == NULL) {
+            pa = alloc_zeroed_page();
+            if (pa == NULL) {
+                infof("sys_mmap: no free physical page");
+                goto err;
+            }
+        } else {
+            struct page_cache *cache = ctable_acquire(ip, v->off + (va - v->start));
+            if (cache == NULL) {
+                infof("sys_mmap: file is too small");
+                goto err;
+            }
+            if (v->flags & MAP_SHARED) {
+                // map the page cache page itself, see uvmsync()
+                pa = cache->page;
+                dup_physical_page(cache->page);
+            } else if ((pa = alloc_physical_page()) != NULL) {
+                memmove(pa, cache->page, PGSIZE);
+            }
+            release_mutex_sleep(&cache->lock);
+            if (pa == NULL) {
+                infof("sys_mmap: no free physical page");
+                goto err;
+            }
+        }
+        if (map1page(p->pagetable, va, (uint64)pa, page_prot) < 0) {
+            infof("sys_mmap: no memory for page tables");
+            put_physical_page(pa);
+            goto err;
+        }
     }
-    memset(&p->maps[MAX_MAPPING - 1], 0, sizeof(struct mapping));
     return 0;
-}
-
-static int mapping_try_remove_page(struct proc *p, uint64 check_va) {
-    KERNEL_ASSERT(check_va % PGSIZE == 0, "mapping_get_range: check_va is not page aligned");
-    uint64 left_va, right_va;
-    uint left_npages, right_npages;
 
-    // find a entry contains check_va
-    int i;
-    uint64 begin, end;
-    bool shared;
-    for (i = 0; i < MAX_MAPPING; i++) {
-        begin = p->maps[i].va;
-        end = begin + p->maps[i].npages * PGSIZE;
-        shared = p->maps[i].shared;
-        if (check_va >= begin && check_va < end) {
-            goto range_found;
-        }
+err:
+    if (va > start) {
+        uvmunmap(p->pagetable, start, (va - start) / PGSIZE, TRUE);
     }
-    // not found
     return -1;
-
-range_found:
-    left_va = begin;
-    left_npages = (check_va - begin) / PGSIZE;
-    right_va = check_va + PGSIZE;
-    right_npages = (end - right_va) / PGSIZE;
-
-    // remove the mapping
-    if (mapping_remove_fixed(p, begin, (end - begin) / PGSIZE) < 0) {
-        panic("mapping_try_remove_page: mapping_remove_fixed failed");
-    }
-    // add the left and right mappings
-    if (left_npages > 0 && mapping_add(p, left_va, left_npages, shared) < 0) {
-        panic("mapping_try_remove_page: mapping_add left failed");
-    }
-    if (right_npages > 0 && mapping_add(p, right_va, right_npages, shared) < 0) {
-        panic("mapping_try_remove_page: mapping_add right failed");
-    }
-    return 0;
 }
 
 void *mmap(struct proc *p, void *start, size_t len, int prot, int flags, struct inode *ip, off_t off) {
-    if (p->maps[MAX_MAPPING - 1].va != 0) {
-        infof("sys_mmap: too many mappings");
-        return MAP_FAILED;
-    }
-
     // length sanity check and do alignment
     if (len == 0) {
         infof("sys_mmap: len cannot be 0");
         return MAP_FAILED;
     }
     len = PGROUNDUP(len);
-    uint npages = len / PGSIZE;
+
+    // 2 MiB pages for anonymous memory, the only huge page size
+    uint64 align = PGSIZE;
+    if (flags & MAP_HUGETLB) {
+        int huge_size = flags & (MAP_HUGE_MASK << MAP_HUGE_SHIFT);
+        if (!(flags & MAP_ANONYMOUS) || (huge_size != 0 && huge_size != MAP_HUGE_2MB)) {
+            infof("sys_mmap: only anonymous 2 MiB huge pages are supported");
+            return MAP_FAILED;
+        }
+        align = HUGEPGSIZE;
+        len = ROUNDUP(len, HUGEPGSIZE);
+    }
 
     // get valid start address
     if (flags & MAP_FIXED) {
@@ -708,127 +786,422 @@ void *mmap(struct proc *p, void *start, size_t len, int prot, int flags, struct
             infof("MAP_FIXED: start cannot be NULL");
             return MAP_FAILED;
         }
-        if (((uint64)start % PGSIZE) != 0) {
+        if (((uint64)start % align) != 0) {
             infof("MAP_FIXED: start must be page aligned");
             return MAP_FAILED;
         }
+        if ((uint64)start + len > USER_STACK_BOTTOM || (uint64)start + len < (uint64)start) {
+            infof("MAP_FIXED: start is out of range");
+            return MAP_FAILED;
+        }
+        if (inside_huge_page(p, (uint64)start) || inside_huge_page(p, (uint64)start + len)) {
+            infof("MAP_FIXED: range splits a huge page");
+            return MAP_FAILED;
+        }
 
-        if (!is_free_range(p->pagetable, (uint64)start, npages)) {
+        if (!vma_range_free(&p->vmas, (uint64)start, (uint64)start + len)) {
             // try to remove existing mapping overlapping with the new one
-            for (uint64 va = (uint64)start; va < (uint64)start + npages * PGSIZE; va += PGSIZE) {
-                if (mapping_try_remove_page(p, va) == 0) {
-                    uvmunmap(p->pagetable, va, 1, TRUE);
-                }
+            if (unmap_range(p, (uint64)start, (uint64)start + len) < 0) {
+                infof("MAP_FIXED: no memory to split mappings");
+                return MAP_FAILED;
             }
             // check again
-            if (!is_free_range(p->pagetable, (uint64)start, npages)) {
+            if (!vma_range_free(&p->vmas, (uint64)start, (uint64)start + len)) {
                 infof("MAP_FIXED: start is not free");
                 return MAP_FAILED;
             }
         }
     } else {
-        start = get_free_range(p->pagetable, npages, PGROUNDUP((uint64)start));
+        // room for an aligned range anywhere in what is found
+        start = (void *)vma_unmapped_area(&p->vmas, len + align - PGSIZE, MMAP_LOW, MMAP_HIGH,
+                                          PGROUNDUP((uint64)start));
         if (start == NULL) {
             infof("sys_mmap: no free range");
             return MAP_FAILED;
         }
+        start = (void *)ROUNDUP((uint64)start, align);
     }
 
     // calculate page protection
-    int page_prot = PTE_U;
-    if (prot & PROT_READ) {
-        page_prot |= PTE_R;
+    int page_prot = PTE_U | prot_to_perm(prot);
+
+    // record mapping info
+    struct vma *v = vma_map(&p->vmas, (uint64)start, (uint64)start + len, prot, flags, VMA_MMAP,
+                            ip, ip ? off : 0, ip ? len : 0);
+    if (v == NULL) {
+        infof("sys_mmap: no memory for the vma");
+        return MAP_FAILED;
     }
-    if (prot & PROT_WRITE) {
-        page_prot |= PTE_W;
+
+    if (flags & MAP_HUGETLB) {
+        if (map_huge_pages(p, v, page_prot) != 0) {
+            infof("sys_mmap: no free huge page");
+            vma_erase(&p->vmas, v);
+            return MAP_FAILED;
+        }
+        return start;
     }
-    if (prot & PROT_EXEC) {
-        page_prot |= PTE_X;
+
+    // private anonymous memory is faulted in on first touch,
+    // shared needs the pages now so that fork can share them
+    if ((flags & MAP_ANONYMOUS) && !(flags & (MAP_SHARED | MAP_POPULATE))) {
+        if (uvmreserve(p->pagetable, (uint64)start, (uint64)start + len, page_prot) == 0) {
+            infof("sys_mmap: no memory for page tables");
+            vma_erase(&p->vmas, v);
+            return MAP_FAILED;
+        }
+        return start;
     }
 
-    // do mmap
-    void *pa_arr[npages];
-    memset(pa_arr, 0, sizeof(pa_arr));
+    if (map_pages_now(p, v, v->start, v->end, page_prot) != 0) {
+        vma_erase(&p->vmas, v);
+        return MAP_FAILED;
+    }
+    return start;
+}
 
-    if (flags & MAP_ANONYMOUS) {
-        // allocate physical pages
-        for (uint i = 0; i < npages; i++) {
-            void *pa = alloc_physical_page();
-            if (pa == NULL) {
-                infof("sys_mmap: no free physical page");
-                goto free_pages;
-            }
-            memset(pa, 0, PGSIZE);
-            pa_arr[i] = pa;
-        }
-    } else {
-        if (PGROUNDUP(f_size(&ip->file)) < off + len) {
-            infof("sys_mmap: file is too small, so expand it");
-            f_lseek(&ip->file, off + len);
+int munmap(struct proc *p, void *start, size_t len) {
+    if ((uint64)start % PGSIZE != 0) {
+        infof("sys_munmap: start is not page aligned");
+        return -1;
+    }
+    uint64 end = (uint64)start + PGROUNDUP(len);
+    if (inside_huge_page(p, (uint64)start) || inside_huge_page(p, end)) {
+        infof("sys_munmap: range splits a huge page");
+        return -1;
+    }
+    return unmap_range(p, (uint64)start, end) > 0 ? 0 : -1;
+}
+
+int msync(struct proc *p, void *start, size_t len) {
+    if ((uint64)start % PGSIZE != 0) {
+        infof("sys_msync: start is not page aligned");
+        return -1;
+    }
+    uint npages = PGROUNDUP(len) / PGSIZE;
+    return uvmsync(p->pagetable, (uint64)start, npages);
+}
+
+// Whether VMAs cover all of [start, end).
+static bool range_mapped(struct proc *p, uint64 start, uint64 end) {
+    uint64 addr = start;
+    struct vma *v;
+    for (v = vma_find_next(&p->vmas, start); v != NULL && v->start <= addr && addr < end; v = vma_next(v)) {
+        addr = v->end;
+    }
+    return addr >= end;
+}
+
+/**
+ * @brief Change the protection of [start, end), see sys_mprotect()
+ *
+ * @return 0 on success, -1 if part of the range is not mapped or out of memory
+ */
+int mprotect(struct proc *p, uint64 start, uint64 end, int prot) {
+    struct vma *v;
+    if (!range_mapped(p, start, end)) {
+        infof("sys_mprotect: range is not mapped");
+        return -1;
+    }
+    if (inside_huge_page(p, start) || inside_huge_page(p, end)) {
+        infof("sys_mprotect: range splits a huge page");
+        return -1;
+    }
+
+    struct vma *next;
+    for (v = vma_find_next(&p->vmas, start); v != NULL && v->start < end; v = next) {
+        next = vma_next(v);
+        if (v->prot == prot) {
+            continue;
         }
-        struct page_cache *cache;
-        void *pa;
-        for (uint i = 0; i < npages; i++) {
-            cache = ctable_acquire(ip, off + i * PGSIZE);
-            if (cache == NULL) {
-                infof("sys_mmap: file is too small");
-                goto free_pages;
-            }
-//            if (flags & MAP_SHARED) {
-//                pa = cache->page;
-//                dup_physical_page(cache->page);
-//            } else {
-                pa = alloc_physical_page();
-                if (pa == NULL) {
-                    infof("sys_mmap: no free physical page");
-                    goto free_pages;
-                }
-                memmove(pa, cache->page, PGSIZE);
-//            }
-            pa_arr[i] = pa;
-            release_mutex_sleep(&cache->lock);
+        if ((v = vma_isolate(&p->vmas, v, start, end)) == NULL) {
+            infof("sys_mprotect: no memory to split mappings");
+            return -1;
         }
+        v->prot = prot;
     }
+    // shared pages keep their write permission, private ones may be COW
+    for (v = vma_find_next(&p->vmas, start); v != NULL && v->start < end; v = vma_next(v)) {
+        uint64 s = MAX(v->start, start), e = MIN(v->end, end);
+        if (uvmprotect(p->pagetable, s, (e - s) / PGSIZE, prot_to_perm(prot), !(v->flags & MAP_SHARED)) != 0)
+            return -1;
+    }
+    return 0;
+}
 
-    // map pages
-    for (uint i = 0; i < npages; i++) {
-        if (map1page(p->pagetable, (uint64)start + i * PGSIZE,
-                     (uint64)pa_arr[i], page_prot) < 0) {
-            panic("sys_mmap: map1page failed, should not happen");
+// MADV_DONTNEED on [start, end) of v: private pages read back as zeros,
+// or from the file, on the next touch. Shared pages keep their contents
+// anyway, so they stay, and so do huge pages, which are cleared instead.
+static int drop_pages(struct proc *p, struct vma *v, uint64 start, uint64 end) {
+    if (v->flags & MAP_SHARED) {
+        return 0;
+    }
+    if (v->flags & MAP_HUGETLB) {
+        // private huge pages are copied on fork, so the frame is p's own
+        // even where p may only read it
+        for (uint64 va = start; va < end; va += HUGEPGSIZE) {
+            memset((void *)walkaddr(p->pagetable, va, FALSE), 0, HUGEPGSIZE);
         }
+        return 0;
+    }
+    uvmunmap(p->pagetable, start, (end - start) / PGSIZE, TRUE);
+    // the page tables are still there, so this can not fail
+    if (uvmreserve(p->pagetable, start, end, PTE_U | prot_to_perm(v->prot)) == 0) {
+        panic("madvise: can not reserve dropped pages");
     }
+    return 0;
+}
 
-    // record mapping info
-    if (mapping_add(p, (uint64)start, npages, !!(flags & MAP_SHARED)) < 0) {
-        panic("sys_mmap: mapping_add failed, found data inconsistent");
+/**
+ * @brief Take advice about the use of [start, end), see sys_madvise()
+ *
+ * @return 0 on success, -1 if part of the range is not mapped or out of memory
+ */
+int madvise(struct proc *p, uint64 start, uint64 end, int advice) {
+    if (!range_mapped(p, start, end)) {
+        infof("sys_madvise: range is not mapped");
+        return -1;
+    }
+    if (advice == MADV_DONTNEED && (inside_huge_page(p, start) || inside_huge_page(p, end))) {
+        infof("sys_madvise: range splits a huge page");
+        return -1;
     }
-    return start;
 
-    free_pages:
-    for (uint i = 0; i < npages; i++) {
-        if (pa_arr[i] == NULL) {
+    struct vma *v, *next;
+    for (v = vma_find_next(&p->vmas, start); v != NULL && v->start < end; v = next) {
+        next = vma_next(v);
+        uint64 s = MAX(v->start, start), e = MIN(v->end, end);
+        switch (advice) {
+        case MADV_WILLNEED:
+            // fill the page cache from the file meanwhile, faults find it there
+            if (v->ip != NULL && s < v->start + v->filesz) {
+                uint64 file_end = MIN(e, PGROUNDUP(v->start + v->filesz));
+                ctable_readahead_async(v->ip, v->off + (s - v->start), (file_end - s) / PGSIZE);
+            }
+            break;
+        case MADV_DONTNEED:
+            drop_pages(p, v, s, e);
+            break;
+        default:
+            // how the file is read ahead on faults, see fault_around()
+            if (v->advice == advice) {
+                break;
+            }
+            if ((v = vma_isolate(&p->vmas, v, start, end)) == NULL) {
+                infof("sys_madvise: no memory to split mappings");
+                return -1;
+            }
+            v->advice = advice;
             break;
         }
-        put_physical_page(pa_arr[i]);
     }
-    return MAP_FAILED;
+    return 0;
 }
 
-int munmap(struct proc *p, void *start, size_t len) {
-    if ((uint64)start % PGSIZE != 0) {
-        infof("sys_munmap: start is not page aligned");
+/**
+ * @brief Tell which pages of [start, end) are resident, see sys_mincore()
+ * A page is resident if it is mapped, or if it is an untouched file page
+ * that the page cache holds.
+ *
+ * @param vec_va one byte per page, bit 0 is set if resident
+ * @return 0 on success, -1 if part of the range is not mapped or vec_va is bad
+ */
+int mincore(struct proc *p, uint64 start, uint64 end, uchar *vec_va) {
+    if (!range_mapped(p, start, end)) {
+        infof("sys_mincore: range is not mapped");
         return -1;
     }
-    len = PGROUNDUP(len);
-    uint npages = len / PGSIZE;
+    uchar vec[MINCORE_BATCH];
+    uint64 va = start;
+    while (va < end) {
+        uint64 n = MIN((end - va) / PGSIZE, MINCORE_BATCH);
+        for (uint64 i = 0; i < n; i++, va += PGSIZE) {
+            pte_t *pte = walk(p->pagetable, va, FALSE);
+            struct vma *v = vma_find(&p->vmas, va);
+            if (pte != NULL && (*pte & PTE_V)) {
+                vec[i] = 1;
+            } else if (pte != NULL && PTE_SWAP_SLOT(*pte) == 0 && v->ip != NULL && va < v->start + v->filesz) {
+                vec[i] = ctable_cached(v->ip, v->off + (va - v->start));
+            } else {
+                vec[i] = 0;
+            }
+        }
+        if (copyout(p->pagetable, (uint64)vec_va, (char *)vec, n) != 0) {
+            infof("sys_mincore: copyout failed");
+            return -1;
+        }
+        vec_va += n;
+    }
+    return 0;
+}
+
+// Back [start, end) of v the way mmap() would: private pages come on
+// first touch, shared ones are mapped right away.
+// Returns 0 on success, -1 with nothing left mapped.
+static int populate_range(struct proc *p, struct vma *v, uint64 start, uint64 end) {
+    int page_prot = PTE_U | prot_to_perm(v->prot);
+    if (!(v->flags & MAP_SHARED)) {
+        return uvmreserve(p->pagetable, start, end, page_prot) == 0 ? -1 : 0;
+    }
+    if (v->ip != NULL) {
+        ilock(v->ip);
+    }
+    int ret = map_pages_now(p, v, start, end, page_prot);
+    if (v->ip != NULL) {
+        iunlock(v->ip);
+    }
+    return ret;
+}
+
+/**
+ * @brief Resize the mmap()ed range [old, old + old_len) and maybe move it,
+ * see sys_mremap(). A move takes the page table entries along, the pages
+ * are not copied.
+ *
+ * @return void* the new start, MAP_FAILED on error
+ */
+void *mremap(struct proc *p, uint64 old, uint64 old_len, uint64 new_len, int flags, uint64 new_addr) {
+    old_len = PGROUNDUP(old_len);
+    new_len = PGROUNDUP(new_len);
+    if (old % PGSIZE != 0 || old_len == 0 || new_len == 0 || (flags & ~(MREMAP_MAYMOVE | MREMAP_FIXED))
+        || ((flags & MREMAP_FIXED) && !(flags & MREMAP_MAYMOVE))) {
+        infof("sys_mremap: invalid arguments");
+        return MAP_FAILED;
+    }
+    struct vma *v = vma_find(&p->vmas, old);
+    if (v == NULL || v->type != VMA_MMAP || old + old_len > v->end || old + old_len < old) {
+        infof("sys_mremap: old range is not inside one mapping");
+        return MAP_FAILED;
+    }
+    if (v->flags & MAP_HUGETLB) {
+        infof("sys_mremap: huge pages stay put");
+        return MAP_FAILED;
+    }
+    if (flags & MREMAP_FIXED) {
+        if (new_addr % PGSIZE != 0 || new_addr + new_len > USER_STACK_BOTTOM || new_addr + new_len < new_addr
+            || (new_addr < old + old_len && old < new_addr + new_len)) {
+            infof("sys_mremap: bad new address");
+            return MAP_FAILED;
+        }
+        if (inside_huge_page(p, new_addr) || inside_huge_page(p, new_addr + new_len)) {
+            infof("sys_mremap: new range splits a huge page");
+            return MAP_FAILED;
+        }
+    }
+
+    // shrinking drops the tail first, v stays valid
+    if (new_len < old_len) {
+        if (unmap_range(p, old + new_len, old + old_len) < 0) {
+            infof("sys_mremap: no memory to split mappings");
+            return MAP_FAILED;
+        }
+        old_len = new_len;
+        if (!(flags & MREMAP_FIXED)) {
+            return (void *)old;
+        }
+    }
+
+    // grow in place if nothing is in the way
+    uint64 old_end = old + old_len;
+    if (!(flags & MREMAP_FIXED) && old_end == v->end && old + new_len <= USER_STACK_BOTTOM
+        && vma_range_free(&p->vmas, old_end, old + new_len)) {
+        uint64 filesz = v->filesz;
+        vma_resize(&p->vmas, v, old + new_len);
+        if (v->ip != NULL) {
+            v->filesz = v->end - v->start;
+        }
+        if (populate_range(p, v, old_end, v->end) != 0) {
+            infof("sys_mremap: no memory to grow");
+            vma_resize(&p->vmas, v, old_end);
+            v->filesz = filesz;
+            return MAP_FAILED;
+        }
+        return (void *)old;
+    }
+    if (!(flags & MREMAP_MAYMOVE)) {
+        infof("sys_mremap: no room to grow in place");
+        return MAP_FAILED;
+    }
 
-    bool removed = FALSE;
-    for (uint64 va = (uint64)start; va < (uint64)start + npages * PGSIZE; va += PGSIZE) {
-        if (mapping_try_remove_page(p, va) == 0) {
-            removed = TRUE;
-            uvmunmap(p->pagetable, va, 1, TRUE);
+    // find or clear the new range, it does not overlap v
+    if (flags & MREMAP_FIXED) {
+        if (unmap_range(p, new_addr, new_addr + new_len) < 0
+            || !vma_range_free(&p->vmas, new_addr, new_addr + new_len)) {
+            infof("sys_mremap: new range is not free");
+            return MAP_FAILED;
         }
+    } else if ((new_addr = vma_unmapped_area(&p->vmas, new_len, MMAP_LOW, MMAP_HIGH, 0)) == 0) {
+        infof("sys_mremap: no free range");
+        return MAP_FAILED;
+    }
+    if ((v = vma_isolate(&p->vmas, v, old, old_end)) == NULL) {
+        infof("sys_mremap: no memory to split mappings");
+        return MAP_FAILED;
     }
 
-    return removed ? 0 : -1;
-}
\ No newline at end of file
+    // back the grown tail first, the move itself can not fail after that
+    struct vma *nv = vma_map(&p->vmas, new_addr, new_addr + new_len, v->prot, v->flags, v->type,
+                             v->ip, v->off, v->ip ? new_len : 0);
+    if (nv == NULL) {
+        infof("sys_mremap: no memory for the vma");
+        return MAP_FAILED;
+    }
+    nv->advice = v->advice;
+    if (new_len > old_len && populate_range(p, nv, new_addr + old_len, new_addr + new_len) != 0) {
+        infof("sys_mremap: no memory to grow");
+        vma_erase(&p->vmas, nv);
+        return MAP_FAILED;
+    }
+    if (uvmmove(p->pagetable, old, new_addr, old_len / PGSIZE) != 0) {
+        infof("sys_mremap: no memory for page tables");
+        if (new_len > old_len) {
+            uvmunmap(p->pagetable, new_addr + old_len, (new_len - old_len) / PGSIZE, TRUE);
+        }
+        vma_erase(&p->vmas, nv);
+        return MAP_FAILED;
+    }
+    vma_erase(&p->vmas, v);
+    return (void *)new_addr;
+}
+
+/**
+ * @brief Move the end of the heap to new_end, see sys_brk()
+ * The heap VMA covers [heap_start, PGROUNDUP(heap end)).
+ *
+ * @return 0 on success, -1 if the heap would run into a mapping or out of memory
+ */
+int resize_heap(struct proc *p, uint64 new_end) {
+    uint64 old_end = p->heap_start + p->heap_sz;
+    uint64 old_top = PGROUNDUP(old_end);
+    uint64 new_top = PGROUNDUP(new_end);
+    struct vma *heap = vma_find(&p->vmas, p->heap_start);
+    if (heap != NULL && heap->type != VMA_HEAP) {
+        heap = NULL;
+    }
+
+    if (new_top > old_top) {
+        if (new_top > MMAP_HIGH || !vma_range_free(&p->vmas, old_top, new_top)) {
+            infof("sys_brk: heap runs into a mapping");
+            return -1;
+        }
+        // reserve memory, pages are zero-filled on first touch
+        if (uvmreserve(p->pagetable, old_end, new_end, PTE_W | PTE_X | PTE_R | PTE_U) == 0) {
+            return -1;
+        }
+        if (heap != NULL) {
+            vma_resize(&p->vmas, heap, new_top);
+        } else if (vma_map(&p->vmas, p->heap_start, new_top, PROT_READ | PROT_WRITE | PROT_EXEC,
+                           MAP_PRIVATE | MAP_ANONYMOUS, VMA_HEAP, NULL, 0, 0) == NULL) {
+            uvmdealloc(p->pagetable, new_end, old_end);
+            return -1;
+        }
+    } else if (new_top < old_top) {
+        uvmdealloc(p->pagetable, old_end, new_end);
+        if (new_top > p->heap_start) {
+            vma_resize(&p->vmas, heap, new_top);
+        } else {
+            vma_erase(&p->vmas, heap);
+        }
+    }
+    return 0;
+}
@@ -7,14 +7,15 @@
 #include <file/file.h>
 #include <lock/lock.h>
 #include <arch/timer.h>
+#include <mem/vma.h>
 #define NPROC (256)
-#define KSTACK_SIZE (PGSIZE * 16)
+#define KSTACK_ORDER (4)
+#define KSTACK_SIZE (PGSIZE << KSTACK_ORDER)
 #define USTACK_SIZE (PGSIZE * 128) // must be multiple of PGSIZE
 #define TRAPFRAME_SIZE (4096)
 #define FD_MAX (256)
 #define PROC_NAME_MAX (16)
 #define MAX_PROC_SHARED_MEM_INSTANCE (32)   // every proc
-#define MAX_MAPPING (128)
 #define RANDOM_SIZE (16)
 
 // for wait()
@@ -68,6 +69,15 @@
 #define PROT_GROWSDOWN 0x01000000
 #define PROT_GROWSUP   0x02000000
 
+#define MADV_NORMAL     0
+#define MADV_RANDOM     1
+#define MADV_SEQUENTIAL 2
+#define MADV_WILLNEED   3
+#define MADV_DONTNEED   4
+
+#define MREMAP_MAYMOVE 1
+#define MREMAP_FIXED   2
+
 // for rusage
 #define	RUSAGE_SELF	0
 #define	RUSAGE_CHILDREN	(-1)
@@ -135,10 +145,18 @@ struct auxv_t {
     uint64 val;
 };
 
-struct mapping {
-    uint64 va; // must be PGSIZE aligned
-    uint npages;
-    bool shared;
+#define FAULT_AROUND_PAGES 8 // file-backed pages read in per fault, power of two
+#define READAHEAD_PAGES 32   // pages read ahead of a MADV_SEQUENTIAL fault
+#define MINCORE_BATCH 256    // pages looked up per copyout in mincore()
+
+// scheduling policies, see set_scheduler()
+#define SCHED_OTHER 0 // stride scheduling
+#define SCHED_FIFO 1  // real-time, runs until it blocks or yields
+#define SCHED_RR 2    // real-time, round robin among equal priorities
+#define RT_PRIO_MAX 99
+
+struct sched_param {
+    int sched_priority; // 1 to RT_PRIO_MAX for real-time policies, 0 otherwise
 };
 
 // Per-process state
@@ -150,6 +168,8 @@ struct proc {
     int pid;               // Process ID
     int killed;            // If non-zero, have been killed
     pagetable_t pagetable; // User page table
+    uint64 asid;           // ASID and its generation, see asid_user_satp()
+    int asid_hart;         // hart that last ran with this ASID
     void *waiting_target;  // used by sleep and wakeup, a pointer of anything
     uint64 exit_code;      // Exit status to be returned to parent's wait
 
@@ -166,6 +186,15 @@ struct proc {
     uint64 heap_sz;
     uint64 stride;
     uint64 priority;
+    uint64 pass;                // stride added per slice, see set_priority()
+    struct proc *rq_next;       // next in the run queue, see scheduler.c
+    uint64 cpu_mask;            // harts it may run on
+    int last_cpu;               // hart it last ran on, -1 if none
+    uint64 nr_migrations;       // times it ran on another hart than the last time
+    int policy;                 // SCHED_OTHER, SCHED_FIFO or SCHED_RR
+    int rt_priority;            // higher runs first, 0 for SCHED_OTHER
+    int rq_prio;                // real-time priority it was queued with, 0 in the stride heap
+    int rq_cpu;                 // hart whose run queue it was queued on
     uint64 user_time;           // us, user only
     uint64 kernel_time;         // us, kernel only
     uint64 last_start_time;     // us
@@ -174,8 +203,16 @@ struct proc {
     struct shared_mem * shmem[MAX_PROC_SHARED_MEM_INSTANCE];
     void * shmem_map_start[MAX_PROC_SHARED_MEM_INSTANCE];
     void* next_shmem_addr;
-    struct mapping maps[MAX_MAPPING];
+    struct vma_tree vmas;       // user address space, except shared memory
+    uint64 swap_cursor;         // where swapping resumes in vmas, see swap.c
+    int swap_pin;               // > 0 while the kernel holds user pages across a sleep or preemption
+    uint64 nswap;               // pages swapped out
+    uint64 majflt;              // faults that swapped a page in
+    uint64 zero_maps;           // pages given the zero page instead of a frame
     char name[PROC_NAME_MAX]; // Process name (debugging)
+    bool kthread;               // kernel thread, never returns to user space
+    void (*kthread_fn)(void *);
+    void *kthread_arg;
 };
 
 // process CPU time
@@ -223,6 +260,7 @@ void forkret(void);
 
 void proc_free_mem_and_pagetable(struct proc* p);
 struct proc *alloc_proc(void);
+struct proc *kthread_create(void (*fn)(void *), void *arg, const char *name);
 struct file *get_proc_file_by_fd(struct proc *p, int fd);
 pagetable_t proc_pagetable(struct proc *p);
 void freeproc(struct proc *p);
@@ -230,4 +268,10 @@ int get_cpu_time(struct proc *p, struct tms *tms);
 bool the_only_proc_in_pool();
 void *mmap(struct proc *p, void *start, size_t len, int prot, int flags, struct inode *ip, off_t off);
 int munmap(struct proc *p, void *start, size_t len);
+int msync(struct proc *p, void *start, size_t len);
+int mprotect(struct proc *p, uint64 start, uint64 end, int prot);
+int madvise(struct proc *p, uint64 start, uint64 end, int advice);
+int mincore(struct proc *p, uint64 start, uint64 end, uchar *vec_va);
+void *mremap(struct proc *p, uint64 old, uint64 old_len, uint64 new_len, int flags, uint64 new_addr);
+int resize_heap(struct proc *p, uint64 new_end);
 #endif // PROC_H
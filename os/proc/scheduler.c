@@ -2,61 +2,819 @@
 #include <proc/proc.h>
 #include <ucore/ucore.h>
 #include <arch/timer.h>
+#include <arch/riscv.h>
+
+struct runqueue runqueues[NCPU];
+static uint64 rr_interval = RR_INTERVAL_TICKS;
+
 void init_scheduler()
 {
+    for (int i = 0; i < NCPU; i++)
+    {
+        init_spin_lock_with_name(&runqueues[i].lock, "runqueue.lock");
+        runqueues[i].heap_size = 0;
+        runqueues[i].vtime = 0;
+        runqueues[i].inbox = NULL;
+        runqueues[i].nr_queued = 0;
+        for (int prio = 0; prio <= RT_PRIO_MAX; prio++)
+        {
+            runqueues[i].rt_head[prio] = NULL;
+            runqueues[i].rt_tail[prio] = NULL;
+            runqueues[i].nr_rt[prio] = 0;
+        }
+        runqueues[i].rt_bitmap[0] = runqueues[i].rt_bitmap[1] = 0;
+        runqueues[i].nr_rt_queued = 0;
+        runqueues[i].rt_period_start = 0;
+        runqueues[i].rt_used = 0;
+        runqueues[i].nr_migrations = 0;
+        runqueues[i].nr_rt_throttled = 0;
+    }
 }
 
-void scheduler(void)
+/**
+ * @brief Set the share of p, it advances by BIGSTRIDE / priority per slice.
+ * p->lock must be held.
+ */
+void set_priority(struct proc *p, uint64 priority)
 {
-    uint64 busy = 0;
-    uint64 all = 0;
-    uint64 timestamp1 = r_cycle();
+    KERNEL_ASSERT(priority >= 2, "set_priority: priority too low");
+    p->priority = priority;
+    p->pass = BIGSTRIDE / priority;
+}
+
+static int allowed(struct proc *p, int cpu)
+{
+    return (p->cpu_mask >> cpu) & 1;
+}
+
+// Send an IPI to one idle hart, so it steals p queued on the busy hart busy.
+static void kick_idle_hart(int busy, struct proc *p)
+{
+    // pairs with the fence in idle(), either it sees the proc or we see it idle
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (int i = 0; i < NCPU; i++)
+    {
+        if (i == busy || !allowed(p, i) || !__atomic_load_n(&cpus[i].idle, __ATOMIC_RELAXED))
+            continue;
+        // claim it, so the next wakeup goes to another one
+        if (__atomic_exchange_n(&cpus[i].idle, FALSE, __ATOMIC_ACQ_REL))
+        {
+            __atomic_store_n(&cpus[i].ipi_sent, r_time(), __ATOMIC_RELAXED);
+            send_ipi(i);
+            return;
+        }
+    }
+}
+
+// Highest real-time priority waiting on rq, the inbox included, 0 if none.
+// Only the counts are looked at, so no lock is needed.
+static int rt_waiting(struct runqueue *rq)
+{
+    if (__atomic_load_n(&rq->nr_rt_queued, __ATOMIC_RELAXED) == 0)
+        return 0;
+    for (int prio = RT_PRIO_MAX; prio > 0; prio--)
+    {
+        if (__atomic_load_n(&rq->nr_rt[prio], __ATOMIC_RELAXED) > 0)
+            return prio;
+    }
+    return 0;
+}
+
+// Start a new throttling period if the last one is over,
+// only the hart owning rq does.
+static void rt_refresh(struct runqueue *rq, uint64 now)
+{
+    if (now - rq->rt_period_start >= RT_PERIOD_TICKS)
+    {
+        rq->rt_period_start = now;
+        rq->rt_used = 0;
+    }
+}
+
+// Whether real-time procs used up their share of this period.
+static int rt_throttled(struct runqueue *rq, uint64 now)
+{
+    rt_refresh(rq, now);
+    return rq->rt_used >= RT_RUNTIME_TICKS;
+}
+
+// The tick the proc running on c has to give up the hart at,
+// for what waits on rq, its own run queue. ~0 if it may run on.
+static uint64 preempt_tick(struct cpu *c, struct runqueue *rq, uint64 now)
+{
+    struct proc *p = c->proc;
+    int nr_queued = __atomic_load_n(&rq->nr_queued, __ATOMIC_RELAXED);
+    // its affinity changed, it goes elsewhere right away
+    if (p != NULL && !allowed(p, c - cpus))
+        return now;
+    if (p == NULL || nr_queued == 0)
+        return ~0ULL;
+    int nr_rt = __atomic_load_n(&rq->nr_rt_queued, __ATOMIC_RELAXED);
+    int top = rt_waiting(rq);
+    uint64 tick = ~0ULL;
+    if (p->policy == SCHED_OTHER)
+    {
+        if (top > 0)
+        {
+            // real-time procs come first, once they have budget again
+            if (!rt_throttled(rq, now))
+                return now;
+            tick = rq->rt_period_start + RT_PERIOD_TICKS;
+        }
+        if (nr_queued > nr_rt)
+            tick = MIN(tick, c->slice_start + TIME_SLICE_TICKS);
+        return tick;
+    }
+    if (top > p->rt_priority)
+        return now;
+    if (nr_queued > nr_rt)
+    {
+        // SCHED_OTHER procs wait, until the budget is gone
+        rt_refresh(rq, now);
+        uint64 left = rq->rt_used < RT_RUNTIME_TICKS ? RT_RUNTIME_TICKS - rq->rt_used : 0;
+        tick = c->slice_start + left;
+    }
+    if (p->policy == SCHED_RR && top == p->rt_priority)
+        tick = MIN(tick, c->slice_start + __atomic_load_n(&rr_interval, __ATOMIC_RELAXED));
+    return tick;
+}
+
+/**
+ * @brief The tick the running proc has to give up this hart at,
+ * for its time slice, the RR quantum or the real-time budget.
+ * ~0 if nothing waits for the hart, see set_next_timer().
+ */
+uint64 preempt_deadline()
+{
+    push_off();
+    uint64 tick = preempt_tick(mycpu(), &runqueues[cpuid()], r_time());
+    pop_off();
+    return tick;
+}
+
+/**
+ * @brief Whether the running proc should yield to what waits for this hart
+ */
+int should_preempt()
+{
+    push_off();
+    uint64 now = r_time();
+    int preempt = preempt_tick(mycpu(), &runqueues[cpuid()], now) <= now;
+    pop_off();
+    return preempt;
+}
+
+// Something was queued behind the proc running on c, see that it gets
+// its turn: now through a soft interrupt to this hart, or by the timer.
+// Unlike set_next_timer() it takes no lock, timers_lock may be held.
+static void resched(struct cpu *c, struct runqueue *rq)
+{
+    uint64 now = r_time();
+    uint64 tick = preempt_tick(c, rq, now);
+    if (tick <= now)
+    {
+        w_sip(r_sip() | SIP_SSIP);
+    }
+    else if (tick < c->timer_deadline)
+    {
+        c->timer_deadline = tick;
+        set_timer(tick);
+    }
+}
+
+/**
+ * @brief Make the hart running p trap soon, so it sees p->killed
+ * without waiting for a time slice that may never end.
+ * p->lock must be held.
+ */
+void kick_proc(struct proc *p)
+{
+    if (p->state != RUNNING)
+        return;
+    for (int i = 0; i < NCPU; i++)
+    {
+        if (cpus[i].proc == p)
+        {
+            send_ipi(i);
+            return;
+        }
+    }
+}
+
+// Procs queued on cpu plus the one it runs.
+static int load(int cpu)
+{
+    return __atomic_load_n(&runqueues[cpu].nr_queued, __ATOMIC_RELAXED) +
+           (__atomic_load_n(&cpus[cpu].proc, __ATOMIC_RELAXED) != NULL);
+}
+
+// The hart to queue p on: the one it last ran on, its caches may still
+// hold p's data, unless that has SCHED_IMBALANCE more work than the
+// least loaded hart p may use. Ties go to self.
+static int select_cpu(struct proc *p, int self)
+{
+    int best = -1;
+    int best_load = 0;
+    for (int i = 0; i < NCPU; i++)
+    {
+        if (!booted[i] || !allowed(p, i))
+            continue;
+        int l = load(i);
+        if (best < 0 || l < best_load || (l == best_load && i == self))
+        {
+            best = i;
+            best_load = l;
+        }
+    }
+    // before the harts have booted
+    if (best < 0)
+        return self;
+    int last = p->last_cpu;
+    if (last >= 0 && booted[last] && allowed(p, last) && load(last) <= best_load + SCHED_IMBALANCE)
+        return last;
+    return best;
+}
+
+// Push p onto the inbox of a hart and see that the hart gets to it,
+// p->lock must be held and interrupts off.
+static void place(struct proc *p, int self)
+{
+    int target = select_cpu(p, self);
+    struct runqueue *rq = &runqueues[target];
+    p->rq_cpu = target;
+    p->rq_prio = p->policy != SCHED_OTHER ? p->rt_priority : 0;
+    if (p->rq_prio > 0)
+    {
+        __atomic_add_fetch(&rq->nr_rt[p->rq_prio], 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&rq->nr_rt_queued, 1, __ATOMIC_RELAXED);
+    }
+    struct proc *head = __atomic_load_n(&rq->inbox, __ATOMIC_RELAXED);
+    do
+    {
+        p->rq_next = head;
+    } while (!__atomic_compare_exchange_n(&rq->inbox, &head, p, TRUE, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    __atomic_add_fetch(&rq->nr_queued, 1, __ATOMIC_SEQ_CST);
+
+    struct cpu *c = &cpus[target];
+    if (target == self)
+    {
+        // an idle hart is not running anything and picks p up itself
+        if (c->proc != NULL)
+        {
+            kick_idle_hart(self, p);
+            resched(c, rq);
+        }
+        return;
+    }
+    if (__atomic_exchange_n(&c->idle, FALSE, __ATOMIC_ACQ_REL))
+    {
+        __atomic_store_n(&c->ipi_sent, r_time(), __ATOMIC_RELAXED);
+        send_ipi(target);
+        return;
+    }
+    // select_cpu() may pick a busy last_cpu over an idle hart,
+    // which should then steal p rather than sleep on in wfi
+    kick_idle_hart(target, p);
+    if (p->rq_prio > 0 || __atomic_load_n(&c->timer_deadline, __ATOMIC_RELAXED) > r_time() + TIME_SLICE_TICKS)
+    {
+        // p may preempt it, or it runs without a slice timer,
+        // the soft interrupt handler sorts it out
+        send_ipi(target);
+    }
+}
+
+/**
+ * @brief Set p RUNNABLE and queue it, p->lock must be held.
+ * It takes no lock, so it is fine from wakeup() and interrupt handlers.
+ * p goes back to the hart it last ran on if that is not too busy, or to
+ * the least busy one, which is woken up if idle.
+ */
+void make_runnable(struct proc *p)
+{
+    KERNEL_ASSERT(p->state != RUNNABLE, "make_runnable: already queued");
+    p->state = RUNNABLE;
+    push_off();
+    place(p, cpuid());
+    pop_off();
+}
+
+// Harts running the scheduler.
+static uint64 online_mask()
+{
+    uint64 mask = 0;
+    for (int i = 0; i < NCPU; i++)
+    {
+        if (booted[i])
+            mask |= 1UL << i;
+    }
+    return mask;
+}
+
+// Find the live proc with pid, 0 for the caller, and lock it.
+static struct proc *lock_proc(int pid)
+{
+    if (pid == 0)
+    {
+        struct proc *p = curr_proc();
+        acquire(&p->lock);
+        return p;
+    }
+    acquire(&pool_lock);
+    for (struct proc *p = pool; p < &pool[NPROC]; p++)
+    {
+        acquire(&p->lock);
+        if (p->state != UNUSED && p->state != ZOMBIE && p->pid == pid)
+        {
+            release(&pool_lock);
+            return p;
+        }
+        release(&p->lock);
+    }
+    release(&pool_lock);
+    return NULL;
+}
+
+/**
+ * @brief Restrict proc pid, 0 for the caller, to the harts in mask.
+ * A proc running on a hart no longer allowed moves away right away,
+ * another one is interrupted for it, queued procs when next scheduled.
+ *
+ * @return int 0 on success, -1 if there is no such proc or no online hart in mask
+ */
+int set_affinity(int pid, uint64 mask)
+{
+    mask &= online_mask();
+    if (mask == 0)
+        return -1;
+    struct proc *p = lock_proc(pid);
+    if (p == NULL)
+        return -1;
+    p->cpu_mask = mask;
+    int move = p == curr_proc() && !allowed(p, cpuid());
+    // running elsewhere, a lone proc may not trap on its own for long
+    if (!move && p->state == RUNNING && !allowed(p, p->last_cpu))
+        kick_proc(p);
+    release(&p->lock);
+    if (move)
+        yield();
+    return 0;
+}
+
+/**
+ * @brief The harts proc pid, 0 for the caller, may run on
+ *
+ * @return int 0 on success, -1 if there is no such proc
+ */
+int get_affinity(int pid, uint64 *mask)
+{
+    struct proc *p = lock_proc(pid);
+    if (p == NULL)
+        return -1;
+    *mask = p->cpu_mask & online_mask();
+    release(&p->lock);
+    return 0;
+}
+
+static int unqueue(struct proc *p);
+
+/**
+ * @brief Move proc pid, 0 for the caller, to another scheduling policy.
+ * Real-time procs run before SCHED_OTHER ones, the highest priority
+ * first, as long as their hart has budget left in this period.
+ * A queued proc is queued again for its new class right away.
+ *
+ * @return int 0 on success, -1 on a bad policy or priority, or no such proc
+ */
+int set_scheduler(int pid, int policy, int priority)
+{
+    if (policy == SCHED_OTHER)
+    {
+        if (priority != 0)
+            return -1;
+    }
+    else if (policy != SCHED_FIFO && policy != SCHED_RR)
+    {
+        return -1;
+    }
+    else if (priority < 1 || priority > RT_PRIO_MAX)
+    {
+        return -1;
+    }
+    struct proc *p = lock_proc(pid);
+    if (p == NULL)
+        return -1;
+    p->policy = policy;
+    p->rt_priority = priority;
+    int self = p == curr_proc();
+    int rq_prio = policy != SCHED_OTHER ? priority : 0;
+    if (p->state == RUNNABLE && p->rq_prio != rq_prio)
+    {
+        // unless a hart is about to run it anyway
+        if (unqueue(p))
+            place(p, cpuid());
+    }
+    else if (!self)
+    {
+        kick_proc(p);
+    }
+    release(&p->lock);
+    if (self && should_preempt())
+        yield();
+    return 0;
+}
+
+/**
+ * @brief The scheduling policy of proc pid, 0 for the caller
+ *
+ * @return int the policy, -1 if there is no such proc
+ */
+int get_scheduler(int pid, int *priority)
+{
+    struct proc *p = lock_proc(pid);
+    if (p == NULL)
+        return -1;
+    int policy = p->policy;
+    *priority = p->rt_priority;
+    release(&p->lock);
+    return policy;
+}
+
+/**
+ * @brief Quantum of SCHED_RR procs, in ticks
+ */
+uint64 get_rr_interval()
+{
+    return __atomic_load_n(&rr_interval, __ATOMIC_RELAXED);
+}
+
+void set_rr_interval(uint64 ticks)
+{
+    ticks = MIN(MAX(ticks, RR_INTERVAL_MIN_TICKS), RR_INTERVAL_MAX_TICKS);
+    __atomic_store_n(&rr_interval, ticks, __ATOMIC_RELAXED);
+}
+
+// Strides only ever grow and may wrap around,
+// so they are compared by their distance.
+static int stride_before(uint64 a, uint64 b)
+{
+    return (int64)(a - b) < 0;
+}
+
+static void heap_push(struct runqueue *rq, struct proc *p)
+{
+    int i = rq->heap_size++;
+    while (i > 0)
+    {
+        int parent = (i - 1) / 2;
+        if (!stride_before(p->stride, rq->heap[parent]->stride))
+            break;
+        rq->heap[i] = rq->heap[parent];
+        i = parent;
+    }
+    rq->heap[i] = p;
+}
+
+// Take heap[i] out, the last one fills the hole.
+static struct proc *heap_remove(struct runqueue *rq, int i)
+{
+    struct proc *removed = rq->heap[i];
+    struct proc *last = rq->heap[--rq->heap_size];
+    if (i == rq->heap_size)
+        return removed;
+    while (i > 0)
+    {
+        int parent = (i - 1) / 2;
+        if (!stride_before(last->stride, rq->heap[parent]->stride))
+            break;
+        rq->heap[i] = rq->heap[parent];
+        i = parent;
+    }
     for (;;)
     {
-        uint64 min_stride = ~0ULL;
-        struct proc *next_proc = NULL;
-        int any_proc = FALSE;
-        // lock when picking proc
-        acquire(&pool_lock);
+        int child = 2 * i + 1;
+        if (child >= rq->heap_size)
+            break;
+        if (child + 1 < rq->heap_size && stride_before(rq->heap[child + 1]->stride, rq->heap[child]->stride))
+            child++;
+        if (!stride_before(rq->heap[child]->stride, last->stride))
+            break;
+        rq->heap[i] = rq->heap[child];
+        i = child;
+    }
+    rq->heap[i] = last;
+    return removed;
+}
+
+static void rt_push(struct runqueue *rq, struct proc *p)
+{
+    int prio = p->rq_prio;
+    p->rq_next = NULL;
+    if (rq->rt_tail[prio] != NULL)
+        rq->rt_tail[prio]->rq_next = p;
+    else
+        rq->rt_head[prio] = p;
+    rq->rt_tail[prio] = p;
+    rq->rt_bitmap[prio / 64] |= 1UL << (prio % 64);
+}
+
+// Take p, which follows prev or heads its FIFO if prev is NULL.
+static struct proc *rt_remove(struct runqueue *rq, struct proc *prev, struct proc *p)
+{
+    int prio = p->rq_prio;
+    if (prev != NULL)
+        prev->rq_next = p->rq_next;
+    else
+        rq->rt_head[prio] = p->rq_next;
+    if (rq->rt_tail[prio] == p)
+        rq->rt_tail[prio] = prev;
+    if (rq->rt_head[prio] == NULL)
+        rq->rt_bitmap[prio / 64] &= ~(1UL << (prio % 64));
+    p->rq_next = NULL;
+    return p;
+}
+
+// Highest priority with a non-empty FIFO, 0 if none, rq->lock must be held.
+static int rt_top(struct runqueue *rq)
+{
+    if (rq->rt_bitmap[1] != 0)
+        return 64 + 63 - __builtin_clzl(rq->rt_bitmap[1]);
+    if (rq->rt_bitmap[0] != 0)
+        return 63 - __builtin_clzl(rq->rt_bitmap[0]);
+    return 0;
+}
+
+// Move the inbox into the FIFOs and the heap, rq->lock must be held.
+static void drain_inbox(struct runqueue *rq)
+{
+    struct proc *p = __atomic_exchange_n(&rq->inbox, NULL, __ATOMIC_ACQUIRE);
+    // the inbox is a stack, turn it around to keep arrival order
+    struct proc *fifo = NULL;
+    while (p != NULL)
+    {
+        struct proc *next = p->rq_next;
+        p->rq_next = fifo;
+        fifo = p;
+        p = next;
+    }
+    for (p = fifo; p != NULL; p = fifo)
+    {
+        fifo = p->rq_next;
+        p->rq_next = NULL;
+        if (p->rq_prio > 0)
+        {
+            rt_push(rq, p);
+            continue;
+        }
+        // a sleeper or newcomer starts level with the others,
+        // instead of running alone until it catches up
+        if (stride_before(p->stride, rq->vtime))
+            p->stride = rq->vtime;
+        heap_push(rq, p);
+    }
+}
 
-        for (struct proc *p = pool; p < &pool[NPROC]; p++)
+// The real-time proc of highest priority allowed on thief, NULL if none.
+static struct proc *rt_steal(struct runqueue *rq, int thief)
+{
+    for (int prio = rt_top(rq); prio > 0; prio--)
+    {
+        struct proc *prev = NULL;
+        for (struct proc *p = rq->rt_head[prio]; p != NULL; prev = p, p = p->rq_next)
         {
-            if (!p->state == UNUSED)
+            if (allowed(p, thief))
+                return rt_remove(rq, prev, p);
+        }
+    }
+    return NULL;
+}
+
+// p left rq, rq->lock must be held.
+static void uncount(struct runqueue *rq, struct proc *p)
+{
+    __atomic_sub_fetch(&rq->nr_queued, 1, __ATOMIC_RELAXED);
+    if (p->rq_prio > 0)
+    {
+        __atomic_sub_fetch(&rq->nr_rt[p->rq_prio], 1, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&rq->nr_rt_queued, 1, __ATOMIC_RELAXED);
+    }
+}
+
+// Take the next proc off rq, NULL if it is empty: the real-time one of
+// highest priority, unless their budget is gone and others wait, or
+// else the one with the least stride.
+// A thief only takes one allowed on its hart, the owner takes any.
+static struct proc *dequeue(struct runqueue *rq, int thief)
+{
+    if (__atomic_load_n(&rq->nr_queued, __ATOMIC_RELAXED) == 0)
+        return NULL;
+    acquire(&rq->lock);
+    drain_inbox(rq);
+    struct proc *p = NULL;
+    int top = rt_top(rq);
+    if (thief < 0 && top > 0 && (rq->heap_size == 0 || !rt_throttled(rq, r_time())))
+        p = rt_remove(rq, NULL, rq->rt_head[top]);
+    else if (thief >= 0)
+        p = rt_steal(rq, thief);
+
+    if (p == NULL)
+    {
+        int i = rq->heap_size > 0 ? 0 : -1;
+        if (thief >= 0 && i == 0 && !allowed(rq->heap[0], thief))
+        {
+            i = -1;
+            for (int j = 1; j < rq->heap_size; j++)
             {
-                any_proc = TRUE;
-                // debugcore("state=%d", p->state);
+                if (allowed(rq->heap[j], thief) && (i < 0 || stride_before(rq->heap[j]->stride, rq->heap[i]->stride)))
+                    i = j;
             }
-            if (p->state == RUNNABLE && !p->lock.locked)
+        }
+        if (i >= 0)
+        {
+            p = heap_remove(rq, i);
+            if (thief < 0)
+                rq->vtime = p->stride;
+        }
+    }
+    if (p != NULL)
+        uncount(rq, p);
+    release(&rq->lock);
+    return p;
+}
+
+/**
+ * @brief Take p off the run queue it was placed on, to place it again.
+ * p->lock must be held and p RUNNABLE.
+ *
+ * @return int FALSE if a hart already took it to run it
+ */
+static int unqueue(struct proc *p)
+{
+    struct runqueue *rq = &runqueues[p->rq_cpu];
+    int found = FALSE;
+    acquire(&rq->lock);
+    drain_inbox(rq);
+    if (p->rq_prio > 0)
+    {
+        struct proc *prev = NULL;
+        for (struct proc *q = rq->rt_head[p->rq_prio]; q != NULL; prev = q, q = q->rq_next)
+        {
+            if (q == p)
+            {
+                rt_remove(rq, prev, p);
+                found = TRUE;
+                break;
+            }
+        }
+    }
+    else
+    {
+        for (int i = 0; i < rq->heap_size; i++)
+        {
+            if (rq->heap[i] == p)
             {
-                if (p->stride < min_stride)
-                {
-                    min_stride = p->stride;
-                    next_proc = p;
-                }
+                heap_remove(rq, i);
+                found = TRUE;
+                break;
             }
         }
+    }
+    if (found)
+        uncount(rq, p);
+    release(&rq->lock);
+    return found;
+}
 
-        if (next_proc != NULL)
+// An idle hart takes work from the sibling with the longest queue.
+static struct proc *steal(int self)
+{
+    int busiest = -1;
+    int most = 0;
+    for (int i = 0; i < NCPU; i++)
+    {
+        int n = __atomic_load_n(&runqueues[i].nr_queued, __ATOMIC_RELAXED);
+        if (i != self && n > most)
         {
-            // found a process to run, lock down the proc;
-            acquire(&next_proc->lock);
+            most = n;
+            busiest = i;
         }
-        // picking proc done
-        release(&pool_lock);
+    }
+    if (busiest < 0)
+        return NULL;
+    struct proc *p = dequeue(&runqueues[busiest], self);
+    if (p != NULL)
+        runqueues[self].nr_migrations++;
+    return p;
+}
+
+// Whether any user proc is left, the kernel shuts down without one.
+// Only called when idle, a stale read just means another round.
+static int any_user_proc()
+{
+    for (struct proc *p = pool; p < &pool[NPROC]; p++)
+    {
+        if (__atomic_load_n(&p->state, __ATOMIC_RELAXED) != UNUSED && !p->kthread)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+// Whether any hart has a proc queued, this one could run or steal it.
+static int any_queued()
+{
+    for (int i = 0; i < NCPU; i++)
+    {
+        if (__atomic_load_n(&runqueues[i].nr_queued, __ATOMIC_RELAXED) > 0)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+// Wait in wfi until there may be work: a wakeup IPI from
+// make_runnable(), a device interrupt, or the nearest timer.
+static void idle(struct cpu *c)
+{
+    intr_off();
+    __atomic_store_n(&c->idle, TRUE, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!any_queued())
+    {
+        // no slice to end, only the nearest timer
+        w_sie(r_sie() | SIE_STIE);
+        set_next_timer();
+        // wfi returns on a pending interrupt even with them turned off,
+        // so one raised after the check is not lost
+        uint64 start = r_time();
+        wfi();
+        c->idle_ticks += r_time() - start;
+    }
+    __atomic_store_n(&c->idle, FALSE, __ATOMIC_RELAXED);
+    // also counted when the IPI came before wfi
+    uint64 sent = __atomic_exchange_n(&c->ipi_sent, 0, __ATOMIC_RELAXED);
+    if (sent != 0)
+    {
+        c->nr_wakeups++;
+        c->wakeup_ticks += r_time() - sent;
+    }
+    // take the pending interrupt, a timer one runs try_wakeup_timer()
+    intr_on();
+    stop_timer_interrupt();
+}
+
+// Get every other hart out of wfi, for the shutdown.
+static void kick_all_harts(int self)
+{
+    for (int i = 0; i < NCPU; i++)
+    {
+        if (i != self && booted[i])
+            send_ipi(i);
+    }
+}
+
+void scheduler(void)
+{
+    uint64 busy = 0;
+    uint64 all = 0;
+    uint64 timestamp1 = r_cycle();
+    for (;;)
+    {
+        int self;
+        push_off();
+        self = cpuid();
+        pop_off();
+
+        struct proc *next_proc = dequeue(&runqueues[self], -1);
+        if (next_proc == NULL)
+            next_proc = steal(self);
 
         if (next_proc != NULL)
         {
+            // the hart it left may still be switching away from it
+            acquire(&next_proc->lock);
+            KERNEL_ASSERT(next_proc->state == RUNNABLE, "scheduler: queued proc not runnable");
+            if (!allowed(next_proc, self))
+            {
+                // its affinity changed while it was queued here
+                place(next_proc, self);
+                release(&next_proc->lock);
+                continue;
+            }
+            if (next_proc->last_cpu >= 0 && next_proc->last_cpu != self)
+                next_proc->nr_migrations++;
+            next_proc->last_cpu = self;
                 // printf("Core %d pick proc %s\n", cpuid(),next_proc->name);
-            
+
             struct cpu *mycore = mycpu();
+            struct runqueue *rq = &runqueues[self];
+            int rt = next_proc->policy != SCHED_OTHER;
             mycore->proc = next_proc;
             next_proc->state = RUNNING;
+            mycore->slice_start = get_tick();
             start_timer_interrupt();
 
             uint64 busy_start = r_cycle();
             next_proc->last_start_time = get_tick();
-            uint64 pass = BIGSTRIDE / (next_proc->priority);
-            next_proc->stride += pass;
+            if (!rt)
+                next_proc->stride += next_proc->pass;
             pushtrace(0x3011);
             pushtrace(next_proc->context.ra);
 
@@ -69,18 +827,35 @@ void scheduler(void)
 
             stop_timer_interrupt();
             mycore->proc = NULL;
+            if (rt)
+            {
+                uint64 now = get_tick();
+                rt_refresh(rq, now);
+                int throttled = rq->rt_used >= RT_RUNTIME_TICKS;
+                rq->rt_used += now - mycore->slice_start;
+                if (!throttled && rq->rt_used >= RT_RUNTIME_TICKS)
+                    rq->nr_rt_throttled++;
+            }
 
             release(&next_proc->lock);
         }
         else
         {
-            if (!any_proc)
+            if (!any_user_proc())
             {
                 debugcore("zero proc in pool");
+                // the others may be waiting in wfi
+                kick_all_harts(self);
                 break;
                 // end scheduler, kernel will shutdown
             }
             pushtrace(0x3019);
+            // nothing to run, prepare zeroed pages instead, then sleep
+            refill_zeroed_pool();
+            push_off();
+            struct cpu *core = mycpu();
+            pop_off();
+            idle(core);
         }
         // printf("core%d\n",cpuid());
         // sample cpu usage
@@ -106,4 +881,4 @@ void scheduler(void)
             pop_off();
         }
     }
-}
\ No newline at end of file
+}
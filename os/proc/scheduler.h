@@ -1,8 +1,58 @@
 #ifndef UCORE_SMP_SCHEDULER_H
 #define UCORE_SMP_SCHEDULER_H
 #include <ucore/types.h>
+#include <arch/cpu.h>
+#include <lock/lock.h>
+#include <proc/proc.h>
+
+// Per-hart run queue.
+// Any hart pushes onto the inbox without a lock, see make_runnable().
+// The owner, or a hart stealing from it, moves the inbox under the lock
+// into a FIFO per real-time priority, or the heap, a min-heap on stride.
+struct runqueue
+{
+    struct spinlock lock;
+    struct proc *heap[NPROC];
+    int heap_size;
+    uint64 vtime;          // stride of the proc picked last, no one joins below it
+    struct proc *rt_head[RT_PRIO_MAX + 1]; // linked by rq_next
+    struct proc *rt_tail[RT_PRIO_MAX + 1];
+    uint64 rt_bitmap[2];   // a bit per non-empty FIFO
+    struct proc *inbox;    // procs made runnable, linked by rq_next
+    int nr_queued;         // procs in queue and inbox
+    int nr_rt[RT_PRIO_MAX + 1]; // real-time ones of them per priority
+    int nr_rt_queued;      // and in all
+    uint64 rt_period_start; // tick the throttling period began at
+    uint64 rt_used;         // ticks real-time procs ran in it
+    uint64 nr_migrations;  // procs this hart stole from the others
+    uint64 nr_rt_throttled; // periods real-time procs used up their budget in
+};
+
+extern struct runqueue runqueues[NCPU];
+
 void init_scheduler();
 void scheduler();
+void make_runnable(struct proc *p);
+void set_priority(struct proc *p, uint64 priority);
+uint64 preempt_deadline();
+int should_preempt();
+int set_scheduler(int pid, int policy, int priority);
+int get_scheduler(int pid, int *priority);
+uint64 get_rr_interval();
+void set_rr_interval(uint64 ticks);
+void kick_proc(struct proc *p);
+int set_affinity(int pid, uint64 mask);
+int get_affinity(int pid, uint64 *mask);
 static const int64 BIGSTRIDE = 0x7FFFFFFFLL;
+// procs more than the least loaded allowed hart has, before a
+// waking proc gives up the hart it last ran on, see select_cpu()
+#define SCHED_IMBALANCE 2
+// Real-time procs get RT_RUNTIME_TICKS of every RT_PERIOD_TICKS
+// while SCHED_OTHER ones wait on the same hart
+#define RT_PERIOD_TICKS SECOND_TO_TICK(1)
+#define RT_RUNTIME_TICKS MS_TO_TICK(950)
+#define RR_INTERVAL_TICKS MS_TO_TICK(100) // default SCHED_RR quantum
+#define RR_INTERVAL_MIN_TICKS MS_TO_TICK(1)
+#define RR_INTERVAL_MAX_TICKS SECOND_TO_TICK(10)
 
 #endif //UCORE_SMP_SCHEDULER_H
@@ -7,7 +7,7 @@ void yield(void) {
     KERNEL_ASSERT(p != NULL, "yield() has no current proc");
     acquire(&p->lock);
     pushtrace(0x3035);
-    p->state = RUNNABLE;
+    make_runnable(p);
     switch_to_scheduler();
     pushtrace(0x3030);
     release(&p->lock);
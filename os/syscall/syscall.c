@@ -56,8 +56,20 @@ char *syscall_names(int id)
         return "SYS_exit";
     case SYS_wait4:
         return "SYS_wait4";
+    case SYS_sched_setscheduler:
+        return "SYS_sched_setscheduler";
+    case SYS_sched_getscheduler:
+        return "SYS_sched_getscheduler";
+    case SYS_sched_setaffinity:
+        return "SYS_sched_setaffinity";
+    case SYS_sched_getaffinity:
+        return "SYS_sched_getaffinity";
     case SYS_sched_yield:
         return "SYS_sched_yield";
+    case SYS_sched_rr_get_interval:
+        return "SYS_sched_rr_get_interval";
+    case SYS_sched_rr_set_interval:
+        return "SYS_sched_rr_set_interval";
     case SYS_kill:
         return "SYS_kill";
     case SYS_setpriority:
@@ -134,6 +146,12 @@ char *syscall_names(int id)
         return "SYS_pselect6";
     case SYS_msync:
         return "SYS_msync";
+    case SYS_madvise:
+        return "SYS_madvise";
+    case SYS_mincore:
+        return "SYS_mincore";
+    case SYS_mremap:
+        return "SYS_mremap";
     default:
         return "?";
     }
@@ -182,9 +200,27 @@ void syscall()
     case SYS_exit:
         ret = sys_exit(args[0]);
         break;
+    case SYS_sched_setscheduler:
+        ret = sys_sched_setscheduler(args[0], args[1], (void *)args[2]);
+        break;
+    case SYS_sched_getscheduler:
+        ret = sys_sched_getscheduler(args[0]);
+        break;
+    case SYS_sched_setaffinity:
+        ret = sys_sched_setaffinity(args[0], args[1], (void *)args[2]);
+        break;
+    case SYS_sched_getaffinity:
+        ret = sys_sched_getaffinity(args[0], args[1], (void *)args[2]);
+        break;
     case SYS_sched_yield:
         ret = sys_sched_yield();
         break;
+    case SYS_sched_rr_get_interval:
+        ret = sys_sched_rr_get_interval(args[0], (void *)args[1]);
+        break;
+    case SYS_sched_rr_set_interval:
+        ret = sys_sched_rr_set_interval((void *)args[0]);
+        break;
     case SYS_setpriority:
         ret = sys_setpriority(args[0]);
         break;
@@ -328,7 +364,16 @@ void syscall()
         ret = sys_dummy_success();
         break;
     case SYS_msync:
-        ret = sys_dummy_success();
+        ret = sys_msync((void *)args[0], args[1], args[2]);
+        break;
+    case SYS_madvise:
+        ret = sys_madvise((void *)args[0], args[1], args[2]);
+        break;
+    case SYS_mincore:
+        ret = sys_mincore((void *)args[0], args[1], (uchar *)args[2]);
+        break;
+    case SYS_mremap:
+        ret = (uint64_t)sys_mremap((void *)args[0], args[1], args[2], args[3], (void *)args[4]);
         break;
     default:
         ret = -38; // ENOSYS
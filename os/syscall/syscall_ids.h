@@ -23,7 +23,12 @@
 #define SYS_fstat 80
 #define SYS_exit 93
 #define SYS_wait4 260
+#define SYS_sched_setscheduler 119
+#define SYS_sched_getscheduler 120
+#define SYS_sched_setaffinity 122
+#define SYS_sched_getaffinity 123
 #define SYS_sched_yield 124
+#define SYS_sched_rr_get_interval 127
 #define SYS_kill 129
 #define SYS_setpriority 140
 #define SYS_getpriority 141
@@ -44,6 +49,7 @@
 #define SYS_spawn 400
 #define SYS_mailread 401
 #define SYS_mailwrite 402
+#define SYS_sched_rr_set_interval 403
 #define SYS_renameat2 276
 #define SYS_getrusage 165
 #define SYS_clock_gettime 113
@@ -63,5 +69,8 @@
 #define SYS_syslog 116
 #define SYS_faccessat 48
 #define SYS_msync 227
+#define SYS_madvise 233
+#define SYS_mincore 232
+#define SYS_mremap 216
 
 #endif // SYSCALL_IDS_H
@@ -2,6 +2,7 @@
 #include <arch/timer.h>
 #include <file/file.h>
 #include <proc/proc.h>
+#include <proc/scheduler.h>
 #include <file/stat.h>
 #include <file/fcntl.h>
 #include <mem/shared.h>
@@ -49,7 +50,7 @@ int sys_pipe(int (*pipefd_va)[2], int flags) {
     struct file *rf, *wf;
     int fd0, fd1;
     int(*pipefd)[2];
-    pipefd = (void *)virt_addr_to_physical(p->pagetable, (uint64)pipefd_va);
+    pipefd = (void *)virt_addr_to_physical(p->pagetable, (uint64)pipefd_va, TRUE);
     if (pipefd == NULL) {
         infof("pipefd invalid");
         return -1;
@@ -88,6 +89,115 @@ int sys_sched_yield() {
     return 0;
 }
 
+/**
+ * @brief Set the scheduling policy of pid, see set_scheduler()
+ *
+ * @return int 0 on success, -1 if failed
+ */
+int sys_sched_setscheduler(pid_t pid, int policy, struct sched_param *param) {
+    struct sched_param kparam;
+    struct proc *p = curr_proc();
+    if (copyin(p->pagetable, (char *)&kparam, (uint64)param, sizeof(kparam)) != 0) {
+        infof("sys_sched_setscheduler: copyin failed");
+        return -1;
+    }
+    return set_scheduler(pid, policy, kparam.sched_priority);
+}
+
+/**
+ * @brief Get the scheduling policy of pid
+ *
+ * @return int the policy, -1 if failed
+ */
+int sys_sched_getscheduler(pid_t pid) {
+    int priority;
+    return get_scheduler(pid, &priority);
+}
+
+/**
+ * @brief Get the quantum of pid, zero unless it is SCHED_RR
+ *
+ * @return int 0 on success, -1 if failed
+ */
+int sys_sched_rr_get_interval(pid_t pid, struct timespec *interval) {
+    int priority;
+    int policy = get_scheduler(pid, &priority);
+    if (policy < 0)
+        return -1;
+    uint64 us = policy == SCHED_RR ? TICK_TO_US(get_rr_interval()) : 0;
+    struct timespec ts;
+    ts.tv_sec = us / USEC_PER_SEC;
+    ts.tv_nsec = us % USEC_PER_SEC * 1000;
+    struct proc *p = curr_proc();
+    if (copyout(p->pagetable, (uint64)interval, (char *)&ts, sizeof(ts)) != 0) {
+        infof("sys_sched_rr_get_interval: copyout failed");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Set the quantum of all SCHED_RR procs,
+ * clamped to between a millisecond and ten seconds
+ *
+ * @return int 0 on success, -1 if failed
+ */
+int sys_sched_rr_set_interval(const struct timespec *interval) {
+    struct timespec ts;
+    struct proc *p = curr_proc();
+    if (copyin(p->pagetable, (char *)&ts, (uint64)interval, sizeof(ts)) != 0) {
+        infof("sys_sched_rr_set_interval: copyin failed");
+        return -1;
+    }
+    if (ts.tv_nsec >= NSEC_PER_SEC) {
+        infof("sys_sched_rr_set_interval: bad tv_nsec");
+        return -1;
+    }
+    // clamp before converting, so that a huge tv_sec can't overflow
+    uint64 sec = MIN(ts.tv_sec, TICK_TO_US(RR_INTERVAL_MAX_TICKS) / USEC_PER_SEC);
+    set_rr_interval(US_TO_TICK(sec * USEC_PER_SEC + ts.tv_nsec / 1000));
+    return 0;
+}
+
+/**
+ * @brief Set the harts pid may run on, bit i for hart i.
+ * Bits past the size of the kernel's mask are ignored.
+ *
+ * @return int 0 on success, -1 if failed
+ */
+int sys_sched_setaffinity(pid_t pid, size_t cpusetsize, void *mask) {
+    uint64 cpu_mask = 0;
+    struct proc *p = curr_proc();
+    if (cpusetsize > sizeof(cpu_mask))
+        cpusetsize = sizeof(cpu_mask);
+    if (copyin(p->pagetable, (char *)&cpu_mask, (uint64)mask, cpusetsize) != 0) {
+        infof("sys_sched_setaffinity: copyin failed");
+        return -1;
+    }
+    return set_affinity(pid, cpu_mask);
+}
+
+/**
+ * @brief Get the harts pid may run on
+ *
+ * @return int the size of the mask written, -1 if failed
+ */
+int sys_sched_getaffinity(pid_t pid, size_t cpusetsize, void *mask) {
+    uint64 cpu_mask;
+    struct proc *p = curr_proc();
+    if (cpusetsize < sizeof(cpu_mask)) {
+        infof("sys_sched_getaffinity: cpusetsize %d is too small", cpusetsize);
+        return -1;
+    }
+    if (get_affinity(pid, &cpu_mask) < 0)
+        return -1;
+    if (copyout(p->pagetable, (uint64)mask, (char *)&cpu_mask, sizeof(cpu_mask)) != 0) {
+        infof("sys_sched_getaffinity: copyout failed");
+        return -1;
+    }
+    return sizeof(cpu_mask);
+}
+
 pid_t sys_getpid() {
     return curr_proc()->pid;
 }
@@ -332,7 +442,7 @@ int64 sys_setpriority(int64 priority) {
     if (2 <= priority) {
         struct proc *p = curr_proc();
         acquire(&p->lock);
-        p->priority = priority;
+        set_priority(p, priority);
         release(&p->lock);
         return priority;
     }
@@ -582,6 +692,12 @@ int sys_munmap(void *start, size_t len) {
     return munmap(p, start, len);
 }
 
+// MS_ASYNC is done synchronously as well
+int sys_msync(void *start, size_t len, int flags) {
+    struct proc *p = curr_proc();
+    return msync(p, start, len);
+}
+
 ssize_t sys_read(int fd, void *dst_va, size_t len) {
     if (fd >= FD_MAX || fd < 0) {
         return -1;
@@ -948,16 +1064,8 @@ uint64 sys_brk(void* addr) {
         infof("sys_brk: addr is below heap start");
         return old_pos;
     }
-    if (new_pos > old_pos) {
-        // allocate memory
-        new_pos = uvmalloc(p->pagetable, old_pos, new_pos);
-    } else {
-        // deallocate memory
-        new_pos = uvmdealloc(p->pagetable, old_pos, new_pos);
-    }
-
-    if (new_pos == 0) {
-        infof("sys_brk: uvmalloc/uvmdealloc failed");
+    if (resize_heap(p, new_pos) < 0) {
+        infof("sys_brk: resize_heap failed");
         return old_pos;
     }
 
@@ -1042,21 +1150,51 @@ int sys_mprotect(void *addr, size_t len, int prot) {
     }
     uint64 start = (uint64)addr;
     uint64 end = PGROUNDUP(start + len);
-    uint npages = (end - start) / PAGE_SIZE;
+    return mprotect(p, start, end, prot);
+}
 
-    // calculate page protection
-    int page_prot = 0;
-    if (prot & PROT_READ) {
-        page_prot |= PTE_R;
+// MADV_WILLNEED reads ahead in the background, MADV_DONTNEED drops
+// private pages, the others steer readahead on faults
+int sys_madvise(void *addr, size_t len, int advice) {
+    struct proc *p = curr_proc();
+    if ((uint64)addr % PAGE_SIZE != 0) {
+        infof("sys_madvise: addr is not aligned");
+        return -1;
     }
-    if (prot & PROT_WRITE) {
-        page_prot |= PTE_W;
+    if (advice < MADV_NORMAL || advice > MADV_DONTNEED) {
+        infof("sys_madvise: advice %d is not supported", advice);
+        return -1;
     }
-    if (prot & PROT_EXEC) {
-        page_prot |= PTE_X;
+    if (len == 0) {
+        return 0;
+    }
+    uint64 start = (uint64)addr;
+    uint64 end = PGROUNDUP(start + len);
+    if (end < start) {
+        infof("sys_madvise: range wraps around");
+        return -1;
     }
+    return madvise(p, start, end, advice);
+}
 
-    return uvmprotect(p->pagetable, start, npages, page_prot);
+int sys_mincore(void *addr, size_t len, uchar *vec_va) {
+    struct proc *p = curr_proc();
+    if ((uint64)addr % PAGE_SIZE != 0) {
+        infof("sys_mincore: addr is not aligned");
+        return -1;
+    }
+    uint64 start = (uint64)addr;
+    uint64 end = PGROUNDUP(start + len);
+    if (end < start) {
+        infof("sys_mincore: range wraps around");
+        return -1;
+    }
+    return mincore(p, start, end, vec_va);
+}
+
+void *sys_mremap(void *old_addr, size_t old_len, size_t new_len, int flags, void *new_addr) {
+    struct proc *p = curr_proc();
+    return mremap(p, (uint64)old_addr, old_len, new_len, flags, (uint64)new_addr);
 }
 
 off_t sys_lseek(int fd, off_t offset, int whence) {
@@ -1183,6 +1321,10 @@ int sys_getrusage(int who, struct rusage *usage_va) {
     usage.ru_utime.tv_usec = user_time % USEC_PER_SEC;
     usage.ru_stime.tv_sec = sys_time / USEC_PER_SEC;
     usage.ru_stime.tv_usec = sys_time % USEC_PER_SEC;
+    usage.ru_majflt = p->majflt;
+    usage.ru_nswap = p->nswap;
+    // minor faults that needed no frame, see uvm_map_zero_page()
+    usage.ru_minflt = p->zero_maps;
 
     if (copyout(p->pagetable, (uint64)usage_va, (char *)&usage, sizeof(struct rusage)) != 0) {
         infof("sys_getrusage: copyout failed");
@@ -25,6 +25,8 @@ struct timespec;
 
 struct fd_set;
 
+struct sched_param;
+
 int sys_execve( char *pathname_va, char * argv_va[], char * envp_va[]);
 
 int sys_exit(int status);
@@ -49,6 +51,18 @@ int sys_dup(int oldfd);
 
 int sys_sched_yield(void);
 
+int sys_sched_setscheduler(pid_t pid, int policy, struct sched_param *param);
+
+int sys_sched_getscheduler(pid_t pid);
+
+int sys_sched_rr_get_interval(pid_t pid, struct timespec *interval);
+
+int sys_sched_rr_set_interval(const struct timespec *interval);
+
+int sys_sched_setaffinity(pid_t pid, size_t cpusetsize, void *mask);
+
+int sys_sched_getaffinity(pid_t pid, size_t cpusetsize, void *mask);
+
 pid_t sys_wait4(pid_t pid, int *wstatus_va, int options, void *rusage);
 
 //int sys_mkdir(char *pathname_va);
@@ -99,12 +113,20 @@ void *sys_mmap(void *start, size_t len, int prot, int flags, int fd, long off);
 
 int sys_munmap(void *start, size_t len);
 
+int sys_msync(void *start, size_t len, int flags);
+
 int sys_writev(int fd, struct iovec *iov, int iovcnt);
 
 int sys_readv(int fd, struct iovec *iov_va, int iovcnt);
 
 int sys_mprotect(void *addr, size_t len, int prot);
 
+int sys_madvise(void *addr, size_t len, int advice);
+
+int sys_mincore(void *addr, size_t len, uchar *vec_va);
+
+void *sys_mremap(void *old_addr, size_t old_len, size_t new_len, int flags, void *new_addr);
+
 int sys_utimensat(int dirfd, const char *pathname, const struct timeval *times, int flags);
 
 int sys_faccessat(int dirfd, char *pathname, int mode, int flags);
@@ -1,4 +1,5 @@
 #include <arch/riscv.h>
+#include <mem/asid.h>
 #include <mem/memory_layout.h>
 #include <proc/proc.h>
 #include <trap/trap.h>
@@ -30,11 +31,35 @@ void set_kerneltrap(void) {
 void kernel_interrupt_handler(uint64 scause, uint64 stval, uint64 sepc) {
     uint64 cause = scause & 0xff;
     int irq;
+    struct proc *p;
     switch (cause) {
     case SupervisorTimer:
         try_wakeup_timer();
         set_next_timer();
+        p = curr_proc();
+        // an idle hart woke up for a timer, see scheduler.c,
+        // or the running proc may go on
+        if (p == NULL || !should_preempt())
+            break;
+        // the interrupted code may be using user pages by physical address
+        p->swap_pin++;
         yield();
+        p->swap_pin--;
+        break;
+    case SupervisorSoft:
+        // a wakeup IPI, it only had to bring an idle hart out of wfi,
+        // a busy one may have to make way for the proc queued behind it
+        w_sip(r_sip() & ~SIP_SSIP);
+        p = curr_proc();
+        if (p == NULL)
+            break;
+        if (!should_preempt()) {
+            set_next_timer();
+            break;
+        }
+        p->swap_pin++;
+        yield();
+        p->swap_pin--;
         break;
     case SupervisorExternal:
         irq = plic_claim();
@@ -69,7 +94,17 @@ void user_interrupt_handler(uint64 scause, uint64 stval, uint64 sepc) {
     case SupervisorTimer:
         try_wakeup_timer();
         set_next_timer();
-        yield();
+        if (should_preempt())
+            yield();
+        break;
+    case SupervisorSoft:
+        // from kill(), usertrap() checks p->killed next,
+        // or a proc was queued behind this one
+        w_sip(r_sip() & ~SIP_SSIP);
+        if (should_preempt())
+            yield();
+        else
+            set_next_timer();
         break;
     case SupervisorExternal:
         irq = plic_claim();
@@ -124,16 +159,26 @@ void user_exception_handler(uint64 scause, uint64 stval, uint64 sepc) {
         syscall();
         break;
     case InstructionPageFault:  // 12
+        intr_on();
+        if (uvm_fault(p, stval, FALSE) == 0)
+            break;
         infof("InstructionPageFault in user application: %p, stval = %p sepc = %p\n", scause, stval, sepc);
         print_user_stack(p);
         exit(-5);
         break;
     case LoadPageFault: // 13
+        intr_on();
+        if (uvm_fault(p, stval, FALSE) == 0)
+            break;
         infof("LoadPageFault in user application: %p, stval = %p sepc = %p\n", scause, stval, sepc);
         print_user_stack(p);
         exit(-2);
         break;
     case StoreAMOPageFault:    //15
+        // a write to a reserved page or one shared since fork
+        intr_on();
+        if (uvm_fault(p, stval, TRUE) == 0)
+            break;
         infof("StorePageFault in user application: %p, stval = %p sepc = %p\n", scause, stval, sepc);
         print_user_stack(p);
         exit(-7);
@@ -195,9 +240,16 @@ void usertrapret() {
     // kerneltrap() to usertrap(), so turn off interrupts until
     // we're back in user space, where usertrap() is correct.
     // intr_off();
+    struct proc *p = curr_proc();
+    // the time since the trap or the dispatch was spent in the kernel
+    uint64 curr_time = get_tick();
+    acquire(&p->lock);
+    p->kernel_time += curr_time - p->last_start_time;
+    p->last_start_time = curr_time;
+    release(&p->lock);
+
     set_usertrap();
     pushtrace(0x3001);
-    struct proc *p = curr_proc();
     struct trapframe *trapframe = p->trapframe;
     trapframe->kernel_satp = r_satp();         // kernel page table
     trapframe->kernel_sp = p->kstack + KSTACK_SIZE; // process's kernel stack
@@ -215,7 +267,7 @@ void usertrapret() {
     w_sstatus(x);
 
     // tell trampoline.S the user page table to switch to.
-    uint64 satp = MAKE_SATP(p->pagetable);
+    uint64 satp = asid_user_satp(p);
 
     // jump to trampoline.S at the top of memory, which
     // switches to the user page table, restores user registers,
@@ -20,6 +20,7 @@ void sbi_console_putchar(int);
 int sbi_console_getchar();
 void shutdown();
 void set_timer(uint64 stime);
+void send_ipi(int hartid);
 
 // printf.c
 void printf(char *, ...);
@@ -72,17 +73,34 @@ int exec(char *name, int argc, const char **argv, int envc, const char **envp);
 int wait(int, int *, int, void*);
 struct proc *alloc_proc();
 void init_scheduler();
+void make_runnable(struct proc *);
+void set_priority(struct proc *, uint64);
+uint64 preempt_deadline();
+int should_preempt();
+void kick_proc(struct proc *);
+int set_affinity(int, uint64);
+int get_affinity(int, uint64 *);
+int set_scheduler(int, int, int);
+int get_scheduler(int, int *);
+uint64 get_rr_interval();
+void set_rr_interval(uint64);
 int fdalloc(struct file *);
 int fdalloc2(struct file *, int);
 
 // physical.c
 uint64 get_free_page_count();
 void *alloc_physical_page(void);
+void *alloc_zeroed_page(void);
+void refill_zeroed_pool(void);
 void recycle_physical_page(void *);
+void *alloc_physical_pages(int order);
+void free_physical_pages(void *pa, int order);
+void detect_memory(uint64);
 void kinit(void);
 void dup_physical_page(void *pa);
 void put_physical_page(void *pa);
-uint8 get_physical_page_ref(void *pa);
+void put_physical_pages(void *pa, int order);
+uint32 get_physical_page_ref(void *pa);
 
 // kill.c
 int kill(int pid);
@@ -93,20 +111,25 @@ void kvmmap(pagetable_t, uint64, uint64, uint64, int);
 int mappages(pagetable_t, uint64, uint64, uint64, int);
 pagetable_t create_empty_user_pagetable(void);
 uint64 uvmalloc(pagetable_t, uint64, uint64);
+uint64 uvmreserve(pagetable_t, uint64, uint64, int);
+int uvmsync(pagetable_t pagetable, uint64 va, uint64 npages);
 uint64 uvmdealloc(pagetable_t, uint64, uint64);
-int uvmcopy(pagetable_t, pagetable_t, uint64);
 int uvmmap_dup(pagetable_t old_pagetable, pagetable_t new_pagetable, uint64 va, uint npages, bool shared);
-int uvmprotect(pagetable_t pagetable, uint64 va, uint npages, uint perm);
-void free_user_mem_and_pagetables(pagetable_t, uint64);
+int uvmprotect(pagetable_t pagetable, uint64 va, uint npages, uint perm, bool cow);
+int uvm_cow_fault(pagetable_t pagetable, uint64 va);
+int uvm_map_zero_page(struct proc *p, uint64 va);
+int uvmmove(pagetable_t pagetable, uint64 old, uint64 new, uint64 npages);
+int uvm_fault(struct proc *p, uint64 va, int write);
 void uvmunmap(pagetable_t, uint64, uint64, int);
 void uvmclear(pagetable_t, uint64);
-uint64 walkaddr(pagetable_t, uint64);
+uint64 walkaddr(pagetable_t, uint64, int);
 uint64 walkaddr_k(pagetable_t pagetable, uint64 va);
-uint64 virt_addr_to_physical(pagetable_t, uint64);
+uint64 virt_addr_to_physical(pagetable_t, uint64, int);
 int copyout(pagetable_t, uint64, char *, uint64);
 int copyin(pagetable_t, char *, uint64, uint64);
 int copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max);
 int map1page(pagetable_t pagetable, uint64 va, uint64 pa, int perm);
+int map1hugepage(pagetable_t pagetable, uint64 va, uint64 pa, int perm);
 pte_t *walk(pagetable_t pagetable, uint64 va, int alloc);
 void kvminithart();
 void free_pagetable_pages(pagetable_t pagetable);
@@ -145,6 +168,7 @@ void plic_complete(int);
 // virtio_disk.c
 void virtio_disk_init(void);
 void virtio_disk_rw(struct buf *, int);
+void virtio_disk_rw_sectors(void *data, uint64 sector, uint32 nsect, int write);
 void virtio_disk_intr(void);
 
 
@@ -167,6 +191,12 @@ struct inode *inode_by_name(char *);
 struct inode *root_dir();
 struct page_cache* ctable_acquire(struct inode* ip, uint offset);
 void ctable_release(struct inode *ip);
+void ctable_mark_dirty(void *pa);
+int ctable_sync(void *pa);
+int ctable_cached(struct inode *ip, uint offset);
+void ctable_readahead(struct inode *ip, uint offset, uint npages);
+void ctable_readahead_async(struct inode *ip, uint offset, uint npages);
+void readahead_init();
 
 void itrunc(struct inode *);
 
@@ -0,0 +1,102 @@
+// Minimal flattened device tree reader.
+// Only walks the structure block far enough to find the /memory node,
+// which is all the kernel needs before the frame allocator is up.
+// Runs with paging off, so the blob is accessed by its physical address.
+
+#include <ucore/defs.h>
+#include <utils/fdt.h>
+
+static uint32 be32(const void *p) {
+    const uchar *b = p;
+    return ((uint32)b[0] << 24) | ((uint32)b[1] << 16) | ((uint32)b[2] << 8) | b[3];
+}
+
+// read a value of `cells` 32-bit cells
+static uint64 read_cells(const uchar *p, uint32 cells) {
+    uint64 v = 0;
+    for (uint32 i = 0; i < cells; i++) {
+        v = (v << 32) | be32(p + 4 * i);
+    }
+    return v;
+}
+
+static int fdt_valid(uint64 dtb) {
+    return dtb != 0 && (dtb & 3) == 0 && be32(&((struct fdt_header *)dtb)->magic) == FDT_MAGIC;
+}
+
+/**
+ * @brief Size of the device tree blob in bytes
+ *
+ * @return 0 if dtb does not point to a device tree
+ */
+uint64 fdt_totalsize(uint64 dtb) {
+    if (!fdt_valid(dtb))
+        return 0;
+    return be32(&((struct fdt_header *)dtb)->totalsize);
+}
+
+static int is_memory_node(const char *name) {
+    return strncmp(name, "memory", 6) == 0 && (name[6] == '\0' || name[6] == '@');
+}
+
+/**
+ * @brief Find the first region of the /memory node
+ *
+ * @param base set to the physical start address of the region
+ * @param size set to the length of the region in bytes
+ * @return 0 on success, -1 if the blob is invalid or has no memory node
+ */
+int fdt_find_memory(uint64 dtb, uint64 *base, uint64 *size) {
+    if (!fdt_valid(dtb))
+        return -1;
+    struct fdt_header *hdr = (struct fdt_header *)dtb;
+    const uchar *st = (const uchar *)dtb + be32(&hdr->off_dt_struct);
+    const char *strings = (const char *)dtb + be32(&hdr->off_dt_strings);
+    uint32 st_size = be32(&hdr->size_dt_struct);
+
+    // defaults from the devicetree spec, overridden by the root node
+    uint32 address_cells = 2, size_cells = 1;
+    int depth = 0;
+    int in_memory = FALSE;
+    uint32 off = 0;
+    while (off + 4 <= st_size) {
+        uint32 token = be32(st + off);
+        off += 4;
+        switch (token) {
+        case FDT_BEGIN_NODE: {
+            const char *name = (const char *)st + off;
+            depth++;
+            in_memory = depth == 2 && is_memory_node(name);
+            off += (strlen(name) + 1 + 3) & ~3U;
+            break;
+        }
+        case FDT_END_NODE:
+            depth--;
+            in_memory = FALSE;
+            break;
+        case FDT_PROP: {
+            uint32 len = be32(st + off);
+            const char *pname = strings + be32(st + off + 4);
+            const uchar *val = st + off + 8;
+            off += 8 + ((len + 3) & ~3U);
+            if (depth == 1 && strncmp(pname, "#address-cells", 15) == 0)
+                address_cells = be32(val);
+            else if (depth == 1 && strncmp(pname, "#size-cells", 12) == 0)
+                size_cells = be32(val);
+            else if (in_memory && strncmp(pname, "reg", 4) == 0
+                     && len >= 4 * (address_cells + size_cells)) {
+                *base = read_cells(val, address_cells);
+                *size = read_cells(val + 4 * address_cells, size_cells);
+                return 0;
+            }
+            break;
+        }
+        case FDT_NOP:
+            break;
+        case FDT_END:
+        default:
+            return -1;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,32 @@
+#if !defined(FDT_H)
+#define FDT_H
+
+#include <ucore/types.h>
+
+// flattened device tree, as handed over by the firmware in a1
+#define FDT_MAGIC 0xd00dfeed
+
+#define FDT_BEGIN_NODE 0x1
+#define FDT_END_NODE 0x2
+#define FDT_PROP 0x3
+#define FDT_NOP 0x4
+#define FDT_END 0x9
+
+// all fields are big-endian
+struct fdt_header {
+    uint32 magic;
+    uint32 totalsize;
+    uint32 off_dt_struct;
+    uint32 off_dt_strings;
+    uint32 off_mem_rsvmap;
+    uint32 version;
+    uint32 last_comp_version;
+    uint32 boot_cpuid_phys;
+    uint32 size_dt_strings;
+    uint32 size_dt_struct;
+};
+
+uint64 fdt_totalsize(uint64 dtb);
+int fdt_find_memory(uint64 dtb, uint64 *base, uint64 *size);
+
+#endif // FDT_H
@@ -0,0 +1,69 @@
+#if !defined(LIST_H)
+#define LIST_H
+
+#include <ucore/ucore.h>
+
+// intrusive circular doubly linked list,
+// embed a struct list_head in the object and use list_entry() to get it back
+struct list_head {
+    struct list_head *next;
+    struct list_head *prev;
+};
+
+#define list_entry(ptr, type, member) container_of(ptr, type, member)
+
+#define list_first_entry(head, type, member) list_entry((head)->next, type, member)
+
+#define list_last_entry(head, type, member) list_entry((head)->prev, type, member)
+
+#define list_for_each(pos, head) \
+    for (pos = (head)->next; pos != (head); pos = pos->next)
+
+// safe against removal of pos
+#define list_for_each_safe(pos, n, head) \
+    for (pos = (head)->next, n = pos->next; pos != (head); pos = n, n = pos->next)
+
+// walk backwards, safe against removal of pos
+#define list_for_each_prev_safe(pos, n, head) \
+    for (pos = (head)->prev, n = pos->prev; pos != (head); pos = n, n = pos->prev)
+
+static inline void list_init(struct list_head *head) {
+    head->next = head;
+    head->prev = head;
+}
+
+static inline int list_empty(const struct list_head *head) {
+    return head->next == head;
+}
+
+static inline void __list_add(struct list_head *new, struct list_head *prev, struct list_head *next) {
+    next->prev = new;
+    new->next = next;
+    new->prev = prev;
+    prev->next = new;
+}
+
+// insert new right after head
+static inline void list_add(struct list_head *new, struct list_head *head) {
+    __list_add(new, head, head->next);
+}
+
+// insert new right before head, i.e. at the tail
+static inline void list_add_tail(struct list_head *new, struct list_head *head) {
+    __list_add(new, head->prev, head);
+}
+
+// unlink entry and leave it pointing to itself
+static inline void list_del(struct list_head *entry) {
+    entry->next->prev = entry->prev;
+    entry->prev->next = entry->next;
+    list_init(entry);
+}
+
+// move entry to the front of head
+static inline void list_move(struct list_head *entry, struct list_head *head) {
+    list_del(entry);
+    list_add(entry, head);
+}
+
+#endif // LIST_H
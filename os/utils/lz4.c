@@ -0,0 +1,148 @@
+// LZ4 block compression, see
+// https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+// Every sequence is a token, literals and a match 4 or more bytes long
+// at most 64 KiB back. The last 5 bytes are always literals and the
+// last match starts at least 12 bytes before the end.
+
+#include <ucore/defs.h>
+#include <utils/lz4.h>
+
+#define MIN_MATCH 4
+#define LAST_LITERALS 5
+#define MF_LIMIT 12
+#define MAX_OFFSET 65535
+#define RUN_MASK 15
+
+static uint32 read32(const uchar *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32)p[3] << 24);
+}
+
+static uint32 hash(uint32 v) {
+    return (v * 2654435761U) >> (32 - LZ4_HASH_BITS);
+}
+
+// a length of 15 or more continues in bytes of 255 and a remainder
+static uchar *write_length(uchar *op, uint len) {
+    for (; len >= 255; len -= 255)
+        *op++ = 255;
+    *op++ = len;
+    return op;
+}
+
+// Append literals [anchor, ip) and, if match_len, a match at offset.
+// Returns the new end of the output, NULL if it does not fit.
+static uchar *write_sequence(uchar *op, uchar *oend, const uchar *anchor, const uchar *ip,
+                             uint offset, uint match_len) {
+    uint lit = ip - anchor;
+    uint ml = match_len ? match_len - MIN_MATCH : 0;
+    // token, lengths, literals and offset in the worst case
+    if (op + 1 + lit / 255 + 1 + lit + 2 + ml / 255 + 1 > oend)
+        return NULL;
+    uchar *token = op++;
+    *token = (lit >= RUN_MASK ? RUN_MASK : lit) << 4;
+    if (lit >= RUN_MASK)
+        op = write_length(op, lit - RUN_MASK);
+    memmove(op, anchor, lit);
+    op += lit;
+    if (match_len == 0)
+        return op;
+    *op++ = offset;
+    *op++ = offset >> 8;
+    *token |= ml >= RUN_MASK ? RUN_MASK : ml;
+    if (ml >= RUN_MASK)
+        op = write_length(op, ml - RUN_MASK);
+    return op;
+}
+
+/**
+ * @brief Compress len bytes (below 64 KiB) from src into dst
+ *
+ * @param table scratch space, need not be initialized
+ * @return int compressed size, 0 if it exceeds cap
+ */
+int lz4_compress(const void *src, int len, void *dst, int cap, lz4_table_t table) {
+    const uchar *in = src, *ip = in, *anchor = in, *end = in + len;
+    const uchar *mf_limit = end - MF_LIMIT, *match_limit = end - LAST_LITERALS;
+    uchar *op = dst, *oend = op + cap;
+
+    memset(table, 0, sizeof(lz4_table_t));
+    while (len >= MF_LIMIT && ip < mf_limit) {
+        uint32 h = hash(read32(ip));
+        const uchar *ref = in + table[h];
+        table[h] = ip - in;
+        if (ref >= ip || ip - ref > MAX_OFFSET || read32(ref) != read32(ip)) {
+            // skip faster through data that does not compress
+            ip += 1 + ((ip - anchor) >> 6);
+            continue;
+        }
+        while (ip > anchor && ref > in && ip[-1] == ref[-1]) {
+            ip--;
+            ref--;
+        }
+        const uchar *m = ip + MIN_MATCH, *r = ref + MIN_MATCH;
+        while (m < match_limit && *m == *r) {
+            m++;
+            r++;
+        }
+        if ((op = write_sequence(op, oend, anchor, ip, ip - ref, m - ip)) == NULL)
+            return 0;
+        ip = anchor = m;
+    }
+    if ((op = write_sequence(op, oend, anchor, end, 0, 0)) == NULL)
+        return 0;
+    return op - (uchar *)dst;
+}
+
+// read the rest of a length that filled its token field
+static const uchar *read_length(const uchar *ip, const uchar *iend, uint *len) {
+    uchar b;
+    do {
+        if (ip >= iend)
+            return NULL;
+        b = *ip++;
+        *len += b;
+    } while (b == 255);
+    return ip;
+}
+
+/**
+ * @brief Decompress the len bytes at src into dst, checking every bound
+ *
+ * @return int decompressed size, -1 if src is malformed or exceeds cap
+ */
+int lz4_decompress(const void *src, int len, void *dst, int cap) {
+    const uchar *ip = src, *iend = ip + len;
+    uchar *op = dst, *oend = op + cap;
+
+    while (ip < iend) {
+        uchar token = *ip++;
+        uint lit = token >> 4;
+        if (lit == RUN_MASK && (ip = read_length(ip, iend, &lit)) == NULL)
+            return -1;
+        if (lit > iend - ip || lit > oend - op)
+            return -1;
+        memmove(op, ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return -1;
+        uint offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op - (uchar *)dst)
+            return -1;
+        uint ml = token & RUN_MASK;
+        if (ml == RUN_MASK && (ip = read_length(ip, iend, &ml)) == NULL)
+            return -1;
+        ml += MIN_MATCH;
+        if (ml > oend - op)
+            return -1;
+        // the match may overlap what it produces
+        const uchar *ref = op - offset;
+        while (ml-- > 0)
+            *op++ = *ref++;
+    }
+    return op - (uchar *)dst;
+}
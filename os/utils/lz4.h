@@ -0,0 +1,16 @@
+#if !defined(LZ4_H)
+#define LZ4_H
+
+#include <ucore/types.h>
+
+// LZ4 block format, without the frame around it
+#define LZ4_HASH_BITS 12
+#define LZ4_HASH_SIZE (1 << LZ4_HASH_BITS)
+
+// positions of recently seen 4-byte sequences, inputs are below 64 KiB
+typedef uint16 lz4_table_t[LZ4_HASH_SIZE];
+
+int lz4_compress(const void *src, int len, void *dst, int cap, lz4_table_t table);
+int lz4_decompress(const void *src, int len, void *dst, int cap);
+
+#endif // LZ4_H
@@ -134,6 +134,7 @@ struct linux_dirent64 {
 #define MAP_FILE 0
 #define MAP_SHARED 0x01
 #define MAP_PRIVATE 0X02
+#define MAP_ANONYMOUS 0x20
 #define MAP_FAILED ((void *) -1)
 
 // for clone
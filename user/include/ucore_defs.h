@@ -28,10 +28,25 @@ struct dirent {
     char name[DIRSIZ];
 };
 
+// scheduling policies
+#define SCHED_OTHER 0
+#define SCHED_FIFO 1
+#define SCHED_RR 2
+
+struct sched_param {
+    int sched_priority; // 1 to 99 for SCHED_FIFO and SCHED_RR, 0 otherwise
+};
+
 struct cpu_stat {
     uint64 uptime;
     uint64 sample_duration;
     uint64 sample_busy_duration;
+    uint64 nr_queued;     // procs waiting in its run queue
+    uint64 nr_migrations; // procs it stole from other harts
+    uint64 idle_time;     // us spent waiting for work
+    uint64 nr_wakeups;    // times another hart woke it up for work
+    uint64 wakeup_time;   // us from those wakeups until it ran
+    uint64 nr_rt_throttled; // periods real-time procs used up their budget in
 };
 
 
@@ -50,5 +65,7 @@ struct proc_stat
     uint64 heap_sz;
     uint64 total_size;
     uint64 cpu_time; // ms, user and kernel
+    uint64 nr_migrations; // times it ran on another hart than the last time
+    int last_cpu;         // hart it last ran on, -1 if none
 };
 #endif // UCORE_DEFS_H
@@ -56,6 +56,10 @@ int64 setpriority(int64 priority);
 
 int64 getpriority();
 
+int sched_setscheduler(pid_t pid, int policy, const struct sched_param *param);
+
+int sched_getscheduler(pid_t pid);
+
 void* sharedmem(char* name, size_t len);
 
 //////////////////////[NEW] 
@@ -74,6 +78,8 @@ int openat(int fd, const char *pathname, int flags);
 
 int64 get_time();
 
+int sys_get_time(TimeVal *ts, int tz);
+
 int brk(void *addr);
 
 void *mmap(void *start, size_t len, int prot, int flags, int fd, off_t off);
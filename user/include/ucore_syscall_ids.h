@@ -22,7 +22,12 @@
 #define SYS_exit 93 // todo
 #define SYS_waitpid 95
 #define SYS_nanosleep 101 // new
+#define SYS_sched_setscheduler 119
+#define SYS_sched_getscheduler 120
+#define SYS_sched_setaffinity 122
+#define SYS_sched_getaffinity 123
 #define SYS_sched_yield 124 // todo
+#define SYS_sched_rr_get_interval 127
 #define SYS_kill 129
 #define SYS_setpriority 140
 #define SYS_getpriority 141
@@ -44,6 +49,7 @@
 #define SYS_spawn 400
 #define SYS_mailread 401
 #define SYS_mailwrite 402
+#define SYS_sched_rr_set_interval 403
 
 
 
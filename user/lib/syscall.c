@@ -138,6 +138,14 @@ int64 getpriority(){
     return syscall(SYS_getpriority);
 }
 
+int sched_setscheduler(pid_t pid, int policy, const struct sched_param *param){
+    return syscall(SYS_sched_setscheduler, pid, policy, param);
+}
+
+int sched_getscheduler(pid_t pid){
+    return syscall(SYS_sched_getscheduler, pid);
+}
+
 void* sharedmem(char* name, size_t len){
     return (void*) syscall(SYS_sharedmem, name, len);
 }
@@ -0,0 +1,95 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include "ucore.h"
+#include "string.h"
+#include "fcntl.h"
+
+/*
+ * fork + execve + wait latency, and how much memory a fork costs.
+ * Run with no argument; the exec'ed child is this program with "child".
+ * Output:
+ * "fork+exit: [num] us/iter"
+ * "fork+execve: [num] us/iter"
+ * "fork cost: [num] kB"	needs /proc/meminfo, see test_runner
+ */
+
+#define ITERS 100
+
+static char meminfo[2048];
+
+// MemAvailable in kB, -1 if /proc/meminfo is missing
+static int mem_available(void) {
+    int fd = open("/proc/meminfo", O_RDONLY);
+    if (fd < 0)
+        return -1;
+    int n = read(fd, meminfo, sizeof(meminfo) - 1);
+    close(fd);
+    if (n <= 0)
+        return -1;
+    meminfo[n] = '\0';
+    char *p = meminfo;
+    while (*p && *p != ':')
+        p++;
+    while (*p == ':' || *p == ' ')
+        p++;
+    return atoi(p);
+}
+
+static void bench_fork_exit(void) {
+    int wstatus;
+    int64 start = get_time();
+    for (int i = 0; i < ITERS; i++) {
+        int pid = fork();
+        assert(pid >= 0);
+        if (pid == 0)
+            exit(0);
+        waitpid(pid, &wstatus, 0);
+    }
+    int64 end = get_time();
+    printf("fork+exit: %d us/iter\n", (int)((end - start) * 1000 / ITERS));
+}
+
+static void bench_fork_execve(void) {
+    int wstatus;
+    char *argv[] = {"forkexec_bench", "child", NULL};
+    char *envp[] = {NULL};
+    int64 start = get_time();
+    for (int i = 0; i < ITERS; i++) {
+        int pid = fork();
+        assert(pid >= 0);
+        if (pid == 0) {
+            execve(argv[0], argv, envp);
+            printf("forkexec_bench: execve error\n");
+            exit(-1);
+        }
+        waitpid(pid, &wstatus, 0);
+    }
+    int64 end = get_time();
+    printf("fork+execve: %d us/iter\n", (int)((end - start) * 1000 / ITERS));
+}
+
+// the child reports how much free memory dropped across the fork
+static void bench_fork_memory(void) {
+    int wstatus;
+    int before = mem_available();
+    if (before < 0) {
+        printf("fork cost: n/a\n");
+        return;
+    }
+    int pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        printf("fork cost: %d kB\n", before - mem_available());
+        exit(0);
+    }
+    waitpid(pid, &wstatus, 0);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1 && strcmp(argv[1], "child") == 0)
+        return 0;
+    bench_fork_memory();
+    bench_fork_exit();
+    bench_fork_execve();
+    return 0;
+}
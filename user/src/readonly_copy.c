@@ -0,0 +1,89 @@
+#include "ucore.h"
+#include "string.h"
+#include "stdio.h"
+#include "stdlib.h"
+
+/*
+ * The kernel must not write into a page the process can only read:
+ * a read-only page may be the zero page shared by every process, or a
+ * page shared with a fork child. read() into one fails instead.
+ * 测试成功时输出：
+ * "read into PROT_READ mapping: -1"
+ * "zero page intact"
+ * "read into page shared by fork: -1"
+ * "shared page intact"
+ */
+#define PAGE_SIZE 4096
+
+static const char *str = "  Hello, read-only page!";
+
+// a pipe holding one page of 'x'
+static int filled_pipe(void) {
+    static char buf[PAGE_SIZE];
+    int fds[2];
+    assert(pipe(fds) == 0);
+    memset(buf, 'x', PAGE_SIZE);
+    write(fds[1], buf, PAGE_SIZE);
+    close(fds[1]);
+    return fds[0];
+}
+
+static int all_zero(const char *p) {
+    for (int i = 0; i < PAGE_SIZE; i++) {
+        if (p[i] != 0)
+            return 0;
+    }
+    return 1;
+}
+
+static void readonly_anonymous(void) {
+    char *ro = mmap(NULL, PAGE_SIZE, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert(ro != MAP_FAILED);
+    // a read fault maps the zero page here
+    assert(ro[0] == 0);
+    int fd = filled_pipe();
+    printf("read into PROT_READ mapping: %d\n", read(fd, ro, PAGE_SIZE));
+    close(fd);
+
+    char *fresh = mmap(NULL, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert(fresh != MAP_FAILED);
+    if (all_zero(ro) && all_zero(fresh))
+        printf("zero page intact\n");
+    munmap(fresh, PAGE_SIZE);
+    munmap(ro, PAGE_SIZE);
+}
+
+static void readonly_forked(void) {
+    int fd = open("test_readonly.txt", O_RDWR | O_CREATE);
+    write(fd, str, strlen(str));
+    char *ro = mmap(NULL, PAGE_SIZE, PROT_READ, MAP_FILE | MAP_PRIVATE, fd, 0);
+    assert(ro != MAP_FAILED);
+    close(fd);
+    assert(ro[0] == str[0]);
+
+    int pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        // the page is shared with the parent, not copied on write
+        int in = filled_pipe();
+        printf("read into page shared by fork: %d\n", read(in, ro, PAGE_SIZE));
+        exit(0);
+    }
+    int wstatus;
+    waitpid(pid, &wstatus, 0);
+    if (strncmp(ro, str, strlen(str)) == 0)
+        printf("shared page intact\n");
+    munmap(ro, PAGE_SIZE);
+}
+
+void test_readonly_copy(void) {
+    TEST_START(__func__);
+    readonly_anonymous();
+    readonly_forked();
+    TEST_END(__func__);
+}
+
+int main(void) {
+    test_readonly_copy();
+    return 0;
+}
@@ -0,0 +1,13 @@
+from test_base import TestBase
+
+
+class readonly_copy_test(TestBase):
+    def __init__(self):
+        super().__init__("readonly_copy", 4)
+
+    def test(self, data):
+        self.assert_ge(len(data), 4)
+        self.assert_equal(data[0], "read into PROT_READ mapping: -1")
+        self.assert_equal(data[1], "zero page intact")
+        self.assert_equal(data[2], "read into page shared by fork: -1")
+        self.assert_equal(data[3], "shared page intact")
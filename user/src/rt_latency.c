@@ -0,0 +1,91 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include "ucore.h"
+
+/*
+ * Wakeup to run latency: how long a process blocked in read() on a pipe
+ * takes to run once the data is written, while BATCH_PROCS processes
+ * spin. Measured with the reader as SCHED_OTHER and as SCHED_FIFO.
+ * Output:
+ * "[policy]: avg [num] us, max [num] us"
+ */
+
+#define ROUNDS 100
+#define BATCH_PROCS 8
+#define GAP_US 2000 // between wakeups, so the reader is blocked again
+#define RT_PRIORITY 50
+
+static int64 now_us(void) {
+    TimeVal tv;
+    sys_get_time(&tv, 0);
+    return tv.sec * 1000000 + tv.usec;
+}
+
+static void spin_until(int64 deadline) {
+    while (now_us() < deadline)
+        ;
+}
+
+// the reader gets the time the writer woke it at and reports
+// the total and the worst latency back
+static void reader(int policy, int in, int out) {
+    if (policy != SCHED_OTHER) {
+        struct sched_param param = {.sched_priority = RT_PRIORITY};
+        assert(sched_setscheduler(0, policy, &param) == 0);
+    }
+    int64 stat[2] = {0, 0};
+    for (int i = 0; i < ROUNDS; i++) {
+        int64 sent;
+        assert(read(in, &sent, sizeof(sent)) == sizeof(sent));
+        int64 latency = now_us() - sent;
+        stat[0] += latency;
+        if (latency > stat[1])
+            stat[1] = latency;
+    }
+    write(out, stat, sizeof(stat));
+    exit(0);
+}
+
+static void measure(int policy, const char *name) {
+    int wake[2], result[2];
+    int wstatus;
+    assert(pipe(wake) == 0 && pipe(result) == 0);
+    int64 stop = now_us() + (int64)ROUNDS * GAP_US * 2;
+    int batch[BATCH_PROCS];
+    for (int i = 0; i < BATCH_PROCS; i++) {
+        batch[i] = fork();
+        assert(batch[i] >= 0);
+        if (batch[i] == 0) {
+            spin_until(stop);
+            exit(0);
+        }
+    }
+    int pid = fork();
+    assert(pid >= 0);
+    if (pid == 0)
+        reader(policy, wake[0], result[1]);
+
+    for (int i = 0; i < ROUNDS; i++) {
+        spin_until(now_us() + GAP_US);
+        int64 sent = now_us();
+        write(wake[1], &sent, sizeof(sent));
+    }
+    int64 stat[2];
+    assert(read(result[0], stat, sizeof(stat)) == sizeof(stat));
+    printf("%s: avg %d us, max %d us\n", name, (int)(stat[0] / ROUNDS), (int)stat[1]);
+
+    waitpid(pid, &wstatus, 0);
+    for (int i = 0; i < BATCH_PROCS; i++) {
+        waitpid(batch[i], &wstatus, 0);
+    }
+    close(wake[0]);
+    close(wake[1]);
+    close(result[0]);
+    close(result[1]);
+}
+
+int main(void) {
+    measure(SCHED_OTHER, "SCHED_OTHER");
+    measure(SCHED_FIFO, "SCHED_FIFO");
+    return 0;
+}
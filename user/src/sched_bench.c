@@ -0,0 +1,61 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include "ucore.h"
+
+/*
+ * Cost of a scheduling round trip through sched_yield(), with one
+ * runnable process and with NPROCS of them competing for the harts.
+ * Output:
+ * "yield x1: [num] ns/yield"
+ * "yield x[num]: [num] ns/yield"
+ */
+
+#define NPROCS 200
+#define ITERS 20000
+#define CHILD_ITERS 200
+
+static void bench_yield_alone(void) {
+    int64 start = get_time();
+    for (int i = 0; i < ITERS; i++) {
+        sched_yield();
+    }
+    int64 end = get_time();
+    printf("yield x1: %d ns/yield\n", (int)((end - start) * 1000000 / ITERS));
+}
+
+// the children wait for the last one to be forked before they start
+static void bench_yield_crowd(void) {
+    int pids[NPROCS];
+    int wstatus;
+    int pipefd[2];
+    assert(pipe(pipefd) == 0);
+    for (int i = 0; i < NPROCS; i++) {
+        pids[i] = fork();
+        assert(pids[i] >= 0);
+        if (pids[i] == 0) {
+            char c;
+            close(pipefd[1]);
+            read(pipefd[0], &c, 1);
+            for (int j = 0; j < CHILD_ITERS; j++) {
+                sched_yield();
+            }
+            exit(0);
+        }
+    }
+    close(pipefd[0]);
+    int64 start = get_time();
+    // closing the write end wakes them all at once
+    close(pipefd[1]);
+    for (int i = 0; i < NPROCS; i++) {
+        waitpid(pids[i], &wstatus, 0);
+    }
+    int64 end = get_time();
+    printf("yield x%d: %d ns/yield\n", NPROCS,
+           (int)((end - start) * 1000000 / ((int64)NPROCS * CHILD_ITERS)));
+}
+
+int main(void) {
+    bench_yield_alone();
+    bench_yield_crowd();
+    return 0;
+}
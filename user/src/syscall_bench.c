@@ -0,0 +1,51 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include "ucore.h"
+
+/*
+ * Syscall round trip latency, alone and with a working set that has
+ * to survive in the TLB across the trap.
+ * Output:
+ * "getppid: [num] ns/call"
+ * "getppid+touch [num] pages: [num] ns/iter"
+ */
+
+#define ITERS 100000
+#define TOUCH_ITERS 20000
+#define TOUCH_PAGES 32
+#define PAGE_SIZE 4096
+
+static char pages[TOUCH_PAGES * PAGE_SIZE];
+
+static void bench_null_syscall(void) {
+    int64 start = get_time();
+    for (int i = 0; i < ITERS; i++) {
+        getppid();
+    }
+    int64 end = get_time();
+    printf("getppid: %d ns/call\n", (int)((end - start) * 1000000 / ITERS));
+}
+
+// every iteration needs TOUCH_PAGES translations again after the trap
+static void bench_syscall_touch(void) {
+    volatile char *p = pages;
+    for (int j = 0; j < TOUCH_PAGES; j++) {
+        p[j * PAGE_SIZE] = 1;
+    }
+    int64 start = get_time();
+    for (int i = 0; i < TOUCH_ITERS; i++) {
+        getppid();
+        for (int j = 0; j < TOUCH_PAGES; j++) {
+            p[j * PAGE_SIZE]++;
+        }
+    }
+    int64 end = get_time();
+    printf("getppid+touch %d pages: %d ns/iter\n", TOUCH_PAGES,
+           (int)((end - start) * 1000000 / TOUCH_ITERS));
+}
+
+int main(void) {
+    bench_null_syscall();
+    bench_syscall_touch();
+    return 0;
+}
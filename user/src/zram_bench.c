@@ -0,0 +1,130 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include "ucore.h"
+#include "string.h"
+#include "fcntl.h"
+
+/*
+ * Swapping to zram under memory pressure. The parent fills a heap with
+ * text-like data and waits while a child allocates more than is free,
+ * which swaps the parent out. The parent then reads its heap back.
+ * Run with no argument; the child is this program with "hog [kB]".
+ * Output:
+ * "zram: [num] kB stored in [num] kB, [num]% of original"
+ * "swap-in: [num] pages, [num] us/fault"
+ * "verify: ok"
+ * Needs /proc/meminfo, see test_runner.
+ */
+
+#define HEAP_KB (32 * 1024)
+#define EXTRA_KB (16 * 1024) // what the child takes beyond free memory
+#define PAGE_SIZE 4096
+
+static char meminfo[2048];
+
+// value of the /proc/meminfo field name, -1 if missing
+static int meminfo_field(const char *name) {
+    int fd = open("/proc/meminfo", O_RDONLY);
+    if (fd < 0)
+        return -1;
+    int n = read(fd, meminfo, sizeof(meminfo) - 1);
+    close(fd);
+    if (n <= 0)
+        return -1;
+    meminfo[n] = '\0';
+    int len = strlen(name);
+    for (char *p = meminfo; *p; p++) {
+        if ((p == meminfo || p[-1] == '\n') && strncmp(p, name, len) == 0 && p[len] == ':') {
+            p += len + 1;
+            while (*p == ' ')
+                p++;
+            return atoi(p);
+        }
+    }
+    return -1;
+}
+
+// compresses to roughly a third, like text or zeroed structures
+static char fill_byte(int page, int i) {
+    static const char words[] = "lorem ipsum dolor sit amet ";
+    if (i % 16 == 0)
+        return (page * 7919 + i * 31) & 0xff;
+    return words[(page + i) % (sizeof(words) - 1)];
+}
+
+static char *grow_heap(int kb) {
+    char *start = (char *)(intptr_t)brk(0);
+    if (brk(start + kb * 1024L) != (intptr_t)(start + kb * 1024L))
+        return NULL;
+    return start;
+}
+
+static int hog(int kb) {
+    char *p = grow_heap(kb);
+    if (p == NULL)
+        return 1;
+    for (long i = 0; i < kb * 1024L; i += PAGE_SIZE)
+        p[i] = 1;
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 2 && strcmp(argv[1], "hog") == 0)
+        return hog(atoi(argv[2]));
+    if (meminfo_field("SwapIn") < 0) {
+        printf("zram_bench: n/a\n");
+        return 0;
+    }
+
+    int npages = HEAP_KB * 1024 / PAGE_SIZE;
+    char *heap = grow_heap(HEAP_KB);
+    assert(heap != NULL);
+    for (int pg = 0; pg < npages; pg++) {
+        for (int i = 0; i < PAGE_SIZE; i++)
+            heap[pg * PAGE_SIZE + i] = fill_byte(pg, i);
+    }
+
+    // a fresh image, so that the child shares none of our pages
+    char size[16];
+    int kb = meminfo_field("MemAvailable") + EXTRA_KB;
+    char *p = size + sizeof(size) - 1;
+    *p = '\0';
+    do {
+        *--p = '0' + kb % 10;
+        kb /= 10;
+    } while (kb > 0);
+    char *cargv[] = {"zram_bench", "hog", p, NULL};
+    char *envp[] = {NULL};
+    int wstatus;
+    int pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        execve(cargv[0], cargv, envp);
+        printf("zram_bench: execve error\n");
+        exit(-1);
+    }
+    waitpid(pid, &wstatus, 0);
+    if (WEXITSTATUS(wstatus) != 0)
+        printf("zram_bench: child failed to allocate\n");
+
+    int stored = meminfo_field("Zram");
+    int used = meminfo_field("ZramUsed");
+    printf("zram: %d kB stored in %d kB, %d%% of original\n", stored, used,
+           stored > 0 ? used * 100 / stored : 0);
+
+    int swap_in = meminfo_field("SwapIn");
+    int64 start = get_time();
+    int errors = 0;
+    for (int pg = 0; pg < npages; pg++) {
+        for (int i = 0; i < PAGE_SIZE; i++) {
+            if (heap[pg * PAGE_SIZE + i] != fill_byte(pg, i))
+                errors++;
+        }
+    }
+    int64 end = get_time();
+    int faults = meminfo_field("SwapIn") - swap_in;
+    printf("swap-in: %d pages, %d us/fault\n", faults,
+           faults > 0 ? (int)((end - start) * 1000 / faults) : 0);
+    printf("verify: %s\n", errors == 0 ? "ok" : "corrupt");
+    return 0;
+}